@@ -1,225 +1,577 @@
-
 #include "ARM7.h"
+#include "Recompiler.h"
+#include <array>
+#include <bit>
+#include <utility>
 
-// ARM standard
-const Instruction ARM_UND(UND, "UND", 0, 0x0E000010, 0x06000010, "Undefined");
-const Instruction ARM_B  (B  , "B"  , 1, 0x0F000000, 0x0A000000, "Branch");
-const Instruction ARM_BL (BL , "BL" , 1, 0x0F000000, 0x0B000000, "Branch with Link");
-const Instruction ARM_BX (BX , "BX" , 1, 0x0FFFFFF0, 0x012FFF10, "Branch with Exchange");
-const Instruction ARM_BLX(BLX, "BLX", 1, 0x0FFFFFF0, 0x012FFF30, "Branch with Link and Exchange");
-const Instruction ARM_BXL(BXL, "BXL", 1, 0x0F000000, 0x0BA00000, "Branch with Link and Exchange using Immediate");
-
-const Instruction ARM_AND(AND, "AND", 3, 0x0DE00000, 0x00000000, "AND (Rd = Rm & Rs)");
-const Instruction ARM_EOR(EOR, "EOR", 3, 0x0DE00000, 0x00200000, "Exclusive OR (Rd = Rm ^ Rs)");
-const Instruction ARM_SUB(SUB, "SUB", 3, 0x0DE00000, 0x00400000, "Subtract(Rd = Rm - Rs)");
-const Instruction ARM_RSB(RSB, "RSB", 3, 0x0DE00000, 0x00600000, "Reverse subtract (Rd = Rs - Rm)");
-const Instruction ARM_ADD(ADD, "ADD", 3, 0x0DE00000, 0x00800000, "Add (Rd = Rm + Rs)");
-const Instruction ARM_ADC(ADC, "ADC", 3, 0x0DE00000, 0x00A00000, "Add with carry  (Rd = Rm + Rs + C)");
-const Instruction ARM_SBC(SBC, "SBC", 3, 0x0DE00000, 0x00C00000, "Subtract with carry (Rd = Rm - Rs + C - 1)");
-const Instruction ARM_RSC(RSC, "RSC", 3, 0x0DE00000, 0x00E00000, "Reverse subtract with carry (Rd = Rs - Rm + C - 1)");
-const Instruction ARM_TST(TST, "TST", 2, 0x0DE00000, 0x01000000, "Test bits");
-const Instruction ARM_TEQ(TEQ, "TEQ", 2, 0x0DE00000, 0x01200000, "Test bitwise equality");
-const Instruction ARM_CMP(CMP, "CMP", 2, 0x0DE00000, 0x01400000, "Compare");
-const Instruction ARM_CMN(CMN, "CMN", 2, 0x0DE00000, 0x01600000, "Compare Negative");
-const Instruction ARM_ORR(ORR, "ORR", 3, 0x0DE00000, 0x01800000, "OR (Rd = Rm | Rs)");
-const Instruction ARM_MOV(MOV, "MOV", 2, 0x0DE00000, 0x01A00000, "Move register or constant (Rd = Rm)");
-const Instruction ARM_BIC(BIC, "BIC", 3, 0x0DE00000, 0x01C00000, "Bit Clear (Rd = Rm & ~Rs)");
-const Instruction ARM_MVN(MVN, "MVN", 2, 0x0DE00000, 0x01E00000, "Move negative register (Rd = ~Rm)");
-
-const Instruction ARM_MUL(MUL, "MUL", 3, 0x0FE000F0, 0x00000090, "Multiply (Rd = Rm * Rs)");
-const Instruction ARM_MLA(MLA, "MLA", 4, 0x0FE000F0, 0x00200090, "Multiply accumulate (Rd = Rm * Rs + Rn)");
-
-const Instruction ARM_LDR(LDR, "LDR", 2, 0x0C500000, 0x04100000, "Load register from memory (word)");
-const Instruction ARM_STR(STR, "STR", 2, 0x0C500000, 0x04000000, "Store register to memory (word)");
-
-const Instruction ARM_SWP(SWP, "SWP", 2, 0x0FF00FF0, 0x01000090, "Swap register with memory (word)");
-
-// Additional
-const Instruction STD_PRINT(PRINT, "PRINT", 1, 0x00000000, 0xFFFFFFFF, "Prints value (std::cout)");
-const Instruction STD_EXPLAIN(EXPLAIN, "EXPLAIN", 1, 0x00000000, 0xFFFFFFFF, "Prints description of of an instruction mnemonic");
+// The handler of every form of an opcode group, indexed by the opcode bits the handler template is instantiated on
+template <unsigned int... Form>
+constexpr std::array<ARMHandler, sizeof...(Form)> dataProcessingForms(std::integer_sequence<unsigned int, Form...>)
+{
+	return { &ARM7TDMI::dataProcessing<Form & 0x100 ? Form & ~7u : Form>... }; // The shift is unused by immediate operands
+}
 
-const Instruction* ARM7TDMI::getPrintInstruction()
+template <unsigned int... Form>
+constexpr std::array<ARMHandler, sizeof...(Form)> multiplyForms(std::integer_sequence<unsigned int, Form...>)
 {
-	return &STD_PRINT;
+	return { &ARM7TDMI::multiply<Form>... };
 }
 
-void ARM7TDMI::interpret(std::string line)
+template <unsigned int... Form>
+constexpr std::array<ARMHandler, sizeof...(Form)> singleTransferForms(std::integer_sequence<unsigned int, Form...>)
 {
-	releaseTempPointers();
-	const std::vector<std::string> parsed = parseCommand(line);
-	const Instruction* instr = findInstructionWithMnemonic(parsed.size() > 0 ? parsed[0] : "null");
+	return { &ARM7TDMI::singleTransfer<Form & 0x80 ? Form : Form & ~3u>... }; // The shift is unused by immediate offsets
+}
 
-	if (parsed.size() - 1 < instr->min_arg)
-	{
-		std::cout << "Error: missing arguments!" << std::endl;
-		return;
-	}
+template <unsigned int... Form>
+constexpr std::array<ARMHandler, sizeof...(Form)> halfwordTransferForms(std::integer_sequence<unsigned int, Form...>)
+{
+	return { &ARM7TDMI::halfwordTransfer<Form>... };
+}
 
-	unsigned int tmp;
-	unsigned int* Rd = parsed.size() > 1 ? getVariable(parsed[1]) : r;
-	unsigned int* Rm = parsed.size() > 2 ? getVariable(parsed[2]) : r;
-	unsigned int* Rs = parsed.size() > 3 ? getVariable(parsed[3]) : r;
-	unsigned int* Rn = parsed.size() > 4 ? getVariable(parsed[4]) : r;
-
-	switch (instr->id) 
-	{
-	default: std::cout << "Error: unknown command!" << std::endl; return;
-
-	case B	: r[15] = *Rd; return;
-	case BL : r[14] = r[15];  r[15] = *Rd; return;
-	case BX : r[15] = *Rd; THUMB = r[15] & 0x1; return;
-	case BLX: r[14] = r[15]; THUMB = r[15] & 0x1; r[15] = *Rd; return;
-	case AND: *Rd = *Rm & *Rs; return;
-	case SUB: *Rd = *Rm - *Rs; return;
-	case ADD: *Rd = *Rm + *Rs; return;
-	case ADC: *Rd = *Rm + *Rs + V; return;
-	case SBC: *Rd = *Rm - *Rs + V - 1; return;
-	case RSC: *Rd = *Rs - *Rm + V - 1; return;
-
-	case TST: 
-		tmp = (*Rd) & (*Rm); 
-		Z = tmp == 0;
-		C = tmp >= 0;
-		N = tmp < 0;
-		return; 
-
-	case TEQ: 
-		tmp = (*Rd) ^ (*Rm); 
-		Z = tmp == 0;
-		C = tmp >= 0;
-		N = tmp < 0;
-		return; 
-
-	case CMP:
-		tmp = (*Rd) - (*Rm);
-		Z = tmp == 0;
-		C = tmp >= 0;
-		N = tmp < 0;
-		V = tmp > *Rd;
-		return;
+// Bits 25-20 (I, opcode, S) and 6-4 (shift type, register shift)
+constexpr auto DATA_PROCESSING_FORMS = dataProcessingForms(std::make_integer_sequence<unsigned int, 512>());
+// Bits 23-20 (long, signed, accumulate, S)
+constexpr auto MULTIPLY_FORMS = multiplyForms(std::make_integer_sequence<unsigned int, 16>());
+// Bits 25-20 (register offset, pre-index, up, byte, write-back, load) and 6-5 (shift type)
+constexpr auto SINGLE_TRANSFER_FORMS = singleTransferForms(std::make_integer_sequence<unsigned int, 256>());
+// Bits 24-20 (pre-index, up, immediate offset, write-back, load) and 6-5 (signed, halfword)
+constexpr auto HALFWORD_TRANSFER_FORMS = halfwordTransferForms(std::make_integer_sequence<unsigned int, 128>());
 
-	case CMN:
-		tmp = (*Rd) + (*Rm);
-		Z = tmp == 0;
-		C = tmp >= 0;
-		N = tmp < 0;
-		V = tmp < *Rd;
-		return;
+constexpr ARMHandler dataProcessingForm(const unsigned int bits) { return DATA_PROCESSING_FORMS[((bits >> 17) & 0x1F8) | ((bits >> 4) & 0x7)]; }
+constexpr ARMHandler multiplyForm(const unsigned int bits) { return MULTIPLY_FORMS[(bits >> 20) & 0xF]; }
+constexpr ARMHandler singleTransferForm(const unsigned int bits) { return SINGLE_TRANSFER_FORMS[((bits >> 18) & 0xFC) | ((bits >> 5) & 0x3)]; }
+constexpr ARMHandler halfwordTransferForm(const unsigned int bits) { return HALFWORD_TRANSFER_FORMS[((bits >> 18) & 0x7C) | ((bits >> 5) & 0x3)]; }
 
-	case ORR: *Rd = *Rm | *Rs; return;
-	case MOV: *Rd = *Rm; return;
-	case BIC: *Rd = *Rm & ~(*Rs); return;
-	case MVN: *Rd = ~(*Rm); return;
+// ARM instruction set, ordered by decoding priority
+constexpr InstructionSpec<ARMHandler> ARM_ISA[] =
+{
+	{ UND, "UND", 0, 0x0E000010, 0x06000010, "Undefined", &ARM7TDMI::undefined },
+	{ B  , "B"  , 1, 0x0F000000, 0x0A000000, "Branch", &ARM7TDMI::branch },
+	{ BL , "BL" , 1, 0x0F000000, 0x0B000000, "Branch with Link", &ARM7TDMI::branch },
+	{ BX , "BX" , 1, 0x0FFFFFF0, 0x012FFF10, "Branch with Exchange", &ARM7TDMI::branchExchange },
+	{ BLX, "BLX", 1, 0x0FFFFFF0, 0x012FFF30, "Branch with Link and Exchange", &ARM7TDMI::branchExchange },
+	//{ BXL, "BXL", 1, 0x0F000000, 0x0BA00000, "Branch with Link and Exchange using Immediate", &ARM7TDMI::undefined },
 
-	case MUL: *Rd = (*Rm) * (*Rs); return;
-	case MLA: *Rd = (*Rm) * (*Rs) + (*Rn); return;
+	{ MRS, "MRS", 2, 0x0FBF0FFF, 0x010F0000, "Move PSR status/flags to register", &ARM7TDMI::moveFromPSR },
+	{ MSR, "MSR", 2, 0x0DB0F000, 0x0120F000, "Move register or immediate to PSR status/flags", &ARM7TDMI::moveToPSR },
 
-	case LDR: 
-		*Rd = *Rm; 
-		//if (parsed.size() > 3) *Rm += *Rs; // POST-FIX
-		return;
-	case STR: 
-		*Rm = *Rd; 
-		//if (parsed.size() > 3) *Rm += *Rs; // POST-FIX
-		return;
+	// Multiplies, swaps and halfword transfers use encodings of the data processing register shifts
+	{ MUL, "MUL", 3, 0x0FE000F0, 0x00000090, "Multiply (Rd = Rm * Rs)", nullptr, multiplyForm },
+	{ MLA, "MLA", 4, 0x0FE000F0, 0x00200090, "Multiply accumulate (Rd = Rm * Rs + Rn)", nullptr, multiplyForm },
+	{ UMULL, "UMULL", 4, 0x0FE000F0, 0x00800090, "Multiply unsigned long", nullptr, multiplyForm },
+	{ UMLAL, "UMLAL", 4, 0x0FE000F0, 0x00A00090, "Multiply unsigned accumulate long", nullptr, multiplyForm },
+	{ SMULL, "SMULL", 4, 0x0FE000F0, 0x00C00090, "Multiply signed long", nullptr, multiplyForm },
+	{ SMLAL, "SMLAL", 4, 0x0FE000F0, 0x00E00090, "Multiply signed accumulate long", nullptr, multiplyForm },
 
-	case SWP: 
-		tmp = *Rd;
-		*Rd = *Rm;
-		*Rm = tmp;
-		return;
+	{ SWP, "SWP", 2, 0x0FF00FF0, 0x01000090, "Swap register with memory (word)", &ARM7TDMI::singleSwap<false> },
+	{ SWPB, "SWPB", 2, 0x0FF00FF0, 0x01400090, "Swap register with memory (byte)", &ARM7TDMI::singleSwap<true> },
 
-	// OTHER ACTIONS
-	case PRINT: 
-		char buffer[arc::HEX_BUFFER_SIZE];
-		std::cout << arc::toHex(buffer, *Rd, bits) << std::endl; return; // Changed to arc may have caused errors
-		//if(parsed.size() > 2)* Rd += *Rm; // POST-FIX
-		return;
+	{ LDRH, "LDRH", 2, 0x0E1000F0, 0x001000B0, "Load register from memory (half-word)", nullptr, halfwordTransferForm },
+	{ STRH, "STRH", 2, 0x0E1000F0, 0x000000B0, "Store register to memory (half-word)", nullptr, halfwordTransferForm },
+	{ LDRSB, "LDRSB", 2, 0x0E1000F0, 0x001000D0, "Load register from memory (sign extended byte)", nullptr, halfwordTransferForm },
+	{ LDRSH, "LDRSH", 2, 0x0E1000F0, 0x001000F0, "Load register from memory (sign extended halfword)", nullptr, halfwordTransferForm },
 
-	case EXPLAIN: std::cout << findInstructionWithMnemonic(parsed[1])->description << std::endl;
-	}
+	{ AND, "AND", 3, 0x0DE00000, 0x00000000, "AND (Rd = Rm & Rs)", nullptr, dataProcessingForm },
+	{ EOR, "EOR", 3, 0x0DE00000, 0x00200000, "Exclusive OR (Rd = Rm ^ Rs)", nullptr, dataProcessingForm },
+	{ SUB, "SUB", 3, 0x0DE00000, 0x00400000, "Subtract(Rd = Rm - Rs)", nullptr, dataProcessingForm },
+	{ RSB, "RSB", 3, 0x0DE00000, 0x00600000, "Reverse subtract (Rd = Rs - Rm)", nullptr, dataProcessingForm },
+	{ ADD, "ADD", 3, 0x0DE00000, 0x00800000, "Add (Rd = Rm + Rs)", nullptr, dataProcessingForm },
+	{ ADC, "ADC", 3, 0x0DE00000, 0x00A00000, "Add with carry  (Rd = Rm + Rs + C)", nullptr, dataProcessingForm },
+	{ SBC, "SBC", 3, 0x0DE00000, 0x00C00000, "Subtract with carry (Rd = Rm - Rs + C - 1)", nullptr, dataProcessingForm },
+	{ RSC, "RSC", 3, 0x0DE00000, 0x00E00000, "Reverse subtract with carry (Rd = Rs - Rm + C - 1)", nullptr, dataProcessingForm },
+	{ TST, "TST", 2, 0x0DE00000, 0x01000000, "Test bits", nullptr, dataProcessingForm },
+	{ TEQ, "TEQ", 2, 0x0DE00000, 0x01200000, "Test bitwise equality", nullptr, dataProcessingForm },
+	{ CMP, "CMP", 2, 0x0DE00000, 0x01400000, "Compare", nullptr, dataProcessingForm },
+	{ CMN, "CMN", 2, 0x0DE00000, 0x01600000, "Compare Negative", nullptr, dataProcessingForm },
+	{ ORR, "ORR", 3, 0x0DE00000, 0x01800000, "OR (Rd = Rm | Rs)", nullptr, dataProcessingForm },
+	{ MOV, "MOV", 2, 0x0DE00000, 0x01A00000, "Move register or constant (Rd = Rm)", nullptr, dataProcessingForm },
+	{ BIC, "BIC", 3, 0x0DE00000, 0x01C00000, "Bit Clear (Rd = Rm & ~Rs)", nullptr, dataProcessingForm },
+	{ MVN, "MVN", 2, 0x0DE00000, 0x01E00000, "Move negative register (Rd = ~Rm)", nullptr, dataProcessingForm },
+
+	{ LDR, "LDR", 2, 0x0C500000, 0x04100000, "Load register from memory (word)", nullptr, singleTransferForm },
+	{ STR, "STR", 2, 0x0C500000, 0x04000000, "Store register to memory (word)", nullptr, singleTransferForm },
+	{ LDRB, "LDRB", 2, 0x0C500000, 0x04500000, "Load register from memory (byte)", nullptr, singleTransferForm },
+	{ STRB, "STRB", 2, 0x0C500000, 0x04400000, "Store register to memory (byte)", nullptr, singleTransferForm },
+
+	{ LDM, "LDM", 2, 0x0E100000, 0x08100000, "Load multiple registers", &ARM7TDMI::blockTransfer },
+	{ STM, "STM", 2, 0x0E100000, 0x08000000, "Store multiple registers", &ARM7TDMI::blockTransfer },
+
+	{ SWI, "SWI", 1, 0x0F000000, 0x0F000000, "Software Interrupt", &ARM7TDMI::softwareInterrupt },
+	/*
+	{ CDP, "CDP", 3, 0x0F000010, 0x0E000000, "Coprocessor Data Processing", &ARM7TDMI::undefined },
+	{ LDC, "LDC", 3, 0x0E100000, 0x0D100000, "Load Coprocessor from memory", &ARM7TDMI::undefined },
+	{ STC, "STC", 3, 0x0E100000, 0x0D000000, "Store coprocessor register to memory", &ARM7TDMI::undefined },
+	{ MRC, "MRC", 3, 0x0F100010, 0x0E100010, "Move from coprocessor register to CPU register", &ARM7TDMI::undefined },
+	{ MCR, "MCR", 3, 0x0F100010, 0x0E000010, "Move from CPU register to coprocessor register", &ARM7TDMI::undefined },
+	*/
+
+	// Additional (script only, never decoded)
+	{ PRINT, "PRINT", 1, 0x00000000, 0xFFFFFFFF, "Prints value (std::cout)", nullptr },
+	{ EXPLAIN, "EXPLAIN", 1, 0x00000000, 0xFFFFFFFF, "Prints description of of an instruction mnemonic", nullptr },
+};
+
+// Generated at compile time from ARM_ISA
+using ARMDecodeTable = DecodeTable<ARMHandler, ARM_ISA, ARM_DECODE_SIZE, ARM_DECODE_MASK, armDecodeBits, &ARM7TDMI::undefined>;
+
+const DecodeEntry<ARMHandler>& ARM7TDMI::decodeARM(const unsigned int op)
+{
+	return ARMDecodeTable::find(armDecodeIndex(op), op);
+}
+
+unsigned int ARM7TDMI::armDecodeCompares(const unsigned int op)
+{
+	return ARMDecodeTable::compares(armDecodeIndex(op), op);
+}
+
+const Instruction* ARM7TDMI::getPrintInstruction()
+{
+	return instructions->getInstructionById(findInstruction("PRINT"));
 }
 
 std::string ARM7TDMI::identify(unsigned int op)
 {
-	for (unsigned int i = 0; i < instructions->size(); i++)
+	const InstructionSpec<ARMHandler>* in = ARMDecodeTable::find(armDecodeIndex(op), op).instr;
+	if (in)
 	{
-		const Instruction* in = instructions->getInstructionById(i);
-		if ((op & in->mask) == in->code)
-		{
-			std::string str = " [";
-			str += in->mnemonic;
-			str += " - ";
-			str += in->description;
-			str += "]";
-			return str;
-		}
+		std::string str = " [";
+		str += in->mnemonic;
+		str += " - ";
+		str += in->description;
+		str += "]";
+		return str;
 	}
 
 	return " [UNKNOWN INSTRUCTION]";
 }
 
-void ARM7TDMI::execute(unsigned short op)
+void ARM7TDMI::execute(unsigned int op)
 {
+	if (!condition(op >> 28)) return;
+	(this->*ARMDecodeTable::find(armDecodeIndex(op), op).handler)(op);
+}
 
+void ARM7TDMI::branch(const unsigned int op)
+{
+	if (op & 0x01000000) r[14] = r[15] - 4; // BL
+	jump(r[15] + ((int)(op << 8) >> 6)); // Sign extended offset * 4
 }
 
-void ARM7TDMI::execute(unsigned int op)
+void ARM7TDMI::branchExchange(const unsigned int op)
+{
+	const unsigned int address = r[op & 0xF];
+	if (op & 0x20) r[14] = r[15] - 4; // BLX
+	setThumb(address & 0x01);
+	jump(address & (isThumb() ? 0xFFFFFFFE : 0xFFFFFFFC));
+}
+
+// MRS Rd, CPSR/SPSR
+void ARM7TDMI::moveFromPSR(const unsigned int op)
+{
+	r[(op >> 12) & 0xF] = op & 0x00400000 ? spsr() : getCPSR();
+}
+
+// MSR CPSR/SPSR_fields, Rm/#imm
+void ARM7TDMI::moveToPSR(const unsigned int op)
 {
-	unsigned int cond = op & instructions->getSuffixMask();
-
-	switch (cond)
-	{
-	case 0x00000000: if (Z) break; else return;
-	case 0x10000000: if (Z) return; else break;
-	case 0x20000000: if (C) break; else return;
-	case 0x30000000: if (C) return; else break;
-	case 0x40000000: if (N) break; else return;
-	case 0x50000000: if (N) return; else break;
-	case 0x60000000: if (V) break; else return;
-	case 0x70000000: if (V) return; else break;
-	case 0x80000000: if (C && !Z) break; else return;
-	case 0x90000000: if (!C || Z) break; else return;
-	case 0xA0000000: if (N == V) break; else return;
-	case 0xB0000000: if (N != V) break; else return;
-	case 0xC0000000: if (!Z && (N == V)) break; else return;
-	case 0xD0000000: if (Z || (N != V)) break; else return;
-	case 0xE0000000: break;
-	case 0xF0000000: return;
-	}
-
-	//unsigned int id = 0x06000010;
-	for (unsigned int i = 0; i < instructions->size(); i++)
-	{
-		const Instruction* in = instructions->getInstructionById(i);
-		if ((op & in->mask) == in->code)
+	const unsigned int value = op & 0x02000000 ? rotate(op & 0xFF, (op >> 7) & 0x1E) : r[op & 0xF];
+
+	unsigned int mask = 0;
+	if (op & 0x00080000) mask |= 0xFF000000; // Flags
+	if (op & 0x00010000) mask |= 0x000000FF; // Control
+
+	if (op & 0x00400000)
+	{
+		spsr() = (spsr() & ~mask) | (value & mask);
+		return;
+	}
+
+	// User mode can only write the flags, the state bit is never written
+	if ((cpsr & CPSR_MODE) == MODE_USER) mask &= CPSR_FLAGS;
+	mask &= ~CPSR_T;
+	writeCPSR((getCPSR() & ~mask) | (value & mask));
+}
+
+// Value of the barrel shifter when C is not changed
+constexpr unsigned int KEEP_CARRY = 2;
+
+template <unsigned int Type, bool ByRegister, bool Carry>
+inline unsigned int ARM7TDMI::shiftOperand(const unsigned int op, unsigned int& carry_out)
+{
+	const unsigned int rm = op & 0xF;
+	unsigned int value = r[rm];
+	unsigned int amount;
+
+	if constexpr (ByRegister)
+	{
+		// The PC is 12 bytes ahead when the amount is a register, a zero amount keeps the value and C
+		if (rm == 15) value += 4;
+		amount = r[(op >> 8) & 0xF] & 0xFF;
+		if (amount == 0) return value;
+	}
+	else
+	{
+		// LSL #0 keeps the value and C, LSR #0 and ASR #0 shift by 32, ROR #0 is RRX
+		amount = (op >> 7) & 0x1F;
+		if (amount == 0)
 		{
-			switch (i)
+			if constexpr (Type == 0) return value;
+			if constexpr (Type == 3)
 			{
-			case UND: 
-				undefined(op);
-				break;
-			case BL:
-				r[14] = r[15] + 4;
-				[[fallthrough]];
-			case B: 
-				r[15] += (op & 0x800000 ? op & 0x7FFFFF : -(int((op & 0x7FFFFF) << 2)));
-				break;
-
-			case BLX:
-				r[14] = r[15] + 4;
-				[[fallthrough]];
-			case BX:
-				THUMB = r[op & 0xF] & 0x01;
-				r[15] = r[op & 0xF] & 0xFFFFFFFE;
-				break;
+				const unsigned int result = (carry() << 31) | (value >> 1);
+				if constexpr (Carry) carry_out = value & 1;
+				return result;
 			}
+			amount = 32;
+		}
+	}
 
+	if constexpr (Type == 0) // LSL
+	{
+		if (amount >= 32)
+		{
+			if constexpr (Carry) carry_out = amount == 32 ? value & 1 : 0;
+			return 0;
+		}
+		if constexpr (Carry) carry_out = (value >> (32 - amount)) & 1;
+		return value << amount;
+	}
+	else if constexpr (Type == 1) // LSR
+	{
+		if (amount >= 32)
+		{
+			if constexpr (Carry) carry_out = amount == 32 ? value >> 31 : 0;
+			return 0;
+		}
+		if constexpr (Carry) carry_out = (value >> (amount - 1)) & 1;
+		return value >> amount;
+	}
+	else if constexpr (Type == 2) // ASR
+	{
+		if (amount >= 32)
+		{
+			if constexpr (Carry) carry_out = value >> 31;
+			return (unsigned int)((int)value >> 31);
+		}
+		if constexpr (Carry) carry_out = (value >> (amount - 1)) & 1;
+		return (unsigned int)((int)value >> amount);
+	}
+	else // ROR, multiples of 32 keep the value and set C to bit 31
+	{
+		const unsigned int result = rotate(value, amount);
+		if constexpr (Carry) carry_out = result >> 31;
+		return result;
+	}
+}
+
+// AND, EOR, SUB, RSB, ADD, ADC, SBC, RSC, TST, TEQ, CMP, CMN, ORR, MOV, BIC, MVN{cond}{S} Rd, Rn, Op2
+template <unsigned int Form>
+void ARM7TDMI::dataProcessing(const unsigned int op)
+{
+	constexpr bool IMMEDIATE = Form & 0x100;
+	constexpr unsigned int OPCODE = (Form >> 4) & 0xF;
+	constexpr bool S = Form & 0x8;
+	constexpr unsigned int SHIFT = (Form >> 1) & 0x3;
+	constexpr bool BY_REGISTER = Form & 0x1;
+	constexpr bool TEST = (OPCODE & 0xC) == 0x8;
+	constexpr bool LOGICAL = OPCODE <= 0x1 || OPCODE == 0x8 || OPCODE == 0x9 || OPCODE >= 0xC;
+	constexpr bool SHIFTER_CARRY = S && LOGICAL;
+
+	const unsigned int rn = (op >> 16) & 0xF;
+	const unsigned int rd = (op >> 12) & 0xF;
+
+	unsigned int shifter_carry = KEEP_CARRY;
+	unsigned int b;
+	if constexpr (IMMEDIATE)
+	{
+		const unsigned int amount = (op >> 7) & 0x1E;
+		b = rotate(op & 0xFF, amount);
+		if constexpr (SHIFTER_CARRY) if (amount) shifter_carry = b >> 31;
+	}
+	else
+		b = shiftOperand<SHIFT, BY_REGISTER, SHIFTER_CARRY>(op, shifter_carry);
+
+	const unsigned int a = BY_REGISTER && rn == 15 ? r[15] + 4 : r[rn];
+
+	unsigned int result;
+	if constexpr (OPCODE == 0x0 || OPCODE == 0x8) result = a & b;
+	else if constexpr (OPCODE == 0x1 || OPCODE == 0x9) result = a ^ b;
+	else if constexpr (OPCODE == 0x2 || OPCODE == 0xA) result = S ? subFlags(a, b) : a - b;
+	else if constexpr (OPCODE == 0x3) result = S ? subFlags(b, a) : b - a;
+	else if constexpr (OPCODE == 0x4 || OPCODE == 0xB) result = S ? addFlags(a, b, 0) : a + b;
+	else if constexpr (OPCODE == 0x5) result = S ? addFlags(a, b, carry()) : a + b + carry();
+	else if constexpr (OPCODE == 0x6) result = S ? subFlags(a, b, carry()) : a + ~b + carry();
+	else if constexpr (OPCODE == 0x7) result = S ? subFlags(b, a, carry()) : b + ~a + carry();
+	else if constexpr (OPCODE == 0xC) result = a | b;
+	else if constexpr (OPCODE == 0xD) result = b;
+	else if constexpr (OPCODE == 0xE) result = a & ~b;
+	else result = ~b;
+
+	if constexpr (!TEST)
+	{
+		// SUBS PC, LR, #n and MOVS PC, Rm restore the CPSR of the interrupted mode
+		if (rd == 15)
+		{
+			if constexpr (S) returnFromException(result);
+			else jump(result & 0xFFFFFFFC);
 			return;
 		}
+		r[rd] = result;
+	}
+
+	if constexpr (SHIFTER_CARRY)
+	{
+		if (shifter_carry != KEEP_CARRY) setCarry(shifter_carry);
+		setNZ(result);
+	}
+}
+
+// MUL, MLA, UMULL, UMLAL, SMULL, SMLAL{cond}{S}, C is kept by the flag-setting forms
+template <unsigned int Form>
+void ARM7TDMI::multiply(const unsigned int op)
+{
+	constexpr bool LONG = Form & 0x8;
+	constexpr bool SIGNED = Form & 0x4;
+	constexpr bool ACCUMULATE = Form & 0x2;
+	constexpr bool S = Form & 0x1;
+
+	const unsigned int rm = r[op & 0xF];
+	const unsigned int rs = r[(op >> 8) & 0xF];
+	const unsigned int rd = (op >> 16) & 0xF;
+	const unsigned int rn = (op >> 12) & 0xF; // RdLo of the long forms
+
+	if constexpr (!LONG)
+	{
+		unsigned int result = rm * rs;
+		if constexpr (ACCUMULATE) result += r[rn];
+		r[rd] = result;
+		if constexpr (S) setNZ(result);
+	}
+	else
+	{
+		unsigned long long result = SIGNED ? (unsigned long long)((long long)(int)rm * (int)rs) : (unsigned long long)rm * rs;
+		if constexpr (ACCUMULATE) result += ((unsigned long long)r[rd] << 32) | r[rn];
+		r[rn] = (unsigned int)result;
+		r[rd] = (unsigned int)(result >> 32);
+
+		if constexpr (S)
+		{
+			resolveFlags();
+			cpsr = (cpsr & ~(CPSR_N | CPSR_Z)) | (r[rd] & CPSR_N) | (result ? 0 : CPSR_Z);
+		}
+	}
+}
+
+// LDR, STR{cond}{B}{T} Rd, <address>, a loaded base is overwritten by the loaded value
+template <unsigned int Form>
+void ARM7TDMI::singleTransfer(const unsigned int op)
+{
+	constexpr bool REGISTER = Form & 0x80;
+	constexpr bool PRE = Form & 0x40;
+	constexpr bool UP = Form & 0x20;
+	constexpr bool BYTE = Form & 0x10;
+	constexpr bool WRITE_BACK = !PRE || (Form & 0x08); // Post-indexing always writes back
+	constexpr bool LOAD = Form & 0x04;
+	constexpr unsigned int SHIFT = Form & 0x3;
+
+	const unsigned int rn = (op >> 16) & 0xF;
+	const unsigned int rd = (op >> 12) & 0xF;
+
+	unsigned int carry_out;
+	const unsigned int offset = REGISTER ? shiftOperand<SHIFT, false, false>(op, carry_out) : op & 0xFFF;
+
+	const unsigned int base = r[rn];
+	const unsigned int indexed = UP ? base + offset : base - offset;
+	const unsigned int address = PRE ? indexed : base;
+
+	if constexpr (LOAD)
+	{
+		const unsigned int value = BYTE ? read8(address) : read32(address);
+		if constexpr (WRITE_BACK) r[rn] = indexed;
+		if (rd == 15)
+			jump(value & 0xFFFFFFFC);
+		else
+			r[rd] = value;
+	}
+	else
+	{
+		// The PC is stored 12 bytes ahead
+		const unsigned int value = rd == 15 ? r[15] + 4 : r[rd];
+		if constexpr (BYTE) write8(address, value);
+		else write32(address, value);
+		if constexpr (WRITE_BACK) r[rn] = indexed;
+	}
+}
+
+// LDRH, STRH, LDRSB, LDRSH{cond} Rd, <address>
+template <unsigned int Form>
+void ARM7TDMI::halfwordTransfer(const unsigned int op)
+{
+	constexpr bool PRE = Form & 0x40;
+	constexpr bool UP = Form & 0x20;
+	constexpr bool IMMEDIATE = Form & 0x10;
+	constexpr bool WRITE_BACK = !PRE || (Form & 0x08);
+	constexpr bool LOAD = Form & 0x04;
+	constexpr unsigned int SH = Form & 0x3; // 1: unsigned halfword, 2: signed byte, 3: signed halfword
+
+	const unsigned int rn = (op >> 16) & 0xF;
+	const unsigned int rd = (op >> 12) & 0xF;
+	const unsigned int offset = IMMEDIATE ? ((op >> 4) & 0xF0) | (op & 0xF) : r[op & 0xF];
+
+	const unsigned int base = r[rn];
+	const unsigned int indexed = UP ? base + offset : base - offset;
+	const unsigned int address = PRE ? indexed : base;
+
+	if constexpr (LOAD)
+	{
+		// Unaligned halfwords are rotated (by the bus), unaligned signed halfwords load a signed byte
+		unsigned int value;
+		if constexpr (SH == 1) value = read16(address);
+		else if constexpr (SH == 2) value = (unsigned int)(signed char)read8(address);
+		else value = address & 1 ? (unsigned int)(signed char)read8(address) : (unsigned int)(short)read16(address);
+
+		if constexpr (WRITE_BACK) r[rn] = indexed;
+		if (rd == 15)
+			jump(value & 0xFFFFFFFC);
+		else
+			r[rd] = value;
+	}
+	else if constexpr (SH == 1)
+	{
+		write16(address, rd == 15 ? r[15] + 4 : r[rd]);
+		if constexpr (WRITE_BACK) r[rn] = indexed;
+	}
+}
+
+// SWP{cond}{B} Rd, Rm, [Rn]
+template <bool Byte>
+void ARM7TDMI::singleSwap(const unsigned int op)
+{
+	const unsigned int address = r[(op >> 16) & 0xF];
+	const unsigned int value = Byte ? read8(address) : read32(address);
+
+	if constexpr (Byte) write8(address, r[op & 0xF]);
+	else write32(address, r[op & 0xF]);
+	r[(op >> 12) & 0xF] = value;
+}
+
+// LDM/STM{amod} Rn{!}, {Rlist}{^}
+void ARM7TDMI::blockTransfer(const unsigned int op)
+{
+	const unsigned int rn = (op >> 16) & 0xF;
+	const unsigned int list = op & 0xFFFF;
+	const bool load = op & 0x00100000;
+	const bool up = op & 0x00800000;
+	const bool write_back = op & 0x00200000;
+
+	const unsigned int count = std::popcount(list);
+	if (count == 0) return;
+
+	// Registers are transferred from the lowest address
+	const unsigned int base = r[rn];
+	const unsigned int end = up ? base + (count << 2) : base - (count << 2);
+	unsigned int address = up ? base : end;
+	if (((op >> 24) & 1) == (unsigned int)up) address += 4;
+
+	// ^ without a loaded PC transfers the User mode registers
+	const unsigned int mode = cpsr & CPSR_MODE;
+	const bool user = (op & 0x00400000) && !(load && (list & 0x8000));
+	if (user) switchMode(MODE_USER);
+
+	unsigned int values[16];
+	if (load)
+	{
+		// A loaded base overrides the write-back
+		if (write_back) r[rn] = end;
+
+		readWords(address, values, count);
+		unsigned int k = 0;
+		for (unsigned int bits = list; bits; bits &= bits - 1)
+			r[std::countr_zero(bits)] = values[k++];
+	}
+	else
+	{
+		unsigned int k = 0;
+		for (unsigned int bits = list; bits; bits &= bits - 1)
+			values[k++] = r[std::countr_zero(bits)];
+
+		// The PC is stored 12 bytes ahead, a stored base is the original value only if it is first
+		if (list & 0x8000) values[count - 1] += 4;
+		const unsigned int below = list & ((1 << rn) - 1);
+		if (write_back && (list & (1 << rn)) && below) values[std::popcount(below)] = end;
+
+		writeWords(address, values, count);
+		if (write_back) r[rn] = end;
+	}
+
+	if (user) switchMode(mode);
+
+	if (load && (list & 0x8000))
+	{
+		if (op & 0x00400000)
+			returnFromException(r[15]);
+		else
+			jump(r[15] & 0xFFFFFFFC);
 	}
+}
+
+// SWI #n
+void ARM7TDMI::softwareInterrupt(const unsigned int)
+{
+	enterException(MODE_SUPERVISOR, VECTOR_SWI, r[15] - 4);
+}
+
+// Swaps the registers of the current bank with the registers of a mode
+void ARM7TDMI::switchMode(const unsigned int mode)
+{
+	const RegisterBank next = modeBank(mode);
+	cpsr = (cpsr & ~CPSR_MODE) | mode;
+	if (next == banks.current) return;
+
+	banks.sp[banks.current] = r[13];
+	banks.lr[banks.current] = r[14];
+	r[13] = banks.sp[next];
+	r[14] = banks.lr[next];
+
+	if ((banks.current == BANK_FIQ) != (next == BANK_FIQ))
+		for (unsigned int i = 0; i < 5; i++)
+			std::swap(r[8 + i], banks.high[i]);
+
+	banks.current = next;
+}
+
+void ARM7TDMI::enterException(const unsigned int mode, const unsigned int vector, const unsigned int link)
+{
+	const unsigned int saved = getCPSR();
+	switchMode(mode);
+	spsr() = saved;
+	r[14] = link;
+	cpsr = (cpsr & ~CPSR_T) | CPSR_I;
+	jump(vector);
+}
 
-	undefined(op);
+void ARM7TDMI::returnFromException(const unsigned int address)
+{
+	writeCPSR(spsr());
+	jump(address & (isThumb() ? 0xFFFFFFFE : 0xFFFFFFFC));
+}
+
+bool ARM7TDMI::interrupt()
+{
+	if (cpsr & CPSR_I) return false;
+
+	// The handler returns with SUBS PC, LR, #4
+	halted = false;
+	enterException(MODE_IRQ, VECTOR_IRQ, r[15] + 4);
+	return true;
+}
+
+void ARM7TDMI::setStackPointer(const unsigned int mode, const unsigned int sp)
+{
+	if (modeBank(mode) == banks.current)
+		r[13] = sp;
+	else
+		banks.sp[modeBank(mode)] = sp;
 }
 
 ARM7TDMI::ARM7TDMI(unsigned long clock) : Processor(32, clock, 16)
@@ -243,86 +595,586 @@ ARM7TDMI::ARM7TDMI(unsigned long clock) : Processor(32, clock, 16)
 	set->addSuffix("AL", 0xE0000000, "Always");
 	set->addSuffix("NV", 0xF0000000, "Never");
 
-	set->addInstruction(ARM_UND);
-	set->addInstruction(ARM_B);
-	set->addInstruction(ARM_BL);
-	set->addInstruction(ARM_BX);
-	set->addInstruction(ARM_BLX);
-	set->addInstruction(ARM_AND);
-	set->addInstruction(ARM_EOR);
-	set->addInstruction(ARM_SUB);
-	set->addInstruction(ARM_RSB);
-	set->addInstruction(ARM_ADD);
-	set->addInstruction(ARM_ADC);
-	set->addInstruction(ARM_SBC);
-	set->addInstruction(ARM_RSC);
-	set->addInstruction(ARM_TST);
-	set->addInstruction(ARM_TEQ); 
-	set->addInstruction(ARM_CMP);
-	set->addInstruction(ARM_CMN);
-	set->addInstruction(ARM_ORR);
-	set->addInstruction(ARM_MOV);
-	set->addInstruction(ARM_BIC);
-	set->addInstruction(ARM_MVN);
-	/*
-	mapper[set->addInstruction("MRS", 0x0FBF0FFF, 0x010F0000, "Move PSR status/flags to register")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("MSR", 0x0FBFFFF0, 0x0129F000, "Move register to PSR status/flags")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("MSR_", 0x0DBFF000, 0x0129F000, "Move register or immediate to PSR flag bits only")] = &ARM7TDMI::undefined;
-	*/
-	set->addInstruction(ARM_MUL);
-	set->addInstruction(ARM_MLA);
-	/*
-	mapper[set->addInstruction("SMLAL", 0x0FE000F0, 0x00E00090, "Multiply signed accumulate long")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("UMLAL", 0x0FE000F0, 0x00A00090, "Multiply unsigned accumulate long")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("SMULL", 0x0FE000F0, 0x00C00090, "Multiply signed long")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("UMULL", 0x0FE000F0, 0x00800090, "Multiply unsigned long")] = &ARM7TDMI::undefined;
-	*/
-	set->addInstruction(ARM_LDR);
-	set->addInstruction(ARM_STR);
-	/*
-	mapper[set->addInstruction("LDRB", 0x0C500000, 0x04500000, "Load register from memory (byte)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("STRB", 0x0C500000, 0x04400000, "Store register to memory (byte)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("LDRH", 0x0E1000F0, 0x001000B0, "Load register from memory (half-word)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("STRH", 0x0E1000F0, 0x000000B0, "Store register to memory (half-word)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("LDRSB", 0x0E1000F0, 0x001000D0, "Load register from memory (sign extended byte)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("LDRSH", 0x0E1000F0, 0x001000F0, "Load register from memory (sign extended halfword)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("LDM", 0x0E100000, 0x08100000, "Load multiple registers")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("STM", 0x0E100000, 0x08000000, "Store multiple")] = &ARM7TDMI::undefined;
-	*/
-	set->addInstruction(ARM_SWP);
-	/*
-	mapper[set->addInstruction("SWPB", 0x0FF00FF0, 0x01400090, "Swap register with memory (byte)")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("SWI", 0x0F000000, 0x0F000000, "Software Interrupt")] = &ARM7TDMI::undefined;
+	addInstructions(*set, ARM_ISA);
+	loadInstructionSet(set);
 
-	mapper[set->addInstruction("CDP", 0x0F000010, 0x0E000000, "Coprocessor Data Processing")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("LDC", 0x0E100000, 0x0D100000, "Load Coprocessor from memory")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("STC", 0x0E100000, 0x0D000000, "Store coprocessor register to memory")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("MRC", 0x0F100010, 0x0E100010, "Move from coprocessor register to CPU register")] = &ARM7TDMI::undefined;
-	mapper[set->addInstruction("MCR", 0x0F100010, 0x0E000010, "Move from CPU register to coprocessor register")] = &ARM7TDMI::undefined;*/
+	loadThumbInstructionSet();
+}
+
+ARM7TDMI::~ARM7TDMI()
+{
+	delete recompiler;
+	delete instructions;
+	delete thumb_instructions;
+}
 
-	set->addInstruction(STD_PRINT);
-	set->addInstruction(STD_EXPLAIN);
+// Instructions that can write to the PC
+bool ARM7TDMI::armEndsBlock(const unsigned int op)
+{
+	const unsigned int rd = (op >> 12) & 0xF;
 
-	loadInstructionSet(set);
+	if ((op & 0x0E000000) == 0x0A000000) return true; // B, BL
+	if ((op & 0x0FFFFFD0) == 0x012FFF10) return true; // BX, BLX
+	if ((op & 0x0F000000) == 0x0F000000) return true; // SWI
+	if ((op & 0x0E108000) == 0x08108000) return true; // LDM with PC
+	if ((op & 0x0C000000) == 0x00000000 && rd == 15) return true; // Data processing, halfword loads
+	if ((op & 0x0C100000) == 0x04100000 && rd == 15) return true; // LDR
+	return false;
 }
 
-void ARM7TDMI::start()
+// Registers and flags read and written by an unconditional instruction, returns false if it stores, branches or changes the mode
+static bool armAccesses(const unsigned int op, unsigned int& reads, unsigned int& writes)
+{
+	const unsigned int rn = (op >> 16) & 0xF;
+	const unsigned int rd = (op >> 12) & 0xF;
+	const unsigned int rm = op & 0xF;
+	if (rd == 15) return false;
+
+	if ((op & 0x0E000090) == 0x00000090) // LDRH, LDRSB, LDRSH (multiplies, swaps and halfword stores are left out)
+	{
+		if (!(op & 0x60) || !(op & 0x00100000)) return false;
+		reads = (1 << rn) | (op & 0x00400000 ? 0 : 1 << rm);
+		writes = (1 << rd) | (!(op & 0x01000000) || (op & 0x00200000) ? 1 << rn : 0);
+		return true;
+	}
+
+	if ((op & 0x0C000000) == 0x00000000) // Data processing
+	{
+		const unsigned int alu = (op >> 21) & 0xF;
+		const bool test = alu >= 0x8 && alu <= 0xB;
+		const bool logical = alu <= 0x1 || alu >= 0xC || alu == 0x8 || alu == 0x9;
+		if (test && !(op & 0x00100000)) return false; // MRS, MSR, BX
+
+		reads = alu == 0xD || alu == 0xF ? 0 : 1 << rn;
+		writes = test ? 0 : 1 << rd;
+		if (alu >= 0x5 && alu <= 0x7) reads |= ACCESS_C; // ADC, SBC, RSC
+
+		// The shifter keeps C for a register shift by zero, RRX rotates it in
+		bool carry = false;
+		if (op & 0x02000000)
+			carry = (op & 0xF00) != 0;
+		else if (op & 0x10)
+		{
+			reads |= (1 << rm) | (1 << ((op >> 8) & 0xF)) | ACCESS_C;
+			carry = true;
+		}
+		else
+		{
+			reads |= 1 << rm;
+			if ((op & 0xFE0) == 0x060) reads |= ACCESS_C;
+			carry = (op & 0xFE0) != 0;
+		}
+
+		if (op & 0x00100000) writes |= logical ? ACCESS_NZ | (carry ? ACCESS_C : 0) : ACCESS_NZCV;
+		return true;
+	}
+
+	if ((op & 0x0C100000) == 0x04100000) // LDR, LDRB
+	{
+		reads = 1 << rn;
+		if (op & 0x02000000)
+		{
+			reads |= 1 << rm;
+			if ((op & 0xFF0) == 0x060) reads |= ACCESS_C; // RRX
+		}
+		writes = (1 << rd) | (!(op & 0x01000000) || (op & 0x00200000) ? 1 << rn : 0);
+		return true;
+	}
+
+	return false;
+}
+
+// Loops that branch to their first instruction and compute the same values from the same memory on every
+// iteration (LDR/CMP/BNE polling VCOUNT, DISPSTAT or a variable set by an interrupt) can only exit after an event
+bool ARM7TDMI::armIdleLoop(const ARMBlock& block)
+{
+	const unsigned int last = block.ops.back().op;
+	const unsigned int pc = block.address + block.size - 4;
+
+	if ((last & 0x0F000000) != 0x0A000000 || (last >> 28) == 0xF) return false; // B{cond}
+	if (pc + 8 + ((int)(last << 8) >> 6) != block.address) return false;
+
+	// Registers read before they are written must not be written later in the iteration
+	unsigned int read = 0, written = 0;
+	for (size_t i = 0; i + 1 < block.ops.size(); i++)
+	{
+		unsigned int reads, writes;
+		if ((block.ops[i].op >> 28) != 0xE || !armAccesses(block.ops[i].op, reads, writes)) return false;
+		read |= reads & ~written;
+		written |= writes;
+	}
+	if ((last >> 28) != 0xE) read |= ACCESS_NZCV & ~written;
+
+	return !(read & written);
+}
+
+// Approximate cycle cost (S + N + I cycles without wait states)
+unsigned char ARM7TDMI::armCycles(const unsigned int op)
+{
+	if ((op & 0x0E000000) == 0x0A000000) return 3; // B, BL
+	if ((op & 0x0FFFFFD0) == 0x012FFF10) return 3; // BX, BLX
+	if ((op & 0x0F000000) == 0x0F000000) return 3; // SWI
+	if ((op & 0x0FB00FF0) == 0x01000090) return 4; // SWP
+	if ((op & 0x0FC000F0) == 0x00000090) return op & 0x00200000 ? 3 : 2; // MUL, MLA
+	if ((op & 0x0F8000F0) == 0x00800090) return op & 0x00200000 ? 4 : 3; // UMULL, UMLAL, SMULL, SMLAL
+	if ((op & 0x0E000090) == 0x00000090 && (op & 0x60)) return op & 0x00100000 ? (((op >> 12) & 0xF) == 15 ? 5 : 3) : 2; // LDRH, STRH, LDRSB, LDRSH
+	if ((op & 0x0C100000) == 0x04100000) return ((op >> 12) & 0xF) == 15 ? 5 : 3; // LDR
+	if ((op & 0x0C100000) == 0x04000000) return 2; // STR
+
+	if ((op & 0x0E000000) == 0x08000000) // LDM, STM
+	{
+		// LDM: nS + 1N + 1I (+ 1S + 1N with the PC), STM: (n - 1)S + 2N
+		unsigned char n = 0;
+		for (unsigned int list = op & 0xFFFF; list; list &= list - 1) n++;
+		if ((op & 0x00108000) == 0x00108000) return n + 4;
+		return n + (op & 0x00100000 ? 2 : 1);
+	}
+
+	unsigned char n = 1;
+	if ((op & 0x0E000010) == 0x00000010) n++; // Register specified shift
+	if (((op >> 12) & 0xF) == 15) n += 2;
+	return n;
+}
+
+DecodedOp<ARMHandler> ARM7TDMI::decode(const unsigned int address, bool& end)
+{
+	DecodedOp<ARMHandler> d;
+
+	if (isThumb())
+	{
+		d.op = read16(address);
+		const DecodeEntry<ARMHandler>& in = decodeTHUMB(d.op);
+		d.handler = in.handler;
+		d.cond = (d.op & 0xF000) == 0xD000 && ((d.op >> 8) & 0xF) < 0xE ? (d.op >> 8) & 0xF : 0xE; // B{cond}
+		d.cycles = thumbCycles(d.op);
+		end = !in.instr || thumbEndsBlock(d.op);
+	}
+	else
+	{
+		d.op = read32(address);
+		const DecodeEntry<ARMHandler>& in = decodeARM(d.op);
+		d.handler = in.handler;
+		d.cond = d.op >> 28;
+		d.cycles = armCycles(d.op);
+		end = !in.instr || armEndsBlock(d.op);
+	}
+
+	return d;
+}
+
+ARMBlock* ARM7TDMI::getBlock()
+{
+	block_cache.release();
+
+	const unsigned int key = r[15] | isThumb();
+	ARMBlock* block = block_cache.find(key);
+	if (block) return block;
+
+	block = new ARMBlock(r[15]);
+
+	const unsigned int width = isThumb() ? 2 : 4;
+	unsigned int address = r[15];
+	for (unsigned int i = 0; i < MAX_BLOCK_LENGTH; i++)
+	{
+		// Breakpoints always start a block
+		if (i > 0 && !breakpoints.empty() && breakpoints.count(address)) break;
+
+		bool end;
+		block->ops.push_back(decode(address, end));
+		address += width;
+		if (end) break;
+	}
+
+	block->size = address - block->address;
+	block->idle = isThumb() ? thumbIdleLoop(*block) : armIdleLoop(*block);
+	block_cache.insert(key, block);
+	return block;
+}
+
+void ARM7TDMI::runBlock(const ARMBlock& block)
+{
+	const unsigned int width = isThumb() ? 2 : 4;
+	block_cache.invalidated = false;
+
+	for (const DecodedOp<ARMHandler>& d : block.ops)
+		if (step(d, width)) return;
+}
+
+// Executes an instruction and records the registers it wrote
+bool ARM7TDMI::traceStep(const DecodedOp<ARMHandler>& d, const unsigned int width)
+{
+	TraceRecord record;
+	record.cycle = cycles;
+	record.pc = r[15] | isThumb();
+	record.op = d.op;
+
+	unsigned int before[16];
+	std::memcpy(before, r, sizeof(before));
+	const bool stop = step(d, width);
+
+	record.cpsr = getCPSR();
+	record.changed = 0;
+	record.reserved = 0;
+	record.values[0] = record.values[1] = 0;
+
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < 16; i++)
+	{
+		// The PC only counts as written by a branch
+		if (i == 15 ? !branched : r[i] == before[i]) continue;
+
+		record.changed |= 1 << i;
+		if (n < 2) record.values[n++] = r[i];
+	}
+
+	trace->push(record);
+	return stop;
+}
+
+void ARM7TDMI::runTracedBlock(const ARMBlock& block)
+{
+	const unsigned int width = isThumb() ? 2 : 4;
+	block_cache.invalidated = false;
+
+	for (const DecodedOp<ARMHandler>& d : block.ops)
+		if (traceStep(d, width)) return;
+}
+
+void ARM7TDMI::executeBlock(ARMBlock& block)
+{
+	if (trace)
+	{
+		runTracedBlock(block);
+		return;
+	}
+
+	switch (mode)
+	{
+	case ExecutionMode::INTERPRETER:
+		runBlock(block);
+		return;
+
+	case ExecutionMode::RECOMPILER:
+		if (!block.native && ++block.executions >= RECOMPILE_THRESHOLD)
+			recompiler->compile(block);
+
+		if (block.native)
+		{
+			block_cache.invalidated = false;
+			resolveFlags();
+			((CompiledBlock)block.native)();
+		}
+		else
+			runBlock(block);
+		return;
+
+	case ExecutionMode::LOCKSTEP:
+		runLockstep(block);
+		return;
+	}
+}
+
+void ARM7TDMI::setExecutionMode(const ExecutionMode m)
+{
+#ifdef ARC_X64
+	if (m != ExecutionMode::INTERPRETER && !recompiler)
+		recompiler = new Recompiler(*this);
+	mode = m;
+#else
+	if (m != ExecutionMode::INTERPRETER)
+		std::cout << "Error: the recompiler requires an x86-64 host!" << std::endl;
+#endif
+}
+
+void ARM7TDMI::recordWrite(const unsigned int address, const unsigned int width, const unsigned int value)
+{
+	const unsigned char* ptr = mem_map->getPointer(address);
+	unsigned int old_value = 0;
+	std::memcpy(&old_value, ptr, width);
+	journal.push_back({ address, width, old_value, value });
+}
+
+void ARM7TDMI::undoWrites(const std::vector<MemoryWrite>& writes)
+{
+	// Stores to read-only memory were dropped, there is nothing to undo
+	for (auto it = writes.rbegin(); it != writes.rend(); it++)
+		if (unsigned char* ptr = mem_map->getWritePointer(it->address))
+			std::memcpy(ptr, &it->old_value, it->width);
+}
+
+ARM7TDMI::CPUState ARM7TDMI::saveState() const
+{
+	CPUState state;
+	for (unsigned int i = 0; i < 16; i++)
+		state.r[i] = r[i];
+	state.cpsr = getCPSR();
+	state.banks = banks;
+	state.cycles = cycles;
+	state.halted = halted;
+	return state;
+}
+
+void ARM7TDMI::loadState(const CPUState& state)
+{
+	for (unsigned int i = 0; i < 16; i++)
+		r[i] = state.r[i];
+	cpsr = state.cpsr;
+	lazy = LAZY_NONE;
+	banks = state.banks;
+	cycles = state.cycles;
+	halted = state.halted;
+	at_breakpoint = false;
+}
+
+// Runs the compiled block and the interpreter from the same state and compares the results
+void ARM7TDMI::runLockstep(ARMBlock& block)
+{
+	if (!block.native) recompiler->compile(block);
+	if (!block.native)
+	{
+		runBlock(block);
+		return;
+	}
+
+	const CPUState start = saveState();
+	journal.clear();
+	record_writes = true;
+
+	block_cache.invalidated = false;
+	resolveFlags();
+	((CompiledBlock)block.native)();
+
+	// Code was overwritten, the pages are no longer watched so the interpreter could not replay it
+	if (block_cache.invalidated)
+	{
+		record_writes = false;
+		return;
+	}
+
+	const CPUState compiled = saveState();
+	std::vector<MemoryWrite> compiled_writes;
+	compiled_writes.swap(journal);
+
+	undoWrites(compiled_writes);
+	loadState(start);
+	runBlock(block);
+	record_writes = false;
+
+	bool match = compiled.cpsr == getCPSR() && compiled.cycles == cycles && compiled_writes.size() == journal.size();
+
+	for (unsigned int i = 0; i < 16; i++)
+		match = match && compiled.r[i] == r[i];
+
+	for (unsigned int i = 0; match && i < journal.size(); i++)
+		match = compiled_writes[i].address == journal[i].address && compiled_writes[i].width == journal[i].width
+			&& compiled_writes[i].value == journal[i].value;
+
+	if (match) return;
+
+	lockstep_errors++;
+	std::cout << "LOCKSTEP MISMATCH IN BLOCK 0x" << std::hex << block.address << (start.cpsr & CPSR_T ? " (THUMB)" : " (ARM)") << std::endl;
+	for (unsigned int i = 0; i < 16; i++)
+		if (compiled.r[i] != r[i])
+			std::cout << "  R" << std::dec << i << ": recompiler = 0x" << std::hex << compiled.r[i] << ", interpreter = 0x" << r[i] << std::endl;
+	std::cout << "  CPSR: recompiler = 0x" << std::hex << compiled.cpsr << ", interpreter = 0x" << getCPSR() << std::endl;
+	std::cout << "  CYCLES: recompiler = " << std::dec << compiled.cycles << ", interpreter = " << cycles << std::endl;
+	std::cout << "  WRITES: recompiler = " << compiled_writes.size() << ", interpreter = " << journal.size() << std::endl;
+}
+
+StopReason ARM7TDMI::run(const unsigned long long budget)
+{
+	const unsigned long long target = cycles + budget;
+
+	while (cycles < target)
+	{
+		if (halted) return StopReason::HALT;
+
+		// The next run continues past the breakpoint
+		if (!at_breakpoint && !breakpoints.empty() && breakpoints.count(r[15]))
+		{
+			at_breakpoint = true;
+			return StopReason::BREAKPOINT;
+		}
+		at_breakpoint = false;
+
+		ARMBlock& block = *getBlock();
+		const unsigned int pc = block.address | isThumb();
+		const unsigned long long start = cycles;
+		const unsigned long long live_reads = mem_map->getLiveReads();
+		executeBlock(block);
+
+		// An idle loop can only exit once an event changes the memory it reads, the iterations up to the target are skipped
+		if (block.idle && r[15] == block.address && cycles < target && !trace && breakpoints.empty() && mem_map->getLiveReads() == live_reads)
+		{
+			const unsigned long long iteration = cycles - start;
+			cycles += (target - cycles + iteration - 1) / iteration * iteration;
+		}
+
+		// Blocks end at branches, a PC past the block means the branch was not taken
+		if (profiler)
+			profiler->record(pc, (unsigned int)(cycles - start), r[15] != block.address + block.size);
+
+		if (faulted)
+		{
+			faulted = false;
+			return StopReason::UNDEFINED;
+		}
+	}
+
+	return StopReason::CYCLE_BUDGET;
+}
+
+// Runs until the end of the current frame
+StopReason ARM7TDMI::runFrame()
+{
+	return run(CYCLES_PER_FRAME - cycles % CYCLES_PER_FRAME);
+}
+
+StopReason ARM7TDMI::stepInstruction()
+{
+	if (halted) return StopReason::HALT;
+
+	bool end;
+	const DecodedOp<ARMHandler> d = decode(r[15], end);
+	block_cache.invalidated = false;
+	if (trace)
+		traceStep(d, isThumb() ? 2 : 4);
+	else
+		step(d, isThumb() ? 2 : 4);
+
+	if (faulted)
+	{
+		faulted = false;
+		return StopReason::UNDEFINED;
+	}
+
+	at_breakpoint = breakpoints.count(r[15]) != 0;
+	return at_breakpoint ? StopReason::BREAKPOINT : StopReason::CYCLE_BUDGET;
+}
+
+void ARM7TDMI::addBreakpoint(const unsigned int address)
+{
+	// Blocks that contain the address are decoded again
+	if (breakpoints.insert(address & ~1).second)
+		block_cache.clear();
+}
+
+void ARM7TDMI::removeBreakpoint(const unsigned int address)
+{
+	breakpoints.erase(address & ~1);
+}
+
+void ARM7TDMI::reset()
 {
 	for (int i = 0; i < 14; i++)
 		r[i] = 0;
 	r[15] = 0x8000000;
 
-	std::string command = "";
-	while (command != "STOP")
+	// Starts in System mode like after the boot ROM
+	banks = {};
+	cpsr = MODE_SYSTEM;
+	lazy = LAZY_NONE;
+	halted = false;
+	faulted = false;
+	at_breakpoint = false;
+}
+
+static const char* stopReasonName(const StopReason reason)
+{
+	switch (reason)
 	{
-		std::string command;
-		std::getline(std::cin, command);
-		unsigned int op = mem_map->readInt(r[15]);
+	case StopReason::CYCLE_BUDGET: return "CYCLE BUDGET";
+	case StopReason::BREAKPOINT: return "BREAKPOINT";
+	case StopReason::HALT: return "HALT";
+	case StopReason::UNDEFINED: return "UNDEFINED INSTRUCTION";
+	default: return "UNKNOWN";
+	}
+}
+
+// Interactive single-step debugger
+void ARM7TDMI::debug()
+{
+	std::cout << "ENTER: step, RUN: run to the next stop, FRAME: run one frame, BREAK <hex address>: toggle breakpoint, "
+		"TRACE <file>: record a binary trace, TRACE: stop recording, PROFILE: start or print and stop profiling, STOP: exit" << std::endl;
 
+	TraceBuffer trace_buffer;
+	TraceWriter* writer = nullptr;
+	Profiler* profile = nullptr;
+
+	std::string command;
+	while (std::getline(std::cin, command) && command != "STOP")
+	{
 		char buffer[arc::HEX_BUFFER_SIZE];
-		std::cout << arc::toHex(buffer, op, 32) << ": " << identify(op) << std::endl;
+		StopReason reason;
 
-		execute(op);
-		r[15] += 4;
+		if (command.empty())
+		{
+			if (isThumb())
+			{
+				const unsigned int op = read16(r[15]);
+				std::cout << arc::toHex(buffer, op, 16) << ": " << identify((unsigned short)op) << std::endl;
+			}
+			else
+			{
+				const unsigned int op = read32(r[15]);
+				std::cout << arc::toHex(buffer, op, 32) << ": " << identify(op) << std::endl;
+			}
+
+			reason = stepInstruction();
+		}
+		else if (command == "RUN")
+			reason = run(~0ULL - cycles);
+		else if (command == "FRAME")
+			reason = runFrame();
+		else if (command.rfind("BREAK ", 0) == 0)
+		{
+			const unsigned int address = (unsigned int)std::stoul(command.substr(6), nullptr, 16) & ~1;
+			if (breakpoints.count(address))
+				removeBreakpoint(address);
+			else
+				addBreakpoint(address);
+			continue;
+		}
+		else if (command.rfind("TRACE", 0) == 0)
+		{
+			setTrace(nullptr);
+			delete writer;
+			writer = nullptr;
+
+			if (command.size() > 6)
+			{
+				writer = new TraceWriter(trace_buffer, command.substr(6).c_str());
+				if (writer->isOpen())
+					setTrace(&trace_buffer);
+				else
+					std::cout << "Error: could not open " << command.substr(6) << "!" << std::endl;
+			}
+			continue;
+		}
+		else if (command == "PROFILE")
+		{
+			if (profile)
+			{
+				profile->print(*this, *mem_map, std::cout);
+				delete profile;
+				profile = nullptr;
+			}
+			else
+				profile = new Profiler();
+			setProfiler(profile);
+			continue;
+		}
+		else
+		{
+			std::cout << "Error: unknown command!" << std::endl;
+			continue;
+		}
+
+		std::cout << "[" << stopReasonName(reason) << "] PC: " << arc::toHex(buffer, r[15], 32) << " CYCLES: " << std::dec << cycles << std::endl;
 	}
-}
\ No newline at end of file
+
+	setTrace(nullptr);
+	delete writer;
+	setProfiler(nullptr);
+	delete profile;
+}
@@ -4,6 +4,11 @@
 #define ARM7_H
 
 #include "Processor.h"
+#include "BlockCache.h"
+#include "Trace.h"
+#include "Profiler.h"
+#include <unordered_set>
+#include <string_view>
 
 enum ARM {
 	UND = 0x00,
@@ -28,113 +33,594 @@ enum ARM {
 	MOV = 0x11,
 	BIC = 0x12,
 	MVN = 0x13,
+	MRS = 0x14,
+	MSR = 0x15,
+	LDRB = 0x16,
+	STRB = 0x17,
+	LDRH = 0x18,
+	STRH = 0x19,
+	LDRSB = 0x1A,
+	LDRSH = 0x1B,
+	SWPB = 0x1C,
 	LDR = 0x1D,
 	STR = 0x1E,
 	MUL = 0x22,
 	MLA = 0x23,
+	UMULL = 0x24,
+	UMLAL = 0x25,
+	SMULL = 0x26,
+	SMLAL = 0x27,
+	LDM = 0x2B,
+	STM = 0x2C,
+	SWI = 0x2D,
 	SWP = 0x2E,
 
 	PRINT = 0xFE,
 	EXPLAIN = 0xFF
 };
 
-class ARM7TDMI : public Processor
+enum THUMBInstruction {
+	T_UND,
+	T_LSL_IMM, T_LSR_IMM, T_ASR_IMM,
+	T_ADD_REG, T_SUB_REG, T_ADD_IMM3, T_SUB_IMM3,
+	T_MOV_IMM, T_CMP_IMM, T_ADD_IMM, T_SUB_IMM,
+	T_AND, T_EOR, T_LSL, T_LSR, T_ASR, T_ADC, T_SBC, T_ROR,
+	T_TST, T_NEG, T_CMP, T_CMN, T_ORR, T_MUL, T_BIC, T_MVN,
+	T_ADD_HI, T_CMP_HI, T_MOV_HI, T_BX,
+	T_LDR_PC,
+	T_STR_REG, T_STRB_REG, T_LDR_REG, T_LDRB_REG,
+	T_STRH_REG, T_LDSB_REG, T_LDRH_REG, T_LDSH_REG,
+	T_STR_IMM, T_LDR_IMM, T_STRB_IMM, T_LDRB_IMM,
+	T_STRH_IMM, T_LDRH_IMM,
+	T_STR_SP, T_LDR_SP,
+	T_ADD_PC, T_ADD_SP,
+	T_ADJ_SP,
+	T_PUSH, T_POP,
+	T_STMIA, T_LDMIA,
+	T_SWI, T_BCOND,
+	T_B,
+	T_BL_HI, T_BL_LO
+};
+
+class ARM7TDMI;
+class Recompiler;
+typedef void (ARM7TDMI::*ARMHandler)(const unsigned int op);
+typedef CodeBlock<ARMHandler> ARMBlock;
+
+constexpr unsigned int MAX_BLOCK_LENGTH = 64; // Maximum number of instructions in a block
+constexpr unsigned int CYCLES_PER_FRAME = 280896; // 228 lines of 1232 cycles
+
+// Flags tracked by the idle loop analysis (after the 16 registers)
+constexpr unsigned int ACCESS_NZ = 1 << 16;
+constexpr unsigned int ACCESS_C = 1 << 17;
+constexpr unsigned int ACCESS_V = 1 << 18;
+constexpr unsigned int ACCESS_NZCV = ACCESS_NZ | ACCESS_C | ACCESS_V;
+
+enum class ExecutionMode {
+	INTERPRETER,	// Blocks are interpreted
+	RECOMPILER,		// Hot blocks are compiled to host code
+	LOCKSTEP		// Compiled blocks are checked against the interpreter
+};
+
+// Reason that a headless run returned
+enum class StopReason {
+	CYCLE_BUDGET,	// The requested number of cycles elapsed
+	BREAKPOINT,		// The PC reached a breakpoint
+	HALT,			// The processor is halted
+	UNDEFINED		// An undefined instruction was executed (the PC points to it)
+};
+
+// Operand types of compiled script lines
+enum ScriptOperandType : unsigned char {
+	SCRIPT_NONE,		// Missing operand (uses R0)
+	SCRIPT_REGISTER,	// Rn
+	SCRIPT_IMMEDIATE,	// #n
+	SCRIPT_MEMORY,		// [base, offset]
+	SCRIPT_WRITE_BACK	// [base, offset]! (base += offset before the access)
+};
+
+struct ScriptOperand
 {
-private:
-	std::vector<unsigned int*> garbage; // Used to track memory to be released
-	bool Z = 0; // Equal
-	bool C = 0; // Unsigned Higher or equal
-	bool N = 0; // Unsigned Lower (Negative)
-	bool V = 0; // Overflow
-	bool THUMB = 0; // THUMB Mode
+	unsigned int base;			// Register index or immediate
+	unsigned int offset;		// Register index or immediate (memory operands)
+	ScriptOperandType type;
+	bool base_register;
+	bool offset_register;
+};
+
+// Script line compiled to bytecode
+struct ScriptOp
+{
+	unsigned int id;			// Instruction id
+	unsigned int line;			// Source line number
+	ScriptOperand args[4];		// Rd, Rm, Rs, Rn
+};
+
+// Program status register bits
+constexpr unsigned int CPSR_N = 0x80000000; // Negative
+constexpr unsigned int CPSR_Z = 0x40000000; // Zero
+constexpr unsigned int CPSR_C = 0x20000000; // Carry (NOT borrow for subtractions)
+constexpr unsigned int CPSR_V = 0x10000000; // Overflow
+constexpr unsigned int CPSR_I = 0x00000080; // IRQ disabled
+constexpr unsigned int CPSR_F = 0x00000040; // FIQ disabled
+constexpr unsigned int CPSR_T = 0x00000020; // THUMB state
+constexpr unsigned int CPSR_MODE = 0x0000001F;
+constexpr unsigned int CPSR_FLAGS = 0xF0000000;
+constexpr unsigned int CPSR_FLAGS_SHIFT = 28;
+
+// Processor modes (CPSR bits 4-0)
+enum ProcessorMode : unsigned int {
+	MODE_USER = 0x10,
+	MODE_FIQ = 0x11,
+	MODE_IRQ = 0x12,
+	MODE_SUPERVISOR = 0x13,
+	MODE_ABORT = 0x17,
+	MODE_UNDEFINED = 0x1B,
+	MODE_SYSTEM = 0x1F
+};
+
+// Flags that are computed when they are read (lazy flag evaluation)
+enum LazyFlags : unsigned char {
+	LAZY_NONE,	// The CPSR holds the flags
+	LAZY_NZ,	// N and Z come from the last result, C and V from the CPSR
+	LAZY_ADD	// Every flag comes from the last addition
+};
+
+// Register banks, User and System mode share the same registers
+enum RegisterBank : unsigned int {
+	BANK_USER,
+	BANK_FIQ,
+	BANK_IRQ,
+	BANK_SUPERVISOR,
+	BANK_ABORT,
+	BANK_UNDEFINED,
+	NUM_BANKS
+};
 
-	void releaseTempPointers()
+constexpr RegisterBank modeBank(const unsigned int mode)
+{
+	switch (mode & CPSR_MODE)
 	{
-		while (!garbage.empty())
+	case MODE_FIQ: return BANK_FIQ;
+	case MODE_IRQ: return BANK_IRQ;
+	case MODE_SUPERVISOR: return BANK_SUPERVISOR;
+	case MODE_ABORT: return BANK_ABORT;
+	case MODE_UNDEFINED: return BANK_UNDEFINED;
+	default: return BANK_USER;
+	}
+}
+
+// Exception vectors
+constexpr unsigned int VECTOR_SWI = 0x08;
+constexpr unsigned int VECTOR_IRQ = 0x18;
+
+// Returns the NZCV values (bits N = 3 to V = 0) for which a condition passes
+constexpr unsigned short conditionMask(const unsigned int cond)
+{
+	unsigned short mask = 0;
+	for (unsigned int nzcv = 0; nzcv < 16; nzcv++)
+	{
+		const bool N = nzcv & 8, Z = nzcv & 4, C = nzcv & 2, V = nzcv & 1;
+		bool pass = false;
+		switch (cond)
 		{
-			delete garbage.back();
-			garbage.pop_back();
+		case 0x0: pass = Z; break;
+		case 0x1: pass = !Z; break;
+		case 0x2: pass = C; break;
+		case 0x3: pass = !C; break;
+		case 0x4: pass = N; break;
+		case 0x5: pass = !N; break;
+		case 0x6: pass = V; break;
+		case 0x7: pass = !V; break;
+		case 0x8: pass = C && !Z; break;
+		case 0x9: pass = !C || Z; break;
+		case 0xA: pass = N == V; break;
+		case 0xB: pass = N != V; break;
+		case 0xC: pass = !Z && (N == V); break;
+		case 0xD: pass = Z || (N != V); break;
+		case 0xE: pass = true; break;
+		default: pass = false; break;
 		}
+		mask |= pass << nzcv;
 	}
+	return mask;
+}
+
+// Bit NZCV of an entry is set when the condition passes
+constexpr unsigned short CONDITION_TABLE[16] = {
+	conditionMask(0x0), conditionMask(0x1), conditionMask(0x2), conditionMask(0x3),
+	conditionMask(0x4), conditionMask(0x5), conditionMask(0x6), conditionMask(0x7),
+	conditionMask(0x8), conditionMask(0x9), conditionMask(0xA), conditionMask(0xB),
+	conditionMask(0xC), conditionMask(0xD), conditionMask(0xE), conditionMask(0xF)
+};
+
+// ARM opcodes are decoded using bits 27-20 and 7-4
+constexpr unsigned int ARM_DECODE_SIZE = 4096;
+constexpr unsigned int ARM_DECODE_MASK = 0x0FF000F0;
+constexpr unsigned int armDecodeIndex(const unsigned int op) { return ((op >> 16) & 0xFF0) | ((op >> 4) & 0xF); }
+constexpr unsigned int armDecodeBits(const unsigned int index) { return ((index & 0xFF0) << 16) | ((index & 0xF) << 4); }
+
+// THUMB opcodes are decoded using bits 15-6
+constexpr unsigned int THUMB_DECODE_SIZE = 1024;
+constexpr unsigned int THUMB_DECODE_MASK = 0xFFC0;
+constexpr unsigned int thumbDecodeIndex(const unsigned int op) { return (op >> 6) & 0x3FF; }
+constexpr unsigned int thumbDecodeBits(const unsigned int index) { return index << 6; }
 
-	unsigned int* makeTempPointer(const unsigned int val)
+class ARM7TDMI : public Processor
+{
+	friend class Recompiler;
+	friend class Disassembler;
+	friend class Benchmark;
+
+public:
+	// Registers of the inactive modes, the current mode always works on r[] directly
+	struct RegisterBanks
 	{
-		garbage.push_back(new unsigned int(val));
-		return garbage.back();
+		unsigned int sp[NUM_BANKS];		// R13 (the entry of the current bank is stale)
+		unsigned int lr[NUM_BANKS];		// R14 (the entry of the current bank is stale)
+		unsigned int spsr[NUM_BANKS];	// Saved program status (unused by User and System mode)
+		unsigned int high[5];			// R8-R12 of FIQ mode, or of the other modes while in FIQ mode
+		RegisterBank current;
+	};
+
+	// Register state (compared by the lockstep mode and stored in save states)
+	struct CPUState
+	{
+		unsigned int r[16];
+		unsigned int cpsr;
+		RegisterBanks banks;
+		unsigned long long cycles;
+		bool halted;
+	};
+
+private:
+
+	// Memory write recorded by the lockstep mode
+	struct MemoryWrite
+	{
+		unsigned int address;
+		unsigned int width;
+		unsigned int old_value;
+		unsigned int value;
+	};
+
+	InstructionSet* thumb_instructions;
+	BlockCache<ARMHandler> block_cache;
+	ExecutionMode mode = ExecutionMode::INTERPRETER;
+	Recompiler* recompiler = nullptr;
+	std::vector<MemoryWrite> journal;
+	bool record_writes = 0; // Records writes to the journal
+	unsigned int lockstep_errors = 0;
+	std::unordered_set<unsigned int> breakpoints;
+	TraceBuffer* trace = nullptr; // Blocks are interpreted and recorded while set
+	Profiler* profiler = nullptr; // Executed blocks are counted while set
+	unsigned int cpsr = MODE_SYSTEM; // Current program status register (the flags are stale while lazy is set)
+	LazyFlags lazy = LAZY_NONE; // Flags of the last flag-setting operation that are not written to the CPSR
+	unsigned int lazy_result = 0; // Result of the last flag-setting operation (N, Z)
+	unsigned int lazy_a = 0; // Operands of the last addition (C, V), subtractions add the inverted operand
+	unsigned int lazy_b = 0;
+	unsigned long long flag_writes = 0; // Flag-setting operations (each one a CPSR write without lazy flags)
+	unsigned long long flag_resolves = 0; // Pending flags written to the CPSR
+	RegisterBanks banks = {};
+	bool branched = 0; // Set when the executed instruction wrote to the PC
+	bool halted = 0; // Set until an interrupt wakes the processor
+	bool faulted = 0; // Set when an undefined instruction was executed
+	bool at_breakpoint = 0; // The last stop was at the breakpoint of the PC
+
+	// Computes NZCV (bits 31-28) from the last flag-setting operation
+	inline unsigned int flags() const
+	{
+		if (lazy == LAZY_NONE) return cpsr & CPSR_FLAGS;
+
+		const unsigned int nz = (lazy_result & CPSR_N) | (lazy_result ? 0 : CPSR_Z);
+		if (lazy == LAZY_NZ) return nz | (cpsr & (CPSR_C | CPSR_V));
+
+		// Carry out and signed overflow of bit 31
+		const unsigned int c = ((lazy_a & lazy_b) | ((lazy_a | lazy_b) & ~lazy_result)) >> 31;
+		const unsigned int v = (~(lazy_a ^ lazy_b) & (lazy_a ^ lazy_result)) >> 31;
+		return nz | (c << 29) | (v << 28);
 	}
 
-	unsigned int* getVariable(const std::string& word)
+	// Writes the pending flags to the CPSR
+	inline void resolveFlags()
 	{
-		if (word.length() <= 1) return makeTempPointer(0);
+		if (lazy == LAZY_NONE) return;
+		flag_resolves++;
+		cpsr = (cpsr & ~CPSR_FLAGS) | flags();
+		lazy = LAZY_NONE;
+	}
 
-		switch (word[0])
-		{
-		case '[': 
+	// Checks the condition field (bits 31-28 of an ARM opcode), the flags are only computed for conditional instructions
+	inline bool condition(const unsigned int cond)
+	{
+		if (cond == 0xE) return true;
+		resolveFlags();
+		return (CONDITION_TABLE[cond] >> (cpsr >> CPSR_FLAGS_SHIFT)) & 1;
+	}
+
+	inline bool isThumb() const { return (cpsr & CPSR_T) != 0; }
+
+	inline unsigned int carry()
+	{
+		resolveFlags();
+		return (cpsr >> 29) & 1;
+	}
+
+	inline void setThumb(const bool thumb)
+	{
+		cpsr = (cpsr & ~CPSR_T) | (thumb ? CPSR_T : 0);
+	}
+
+	inline void setCarry(const unsigned int c)
+	{
+		if (lazy == LAZY_ADD) resolveFlags();
+		cpsr = (cpsr & ~CPSR_C) | (c << 29);
+	}
+
+	inline unsigned int& spsr() { return banks.spsr[banks.current]; }
+
+	void switchMode(const unsigned int mode);
+
+	// Writes the CPSR, the registers are only swapped if the bank changes
+	inline void writeCPSR(const unsigned int value)
+	{
+		if (modeBank(value) != banks.current) switchMode(value & CPSR_MODE);
+		cpsr = value;
+		lazy = LAZY_NONE;
+	}
+
+	void enterException(const unsigned int mode, const unsigned int vector, const unsigned int link);
+	void returnFromException(const unsigned int address);
+
+	// Writes to the PC flush the pipeline
+	inline void jump(const unsigned int address)
+	{
+		r[15] = address;
+		branched = true;
+	}
+
+	// Sets N and Z from the result of a logical operation (C and V are kept)
+	inline void setNZ(const unsigned int result)
+	{
+		if (lazy == LAZY_ADD) resolveFlags();
+		lazy = LAZY_NZ;
+		lazy_result = result;
+		flag_writes++;
+	}
+
+	// Adds with carry and updates all flags (computed when they are read)
+	inline unsigned int addFlags(const unsigned int a, const unsigned int b, const unsigned int carry)
+	{
+		const unsigned int result = a + b + carry;
+		lazy = LAZY_ADD;
+		lazy_result = result;
+		lazy_a = a;
+		lazy_b = b;
+		flag_writes++;
+		return result;
+	}
+
+	// Subtracts with borrow (C = NOT borrow) and updates all flags
+	inline unsigned int subFlags(const unsigned int a, const unsigned int b, const unsigned int carry = 1)
+	{
+		return addFlags(a, ~b, carry);
+	}
+
+	// Barrel shifter operations, updates C with the carry out when the shift amount is non-zero
+	inline unsigned int shiftLSL(const unsigned int value, const unsigned int amount)
+	{
+		if (amount == 0) return value;
+		if (amount > 32) { setCarry(0); return 0; }
+		setCarry((value >> (32 - amount)) & 1);
+		return amount == 32 ? 0 : value << amount;
+	}
+
+	inline unsigned int shiftLSR(const unsigned int value, const unsigned int amount)
+	{
+		if (amount == 0) return value;
+		if (amount > 32) { setCarry(0); return 0; }
+		setCarry((value >> (amount - 1)) & 1);
+		return amount == 32 ? 0 : value >> amount;
+	}
+
+	inline unsigned int shiftASR(const unsigned int value, const unsigned int amount)
+	{
+		if (amount == 0) return value;
+		if (amount >= 32) { setCarry(value >> 31); return (unsigned int)((int)value >> 31); }
+		setCarry((value >> (amount - 1)) & 1);
+		return (unsigned int)((int)value >> amount);
+	}
+
+	inline unsigned int shiftROR(const unsigned int value, const unsigned int amount)
+	{
+		if (amount == 0) return value;
+		const unsigned int result = rotate(value, amount);
+		setCarry(result >> 31);
+		return result;
+	}
+
+	// Shifted register operand of an ARM opcode (Type is bits 6-5), carry_out is only written if Carry is set and C changes
+	template <unsigned int Type, bool ByRegister, bool Carry>
+	inline unsigned int shiftOperand(const unsigned int op, unsigned int& carry_out);
+
+	static constexpr unsigned int rotate(const unsigned int value, const unsigned int amount)
+	{
+		return (value >> (amount & 31)) | (value << ((32 - amount) & 31));
+	}
+
+	// Memory accesses go through the typed accesses of the map (aligned to their width, unaligned reads are rotated)
+	inline unsigned int read32(const unsigned int address)
+	{
+		return mem_map->read32(address);
+	}
+
+	inline unsigned int read16(const unsigned int address)
+	{
+		return mem_map->read16(address);
+	}
+
+	inline unsigned int read8(const unsigned int address)
+	{
+		return mem_map->read8(address);
+	}
+
+	inline void write32(const unsigned int address, const unsigned int value)
+	{
+		if (record_writes) recordWrite(address & ~3, 4, value);
+		mem_map->write32(address, value);
+	}
+
+	inline void write16(const unsigned int address, const unsigned int value)
+	{
+		if (record_writes) recordWrite(address & ~1, 2, value & 0xFFFF);
+		mem_map->write16(address, value);
+	}
+
+	inline void write8(const unsigned int address, const unsigned int value)
+	{
+		if (record_writes) recordWrite(address, 1, value & 0xFF);
+		mem_map->write8(address, value);
+	}
+
+	// Consecutive words of LDM, STM, PUSH and POP, moved at once when they are in one component without IO
+	inline void readWords(const unsigned int address, unsigned int* values, const unsigned int count)
+	{
+		if (const unsigned char* host = mem_map->getRange(address & ~3, count << 2))
 		{
-			bool WRITE_BACK = word[word.length() - 1] == '!';
-
-			std::string arg = WRITE_BACK ? word.substr(1, word.length() - 3) : word.substr(1, word.length() - 2);
-			std::vector<std::string> parsed = parseCommand(arg);
-			unsigned int* arg_0 = parsed.size() > 0 ? getVariable(parsed[0]) : r;
-
-			if (parsed.size() > 1)
-			{
-				unsigned int* arg_1 = getVariable(parsed[1]);
-				if (WRITE_BACK)
-				{
-					*arg_0 += *arg_1;
-					return (unsigned int*)mem_map->getPointer((*arg_0));
-				}
-				else
-					return (unsigned int*)mem_map->getPointer((*arg_0) + (*arg_1));
-			}
-			else
-				return (unsigned int*)mem_map->getPointer(*arg_0);
+			std::memcpy(values, host, count << 2);
+			return;
 		}
 
-		default:
-		case '#': return makeTempPointer(atoi(word.substr(1).c_str()));
+		for (unsigned int i = 0; i < count; i++)
+			values[i] = read32((address & ~3) + (i << 2));
+	}
 
-		case 'R':
-		case 'r':
+	inline void writeWords(const unsigned int address, const unsigned int* values, const unsigned int count)
+	{
+		// The lockstep journal records every word
+		unsigned char* host = record_writes ? nullptr : mem_map->getRange(address & ~3, count << 2, true);
+		if (host)
 		{
-			unsigned int reg = atoi(word.substr(1).c_str());
-			if (reg > 0xF)
-			{
-				std::cout << "Error: Register id is too large!" << std::endl;
-				return r;
-			}
-			else
-				return r + reg;
-		}
+			std::memcpy(host, values, count << 2);
+			mem_map->notifyRange(address & ~3, count << 2);
+			return;
 		}
+
+		for (unsigned int i = 0; i < count; i++)
+			write32((address & ~3) + (i << 2), values[i]);
 	}
 
-	const Instruction* getPrintInstruction();
+	void recordWrite(const unsigned int address, const unsigned int width, const unsigned int value);
+	void undoWrites(const std::vector<MemoryWrite>& writes);
+
+	void loadThumbInstructionSet();
 
-	const Instruction* findInstructionWithMnemonic(std::string mnemonic)
+	// Resolve opcodes to handlers (through the tables generated from ARM_ISA and THUMB_ISA)
+	static const DecodeEntry<ARMHandler>& decodeARM(const unsigned int op);
+	static const DecodeEntry<ARMHandler>& decodeTHUMB(const unsigned int op);
+
+	// Entries that decodeARM and decodeTHUMB visit for an opcode (measured by the benchmark)
+	static unsigned int armDecodeCompares(const unsigned int op);
+	static unsigned int thumbDecodeCompares(const unsigned int op);
+
+	static bool armEndsBlock(const unsigned int op);
+	static bool thumbEndsBlock(const unsigned int op);
+	static bool armIdleLoop(const ARMBlock& block);
+	static bool thumbIdleLoop(const ARMBlock& block);
+	static unsigned char armCycles(const unsigned int op);
+	static unsigned char thumbCycles(const unsigned int op);
+	DecodedOp<ARMHandler> decode(const unsigned int address, bool& end);
+	ARMBlock* getBlock();
+	void runBlock(const ARMBlock& block);
+	bool traceStep(const DecodedOp<ARMHandler>& d, const unsigned int width);
+	void runTracedBlock(const ARMBlock& block);
+	void runLockstep(ARMBlock& block);
+
+	// Executes a decoded instruction, returns true if the block must stop
+	inline bool step(const DecodedOp<ARMHandler>& d, const unsigned int width)
 	{
-		for (unsigned int i = 0; i < mnemonic.size(); i++)
-			mnemonic[i] = std::toupper(mnemonic[i]);
+		// The PC reads 2 instructions ahead while executing
+		const unsigned int pc = r[15];
+		r[15] = pc + (width << 1);
+		branched = false;
 
-		for (unsigned int i = 0; i < instructions->size(); i++){
-			const Instruction* instr = instructions->getInstructionById(i);
-			if (instr->mnemonic == mnemonic)
-				return instr;
+		if (condition(d.cond))
+		{
+			(this->*d.handler)(d.op);
+			cycles += d.cycles;
 		}
+		else
+			cycles++;
+
+		if (branched) return true;
+		r[15] = pc + width;
 
-		return instructions->getInstructionById(UND);
+		// The block wrote to its own code or halted the processor
+		return block_cache.invalidated || halted;
 	}
 
+	// Entry point for compiled code (r[15] must hold the address of the instruction)
+	static bool interpretOp(ARM7TDMI* cpu, const DecodedOp<ARMHandler>* d)
+	{
+		// Compiled code reads the flags from the CPSR
+		const bool stop = cpu->step(*d, cpu->isThumb() ? 2 : 4);
+		cpu->resolveFlags();
+		return stop;
+	}
+
+	unsigned int* scriptOperand(const ScriptOperand& arg, unsigned int& imm);
+	bool compileScriptLine(const std::string_view line, const unsigned int number, ScriptOp& op) const;
+	unsigned int findInstruction(const std::string_view mnemonic) const;
+
+	const Instruction* getPrintInstruction();
+
 public:
 	ARM7TDMI(unsigned long clock);
-	~ARM7TDMI() {}
+	~ARM7TDMI();
 
-	void undefined(unsigned int& op)
+	// Stops the run with the PC pointing to the instruction
+	void undefined(const unsigned int)
 	{
-		std::cout << "Executing unknown instruction 0x" << std::hex << op << std::endl;
+		faulted = true;
+		jump(r[15] - (isThumb() ? 4 : 8));
 	}
 
+	void unimplemented(const unsigned int) {}
+	void branch(const unsigned int op);
+	void branchExchange(const unsigned int op);
+	void moveFromPSR(const unsigned int op);
+	void moveToPSR(const unsigned int op);
+	void blockTransfer(const unsigned int op);
+	void softwareInterrupt(const unsigned int op);
+
+	// Instantiated for every form of their opcode bits (see the FORMS tables of ARM7.cpp)
+	template <unsigned int Form> void dataProcessing(const unsigned int op);
+	template <unsigned int Form> void multiply(const unsigned int op);
+	template <unsigned int Form> void singleTransfer(const unsigned int op);
+	template <unsigned int Form> void halfwordTransfer(const unsigned int op);
+	template <bool Byte> void singleSwap(const unsigned int op);
+
+	// THUMB handlers
+	void thumbShift(const unsigned int op);
+	void thumbAddSub(const unsigned int op);
+	void thumbImmediate(const unsigned int op);
+	void thumbALU(const unsigned int op);
+	void thumbHiRegister(const unsigned int op);
+	void thumbLoadPC(const unsigned int op);
+	void thumbLoadStoreReg(const unsigned int op);
+	void thumbLoadStoreSigned(const unsigned int op);
+	void thumbLoadStoreImm(const unsigned int op);
+	void thumbLoadStoreHalf(const unsigned int op);
+	void thumbLoadStoreSP(const unsigned int op);
+	void thumbLoadAddress(const unsigned int op);
+	void thumbAdjustSP(const unsigned int op);
+	void thumbPushPop(const unsigned int op);
+	void thumbLoadStoreMultiple(const unsigned int op);
+	void thumbSoftwareInterrupt(const unsigned int op);
+	void thumbBranchCond(const unsigned int op);
+	void thumbBranch(const unsigned int op);
+	void thumbBranchLink(const unsigned int op);
+
 	void readHeader(const ROM& rom)
 	{
 		const unsigned char* buffer = rom.getROM();
@@ -174,9 +660,77 @@ public:
 		return;
 	}
 
-	void start();
-	void interpret(std::string line);
+	void setMemoryMap(MemoryMap* map) override
+	{
+		Processor::setMemoryMap(map);
+		block_cache.attach(map);
+	}
+
+	void setExecutionMode(const ExecutionMode m);
+	ExecutionMode getExecutionMode() const { return mode; }
+	unsigned int getLockstepErrors() const { return lockstep_errors; }
+	void executeBlock(ARMBlock& block);
+
+	// Headless execution without I/O, blocks that cross the end of the budget finish first
+	StopReason run(const unsigned long long budget);
+	StopReason runFrame();
+	StopReason stepInstruction();
+
+	/**
+	 * @brief Records every executed instruction (compiled blocks are not used while tracing)
+	 * @param buffer - trace ring (nullptr disables tracing)
+	*/
+	void setTrace(TraceBuffer* buffer) { trace = buffer; }
+
+	/**
+	 * @brief Counts the executions, cycles and taken branches of the blocks run by run and runFrame
+	 * @param p - profile (nullptr disables profiling)
+	*/
+	void setProfiler(Profiler* p) { profiler = p; }
+
+	CPUState saveState() const;
+
+	/**
+	 * @brief Restores the registers, compiled blocks are invalidated by restoring the memory they were decoded from
+	 * @param state - state returned by saveState
+	*/
+	void loadState(const CPUState& state);
+
+	void addBreakpoint(const unsigned int address);
+	void removeBreakpoint(const unsigned int address);
+	/**
+	 * @brief Halts or wakes the processor, a halt ends the current block
+	 * @param h - true until an interrupt is requested
+	*/
+	void setHalted(const bool h) { halted = h; }
+
+	/**
+	 * @brief Enters the IRQ handler between two instructions
+	 * @return false if IRQs are disabled by the CPSR
+	*/
+	bool interrupt();
+
+	/**
+	 * @brief Sets the stack pointer of a mode (R13 if the mode is current)
+	 * @param mode - processor mode
+	 * @param sp - stack address
+	*/
+	void setStackPointer(const unsigned int mode, const unsigned int sp);
+
+	unsigned int getPC() const { return r[15]; }
+	unsigned int getCPSR() const { return (cpsr & ~CPSR_FLAGS) | flags(); }
+	bool isHalted() const { return halted; }
+	unsigned long long getCycles() const { return cycles; }
+	void addCycles(const unsigned long long n) { cycles += n; }
+
+	void reset();
+	void debug();
+	void interpret(const std::string_view line);
+	bool compileScript(std::istream& stream, std::vector<ScriptOp>& script) const;
+	void executeScript(const ScriptOp& op);
+	void runScript(const std::vector<ScriptOp>& script);
 	std::string identify(unsigned int opcode);
+	std::string identify(unsigned short opcode);
 	void execute(unsigned int opcode);
 	void execute(unsigned short opcode);
 	const char* getName() { return "ARM7TDMI"; }
@@ -0,0 +1,148 @@
+#include "BatchRunner.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <thread>
+
+// Work RAM hashed into the checksum of a machine
+constexpr unsigned int CHECKSUM_REGIONS[][2] = { { 0x2000000, 0x40000 }, { 0x3000000, 0x8000 } };
+
+bool BatchRunner::WorkQueue::pop(unsigned int& job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (jobs.empty()) return false;
+	job = jobs.front();
+	jobs.pop_front();
+	return true;
+}
+
+bool BatchRunner::WorkQueue::steal(unsigned int& job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (jobs.empty()) return false;
+	job = jobs.back();
+	jobs.pop_back();
+	return true;
+}
+
+void BatchRunner::runMachine(const std::string& rom, const unsigned int frames, MachineResult& result)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	// Every machine owns its processor, memory map and devices
+	std::unique_ptr<GBA> gba = std::make_unique<GBA>();
+	gba->loadROM(rom.c_str());
+	gba->reset();
+
+	result.rom = rom;
+	result.loaded = gba->getROM().getLoadedSize() > 0;
+	result.reason = StopReason::CYCLE_BUDGET;
+	result.frames = 0;
+
+	while (result.loaded && result.frames < frames)
+	{
+		result.reason = gba->runFrame();
+		if (result.reason == StopReason::UNDEFINED) break;
+		result.frames++;
+	}
+
+	result.cycles = gba->getProcessor().getCycles();
+	result.pc = gba->getProcessor().getPC();
+
+	unsigned int hash = 2166136261u;
+	for (const auto& region : CHECKSUM_REGIONS)
+	{
+		const unsigned char* data = gba->getMemoryMap().getPointer(region[0]);
+		for (unsigned int i = 0; i < region[1]; i++)
+			hash = (hash ^ data[i]) * 16777619u;
+	}
+	result.checksum = hash;
+
+	gba.reset(); // The machine is destroyed within the measured time
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+BatchReport BatchRunner::run(const std::vector<std::string>& roms, const unsigned int frames, unsigned int threads)
+{
+	const unsigned int count = (unsigned int)roms.size();
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1u, std::min(threads, count));
+
+	BatchReport report;
+	report.results.resize(count);
+	report.frames = report.cycles = 0;
+
+	// Every thread starts with a contiguous range of the ROMs
+	std::vector<WorkQueue> queues(threads);
+	for (unsigned int i = 0; i < count; i++)
+		queues[(unsigned long long)i * threads / count].jobs.push_back(i);
+
+	std::atomic<unsigned long long> steals(0);
+
+	auto worker = [&](const unsigned int id)
+	{
+		unsigned int job;
+		for (;;)
+		{
+			bool found = queues[id].pop(job);
+
+			// Jobs are never added while running, so empty queues mean the batch is done
+			for (unsigned int i = 1; !found && i < threads; i++)
+				if ((found = queues[(id + i) % threads].steal(job)))
+					steals++;
+
+			if (!found) return;
+
+			runMachine(roms[job], frames, report.results[job]);
+			report.results[job].worker = id;
+		}
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.emplace_back(worker, i);
+	worker(0);
+
+	for (std::thread& t : pool)
+		t.join();
+
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report.steals = steals;
+
+	for (const MachineResult& result : report.results)
+	{
+		report.frames += result.frames;
+		report.cycles += result.cycles;
+	}
+
+	return report;
+}
+
+void BatchRunner::print(const BatchReport& report, std::ostream& out)
+{
+	static const char* REASONS[] = { "OK", "BREAKPOINT", "HALT", "UNDEFINED" };
+	char buffer[arc::HEX_BUFFER_SIZE];
+
+	for (const MachineResult& result : report.results)
+	{
+		out << std::left << std::setw(40) << result.rom << std::right;
+		if (!result.loaded)
+		{
+			out << "  NOT LOADED\n";
+			continue;
+		}
+
+		out << "  " << std::setw(10) << REASONS[(unsigned int)result.reason];
+		out << "  frames=" << std::dec << result.frames << "  pc=" << arc::toHex(buffer, result.pc, 32);
+		out << "  hash=" << arc::toHex(buffer, result.checksum, 32);
+		out << "  " << std::fixed << std::setprecision(1) << (result.seconds > 0 ? result.frames / result.seconds : 0) << " fps\n";
+	}
+
+	out << "\n" << report.results.size() << " machines, " << report.frames << " frames in " << std::setprecision(2) << report.seconds << " s";
+	out << " (" << std::setprecision(1) << report.framesPerSecond() << " fps, " << (report.seconds > 0 ? report.cycles / report.seconds / 1e6 : 0) << " MHz";
+	out << ", " << report.steals << " stolen)" << std::endl;
+}
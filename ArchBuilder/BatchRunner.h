@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include "GBA.h"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Outcome of one emulated machine
+struct MachineResult
+{
+	std::string rom;
+	bool loaded;				// The ROM could be read
+	StopReason reason;			// Reason the last frame stopped
+	unsigned int frames;		// Frames completed
+	unsigned long long cycles;	// Emulated cycles
+	unsigned int pc;			// PC after the last frame
+	unsigned int checksum;		// FNV-1a hash of the work RAM (compares runs of the same ROM)
+	double seconds;				// Host time spent on the machine
+	unsigned int worker;		// Thread that ran the machine
+};
+
+// Results of a batch, in the order of the ROMs
+struct BatchReport
+{
+	std::vector<MachineResult> results;
+	double seconds;				// Wall time of the batch
+	unsigned long long frames;	// Frames completed by every machine
+	unsigned long long cycles;	// Cycles emulated by every machine
+	unsigned long long steals;	// Machines taken from the queue of another thread
+
+	double framesPerSecond() const { return seconds > 0 ? frames / seconds : 0; }
+};
+
+/**
+ * @brief Runs many independent machines on all cores.
+ * Every thread owns a queue of machines, takes work from the front of its own queue
+ * and steals from the back of the others once it runs dry.
+*/
+class BatchRunner
+{
+private:
+	// Queue of ROM indices owned by a thread
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<unsigned int> jobs;
+
+		bool pop(unsigned int& job);
+		bool steal(unsigned int& job);
+	};
+
+	static void runMachine(const std::string& rom, const unsigned int frames, MachineResult& result);
+
+public:
+	/**
+	 * @brief Runs every ROM on its own machine for a fixed number of frames
+	 * @param roms - paths of the ROMs
+	 * @param frames - frames run by each machine (stops early on an undefined instruction)
+	 * @param threads - number of worker threads (0 uses every core)
+	 * @return per machine results and throughput
+	*/
+	static BatchReport run(const std::vector<std::string>& roms, const unsigned int frames, unsigned int threads = 0);
+
+	/**
+	 * @brief Prints a report as a table
+	*/
+	static void print(const BatchReport& report, std::ostream& out);
+};
+
+#endif
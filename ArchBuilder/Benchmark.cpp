@@ -0,0 +1,464 @@
+#include "Benchmark.h"
+#include "Recompiler.h"
+#include "Rewind.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+// Guest code (IWRAM) and the memory its loads and stores use (EWRAM)
+constexpr unsigned int CODE_ADDRESS = 0x3000000;
+constexpr unsigned int DATA_ADDRESS = 0x2000000;
+constexpr unsigned int LOOP_REPEAT = 32;		// Repetitions of a loop body
+constexpr unsigned long long LOOP_CYCLES = 1 << 21;	// Cycles of one timed run of a loop
+constexpr unsigned int CODE_SIZE = 0x40000;		// Bytes of cartridge code read from the entry point
+constexpr unsigned int DECODE_COUNT = 1 << 22;	// Opcodes of one timed decoding run
+constexpr unsigned int ACCESS_COUNT = 1 << 22;	// Accesses of one timed memory run
+
+// Keeps the results of the measured work alive
+static volatile unsigned int sink;
+
+// THUMB instruction classes, then the ARM cases of the data processing, block transfer and mode changes
+static const std::vector<std::pair<const char*, std::vector<unsigned int>>> THUMB_LOOPS = {
+	{ "shift (LSLS)", { 0x0040 } },
+	{ "add/sub (ADDS Rd, Rs, Rn)", { 0x1840 } },
+	{ "immediate (ADDS #)", { 0x3001 } },
+	{ "ALU (EORS)", { 0x4048 } },
+	{ "high register (ADD R8)", { 0x4480 } },
+	{ "PC-relative load", { 0x4800 } },
+	{ "register offset (LDR)", { 0x5888 } },
+	{ "sign extended (LDRSH)", { 0x5E88 } },
+	{ "immediate offset (LDR/STR)", { 0x6808, 0x6048 } },
+	{ "halfword (LDRH/STRH)", { 0x8808, 0x8048 } },
+	{ "SP-relative (STR/LDR)", { 0x9000, 0x9800 } },
+	{ "load address (ADD PC)", { 0xA000 } },
+	{ "adjust SP (ADD/SUB)", { 0xB001, 0xB081 } },
+	{ "PUSH/POP {R0-R7}", { 0xB4FF, 0xBCFF } },
+	{ "STMIA {R2, R3} + SUBS", { 0xC10C, 0x3908 } },
+	{ "branch not taken (BEQ)", { 0xD000 } },
+	{ "flags (ADDS/CMP/BNE)", { 0x3001, 0x4288, 0xD1FF } },
+	{ "branch (B)", { 0xE7FF } },
+	{ "branch with link (BL)", { 0xF000, 0xF800 } },
+};
+
+static const std::vector<std::pair<const char*, std::vector<unsigned int>>> ARM_LOOPS = {
+	{ "data processing (ADDS)", { 0xE0900001 } },
+	{ "load/store (LDR/STR)", { 0xE5912000, 0xE5812004 } },
+	{ "LDMIA/STMIA 8 registers", { 0xE890077C, 0xE881077C } },
+	{ "mode change (MSR CPSR_c)", { 0xE321F012, 0xE321F01F } },
+};
+
+// Discards the messages printed while it exists (construction of a machine and loading of a cartridge)
+class QuietOutput
+{
+	std::ostringstream log;
+	std::streambuf* const previous;
+
+public:
+	QuietOutput() : previous(std::cout.rdbuf(log.rdbuf())) {}
+	~QuietOutput() { std::cout.rdbuf(previous); }
+};
+
+static std::unique_ptr<GBA> createMachine()
+{
+	QuietOutput quiet;
+	return std::make_unique<GBA>();
+}
+
+// One line of a table: the name, then the columns
+static std::ostream& row(std::ostream& out, const std::string& name)
+{
+	return out << "  " << std::left << std::setw(36) << name << std::right;
+}
+
+double Benchmark::best(const std::function<void()>& run, const unsigned int runs)
+{
+	double seconds = 1e30;
+	for (unsigned int i = 0; i < runs; i++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		run();
+		seconds = std::min(seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return seconds;
+}
+
+// Words of a cartridge from the target of the branch in its first word (the entry point)
+std::vector<unsigned int> Benchmark::readCode(const char* rom)
+{
+	std::ifstream stream(rom, std::ios::in | std::ios::binary);
+	unsigned int branch = 0;
+	stream.read((char*)&branch, sizeof(branch));
+	if (!stream || (branch & 0xFF000000) != 0xEA000000) return {};
+
+	std::vector<unsigned int> code(CODE_SIZE >> 2);
+	stream.seekg(((branch & 0xFFFFFF) << 2) + 8);
+	stream.read((char*)code.data(), CODE_SIZE);
+	code.resize((size_t)stream.gcount() >> 2);
+	return code;
+}
+
+// Writes a loop to IWRAM and starts the processor on it, returns the guest instructions per cycle
+double Benchmark::startLoop(GBA& gba, const Loop& loop, const ExecutionMode mode)
+{
+	ARM7TDMI& cpu = gba.getProcessor();
+	const unsigned int width = loop.thumb ? 2 : 4;
+
+	// The counter keeps the loop from being skipped as idle
+	unsigned int address = CODE_ADDRESS;
+	for (unsigned int i = 0; i < LOOP_REPEAT; i++)
+		for (const unsigned int op : loop.body)
+		{
+			if (loop.thumb) cpu.write16(address, op);
+			else cpu.write32(address, op);
+			address += width;
+		}
+	if (loop.thumb)
+	{
+		cpu.write16(address, 0x3701); // ADDS R7, #1
+		cpu.write16(address + 2, 0xE000 | (((CODE_ADDRESS - address - 6) >> 1) & 0x7FF)); // B CODE_ADDRESS
+	}
+	else
+	{
+		cpu.write32(address, 0xE2977001); // ADDS R7, R7, #1
+		cpu.write32(address + 4, 0xEA000000 | (((CODE_ADDRESS - address - 12) >> 2) & 0xFFFFFF)); // B CODE_ADDRESS
+	}
+	const unsigned int count = LOOP_REPEAT * (unsigned int)loop.body.size() + 2;
+
+	gba.reset();
+	cpu.setExecutionMode(mode);
+	cpu.r[0] = DATA_ADDRESS + 0x100;
+	cpu.r[1] = DATA_ADDRESS;
+	cpu.r[15] = CODE_ADDRESS;
+	cpu.setThumb(loop.thumb);
+
+	// Cycles of one iteration, to count the instructions of a run
+	const unsigned long long start = cpu.getCycles();
+	for (unsigned int i = 0; i < count; i++)
+		cpu.stepInstruction();
+	return (double)count / (cpu.getCycles() - start);
+}
+
+// Host nanoseconds per guest instruction of a loop
+double Benchmark::runLoop(GBA& gba, const Loop& loop, const ExecutionMode mode)
+{
+	ARM7TDMI& cpu = gba.getProcessor();
+	const double rate = startLoop(gba, loop, mode);
+
+	gba.run(LOOP_CYCLES); // Compiles the loop
+	unsigned long long cycles = 0;
+	const double seconds = best([&] {
+		const unsigned long long before = cpu.getCycles();
+		gba.run(LOOP_CYCLES);
+		cycles = cpu.getCycles() - before;
+	});
+	cpu.setExecutionMode(ExecutionMode::INTERPRETER);
+	return seconds * 1e9 / (cycles * rate);
+}
+
+// Host milliseconds per frame of guest code (its body is written once)
+double Benchmark::runFrames(GBA& gba, const Loop& code, const unsigned int frames)
+{
+	ARM7TDMI& cpu = gba.getProcessor();
+	for (unsigned int i = 0; i < code.body.size(); i++)
+	{
+		if (code.thumb) cpu.write16(CODE_ADDRESS + (i << 1), code.body[i]);
+		else cpu.write32(CODE_ADDRESS + (i << 2), code.body[i]);
+	}
+
+	gba.reset();
+	cpu.r[1] = 0x4000006; // VCOUNT
+	cpu.r[2] = 0x4000301; // HALTCNT
+	cpu.r[15] = CODE_ADDRESS;
+	cpu.setThumb(code.thumb);
+	return best([&] { for (unsigned int i = 0; i < frames; i++) gba.runFrame(); }) * 1e3 / frames;
+}
+
+// ARM and THUMB opcodes through the linear scan of their instruction set and through their decode table
+void Benchmark::decoding(const std::vector<unsigned int>& code, std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	const ARM7TDMI& cpu = gba->getProcessor();
+	const InstructionSet& arm = *cpu.instructions;
+	const InstructionSet& thumb = *cpu.thumb_instructions;
+
+	// Every word is also decoded as two THUMB opcodes
+	std::vector<unsigned int> ops(DECODE_COUNT);
+	for (unsigned int i = 0; i < DECODE_COUNT; i++) ops[i] = code[i % code.size()];
+
+	// Instructions compared to find each opcode (the scan stops at the first match)
+	const auto scanned = [](const InstructionSet& set, const unsigned int op) {
+		const Instruction* in = set.getInstruction(op);
+		return in ? (unsigned int)(in - set.getInstructionById(0)) + 1 : set.size();
+	};
+	double arm_scanned = 0, arm_compared = 0, thumb_scanned = 0, thumb_compared = 0;
+	for (const unsigned int op : code)
+	{
+		arm_scanned += scanned(arm, op);
+		arm_compared += ARM7TDMI::armDecodeCompares(op);
+		for (const unsigned int half : { op & 0xFFFF, op >> 16 })
+		{
+			thumb_scanned += scanned(thumb, half);
+			thumb_compared += ARM7TDMI::thumbDecodeCompares(half);
+		}
+	}
+
+	unsigned int sum = 0;
+	const double arm_scan = best([&] { for (const unsigned int op : ops) sum += arm.getInstruction(op) != nullptr; }, 3);
+	const double arm_lookup = best([&] { for (const unsigned int op : ops) sum += ARM7TDMI::decodeARM(op).instr != nullptr; });
+	const double thumb_scan = best([&] { for (const unsigned int op : ops) sum += thumb.getInstruction(op & 0xFFFF) != nullptr; }, 3);
+	const double thumb_lookup = best([&] { for (const unsigned int op : ops) sum += ARM7TDMI::decodeTHUMB(op & 0xFFFF).instr != nullptr; });
+	sink = sum;
+
+	out << "\nDECODING (" << (code.size() << 2) / 1024 << " KB of cartridge code from the entry point)\n";
+	row(out, "") << std::setw(10) << "ns" << std::setw(10) << "compares" << "\n";
+	row(out, "ARM linear scan") << std::setw(10) << arm_scan * 1e9 / DECODE_COUNT << std::setw(10) << arm_scanned / code.size() << "\n";
+	row(out, "ARM decode table") << std::setw(10) << arm_lookup * 1e9 / DECODE_COUNT << std::setw(10) << arm_compared / code.size() << "\n";
+	row(out, "THUMB linear scan") << std::setw(10) << thumb_scan * 1e9 / DECODE_COUNT << std::setw(10) << thumb_scanned / (code.size() << 1) << "\n";
+	row(out, "THUMB decode table") << std::setw(10) << thumb_lookup * 1e9 / DECODE_COUNT << std::setw(10) << thumb_compared / (code.size() << 1) << "\n";
+}
+
+// Every instruction class in a loop, interpreted and compiled
+void Benchmark::instructions(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+#ifdef ARC_X64
+	const bool compiled = true;
+#else
+	const bool compiled = false;
+#endif
+
+	out << "\nINSTRUCTIONS (ns per guest instruction)\n";
+	row(out, "") << std::setw(10) << "interp" << (compiled ? "  compiled" : "") << "\n";
+	const auto print = [&](const char* set, const Loop& loop) {
+		row(out, std::string(set) + " " + loop.name) << std::setw(10) << runLoop(*gba, loop, ExecutionMode::INTERPRETER);
+		if (compiled) out << std::setw(10) << runLoop(*gba, loop, ExecutionMode::RECOMPILER);
+		out << "\n";
+	};
+	for (const auto& [name, body] : THUMB_LOOPS) print("THUMB", { name, true, body });
+	for (const auto& [name, body] : ARM_LOOPS) print("ARM", { name, false, body });
+}
+
+// CPSR flag writes of the flag-setting instructions, against the writes left after lazy evaluation
+void Benchmark::flags(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	ARM7TDMI& cpu = gba->getProcessor();
+
+	out << "\nFLAGS (CPSR writes per 100 guest instructions, interpreted)\n";
+	row(out, "") << std::setw(10) << "eager" << std::setw(10) << "lazy" << "\n";
+	const auto print = [&](const std::string& name, const double instructions, const unsigned long long writes, const unsigned long long resolves) {
+		row(out, name) << std::setw(10) << writes * 100 / instructions << std::setw(10) << resolves * 100 / instructions << "\n";
+	};
+
+	double total = 0;
+	unsigned long long total_writes = 0, total_resolves = 0;
+	for (const auto& [name, body] : THUMB_LOOPS)
+	{
+		const double rate = startLoop(*gba, { name, true, body }, ExecutionMode::INTERPRETER);
+		const unsigned long long start = cpu.getCycles(), writes = cpu.flag_writes, resolves = cpu.flag_resolves;
+		gba->run(LOOP_CYCLES);
+
+		const double instructions = (cpu.getCycles() - start) * rate;
+		total += instructions;
+		total_writes += cpu.flag_writes - writes;
+		total_resolves += cpu.flag_resolves - resolves;
+		print(std::string("THUMB ") + name, instructions, cpu.flag_writes - writes, cpu.flag_resolves - resolves);
+	}
+	print("every THUMB loop", total, total_writes, total_resolves);
+}
+
+// Script lines compiled once and executed many times
+void Benchmark::script(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	ARM7TDMI& cpu = gba->getProcessor();
+
+	std::istringstream source("MOV r1, #0x2000000\nADD r0, r0, #1\nSTR r0, [r1, #8]\nLDR r2, [r1, #8]\nEOR r3, r0, r2\nCMP r3, r0\n");
+	std::vector<ScriptOp> ops;
+	cpu.compileScript(source, ops);
+
+	constexpr unsigned int RUNS = 1 << 18;
+	const double seconds = best([&] { for (unsigned int i = 0; i < RUNS; i++) cpu.runScript(ops); });
+
+	out << "\nSCRIPT (ns per line)\n";
+	row(out, "MOV/ADD/STR/LDR/EOR/CMP") << std::setw(10) << seconds * 1e9 / (RUNS * ops.size()) << "\n";
+	sink = cpu.r[0];
+}
+
+// IRQs taken by a THUMB loop, from the request to the first instruction of the handler
+void Benchmark::interrupts(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	ARM7TDMI& cpu = gba->getProcessor();
+
+	// B . (THUMB) is interrupted, the handler (ARM) returns to the boot ROM with BX LR
+	constexpr unsigned int HANDLER = CODE_ADDRESS + 0x100;
+	cpu.write16(CODE_ADDRESS, 0xE7FE);
+	cpu.write32(HANDLER, 0xE12FFF1E);
+	cpu.write32(0x3007FFC, HANDLER);
+
+	gba->reset();
+	cpu.r[15] = CODE_ADDRESS;
+	cpu.setThumb(true);
+	cpu.addBreakpoint(CODE_ADDRESS);
+	cpu.addBreakpoint(HANDLER);
+	gba->reg16(REG_IE) = IRQ_VBLANK;
+	gba->reg16(REG_IME) = 1;
+
+	// The IRQ is requested like a device event does, the handler is reached through the boot ROM
+	constexpr unsigned int IRQS = 10000;
+	double entry = 1e30;
+	const double round_trip = best([&] {
+		std::chrono::steady_clock::duration taken = {};
+		for (unsigned int i = 0; i < IRQS; i++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			gba->requestInterrupt(IRQ_VBLANK);
+			gba->checkInterrupts();
+			gba->run(CYCLES_PER_FRAME);
+			taken += std::chrono::steady_clock::now() - start;
+
+			gba->reg16(REG_IF) = 0;
+			gba->run(CYCLES_PER_FRAME);
+		}
+		entry = std::min(entry, std::chrono::duration<double>(taken).count());
+	});
+	sink = cpu.r[15];
+
+	out << "\nINTERRUPTS (ns per IRQ)\n";
+	row(out, "request to handler") << std::setw(10) << entry * 1e9 / IRQS << "\n";
+	row(out, "request to return") << std::setw(10) << round_trip * 1e9 / IRQS << "\n";
+}
+
+// Bus accesses of the GBA map
+void Benchmark::memory(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	MemoryMap& map = gba->getMemoryMap();
+
+	// Random bytes of the ROM, EWRAM and IO pages
+	static constexpr unsigned int REGIONS[][2] = { { 0x8000000, 0x100000 }, { 0x2000000, 0x40000 }, { 0x4000000, 0x400 } };
+	std::mt19937 random(1);
+	std::vector<unsigned int> addresses(ACCESS_COUNT);
+	for (unsigned int& address : addresses)
+	{
+		const unsigned int* region = REGIONS[random() % 3];
+		address = region[0] + random() % region[1];
+	}
+
+	// Consecutive accesses wrap around the start of the region
+	unsigned int sum = 0;
+	const auto time = [&](const auto& access) {
+		return best([&] { for (unsigned int i = 0; i < ACCESS_COUNT; i++) access(i); }) * 1e9 / ACCESS_COUNT;
+	};
+
+	out << "\nMEMORY (ns per access)\n";
+	row(out, "random ROM/EWRAM/IO bytes") << std::setw(10) << time([&](const unsigned int i) { sum += map.read8(addresses[i]); }) << "\n";
+	row(out, "sequential ROM read32") << std::setw(10) << time([&](const unsigned int i) { sum += map.read32(0x8000000 + ((i << 2) & 0xFFFFF)); }) << "\n";
+	row(out, "sequential EWRAM read32") << std::setw(10) << time([&](const unsigned int i) { sum += map.read32(0x2000000 + ((i << 2) & 0x3FFFF)); }) << "\n";
+	row(out, "sequential EWRAM write32") << std::setw(10) << time([&](const unsigned int i) { map.write32(0x2000000 + ((i << 2) & 0x3FFFF), i); }) << "\n";
+	row(out, "sequential IO read16") << std::setw(10) << time([&](const unsigned int i) { sum += map.read16(0x4000000 + ((i << 1) & 0xFF)); }) << "\n";
+	// The BG offsets are write-only and have no side effects
+	row(out, "IO write16 (BG offsets)") << std::setw(10) << time([&](const unsigned int i) { map.write16(0x4000010 + ((i << 1) & 0xF), i); }) << "\n";
+	row(out, "IO write32 (BG offsets)") << std::setw(10) << time([&](const unsigned int i) { map.write32(0x4000010 + ((i << 2) & 0xF), i); }) << "\n";
+	sink = sum;
+}
+
+// Save states and the rewind buffer
+void Benchmark::states(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	ARM7TDMI& cpu = gba->getProcessor();
+	gba->reset();
+
+	// A restore after two pages were written
+	const std::shared_ptr<const GBA::SaveState> boot = gba->saveState();
+	constexpr unsigned int RESTORES = 1000;
+	const double restore = best([&] {
+		for (unsigned int i = 0; i < RESTORES; i++)
+		{
+			cpu.write32(0x2000000, i);
+			cpu.write32(0x3000000, i);
+			gba->loadState(*boot);
+		}
+	});
+
+	// Every frame writes a few pages, every captured frame is a keyframe in the second buffer
+	constexpr unsigned int FRAMES = 120;
+	RewindBuffer deltas(256 << 20, FRAMES + 1), keyframes(256 << 20, 1), history(256 << 20);
+	const auto capture = [&](RewindBuffer& buffer) {
+		return best([&] {
+			buffer.clear();
+			for (unsigned int i = 0; i < FRAMES; i++)
+			{
+				for (unsigned int page = 0; page < 4; page++)
+					cpu.write32(0x2000000 + (page << 12) + (i << 2), i);
+				buffer.capture(*gba);
+			}
+		}, 3) * 1e6 / FRAMES;
+	};
+	const double delta = capture(deltas);
+	const double keyframe = capture(keyframes);
+	capture(history);
+	const double seek = best([&] { for (unsigned int i = 0; i < FRAMES; i++) history.seek(*gba, (i * 37) % FRAMES); }, 3) * 1e6 / FRAMES;
+
+	out << "\nSTATES (us)\n";
+	row(out, "restore after writing 2 pages") << std::setw(10) << restore * 1e6 / RESTORES << "\n";
+	row(out, "rewind capture (delta)") << std::setw(10) << delta << "\n";
+	row(out, "rewind capture (keyframe)") << std::setw(10) << keyframe << "\n";
+	row(out, "rewind seek (keyframe every 60)") << std::setw(10) << seek << "\n";
+}
+
+// Frames of a machine waiting in a polling loop or halted
+void Benchmark::idle(std::ostream& out)
+{
+	std::unique_ptr<GBA> gba = createMachine();
+	constexpr unsigned int FRAMES = 60;
+
+	// LDRH R0, [R1]; CMP R0, #160; BNE back to the LDRH; B back to the LDRH
+	const double thumb = runFrames(*gba, { "", true, { 0x8808, 0x28A0, 0xD1FC, 0xE7FB } }, FRAMES);
+	const double arm = runFrames(*gba, { "", false, { 0xE1D100B0, 0xE35000A0, 0x1AFFFFFC, 0xEAFFFFFB } }, FRAMES);
+	// STRB R0, [R2]; B -4 (no interrupt is enabled, the processor halts until the end of the frame)
+	const double halted = runFrames(*gba, { "", true, { 0x7010, 0xE7FD } }, FRAMES);
+
+	out << "\nIDLE (ms per frame)\n";
+	row(out, "THUMB VCOUNT polling loop") << std::setw(10) << thumb << "\n";
+	row(out, "ARM VCOUNT polling loop") << std::setw(10) << arm << "\n";
+	row(out, "HALTCNT halt") << std::setw(10) << halted << "\n";
+}
+
+// Construction of a machine and loading of a cartridge
+void Benchmark::startup(const char* rom, std::ostream& out)
+{
+	const double construct = best([] { std::unique_ptr<GBA> gba = createMachine(); });
+
+	out << "\nSTARTUP (ms)\n";
+	row(out, "machine") << std::setw(10) << construct * 1e3 << "\n";
+	if (!rom) return;
+
+	const double load = best([&] {
+		std::unique_ptr<GBA> gba = createMachine();
+		QuietOutput quiet;
+		gba->loadROM(rom);
+	});
+	row(out, "machine and cartridge") << std::setw(10) << load * 1e3 << "\n";
+}
+
+void Benchmark::run(const char* rom, std::ostream& out)
+{
+	out << std::fixed << std::setprecision(2);
+
+	const std::vector<unsigned int> code = rom ? readCode(rom) : std::vector<unsigned int>();
+	if (code.empty()) out << "\nDECODING skipped (no cartridge code)\n";
+	else decoding(code, out);
+	instructions(out);
+	flags(out);
+	script(out);
+	interrupts(out);
+	memory(out);
+	states(out);
+	idle(out);
+	startup(rom, out);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "GBA.h"
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Microbenchmarks of the hot paths of the emulator (ArchBuilder -bench [rom]).
+ * Decoding is measured on the code of a cartridge, read from its entry point.
+ * Guest code is written to the work RAM of a machine, so it needs no cartridge.
+ * Every figure is the best of several runs, in host time.
+*/
+class Benchmark
+{
+private:
+	// Guest loop: the body is repeated, then a counter is incremented and the loop branches back
+	struct Loop
+	{
+		const char* name;
+		bool thumb;
+		std::vector<unsigned int> body;	// Opcodes of one repetition
+	};
+
+	static double best(const std::function<void()>& run, const unsigned int runs = 5);
+	static std::vector<unsigned int> readCode(const char* rom);
+	static double startLoop(GBA& gba, const Loop& loop, const ExecutionMode mode);
+	static double runLoop(GBA& gba, const Loop& loop, const ExecutionMode mode);
+	static double runFrames(GBA& gba, const Loop& code, const unsigned int frames);
+
+	static void decoding(const std::vector<unsigned int>& code, std::ostream& out);
+	static void instructions(std::ostream& out);
+	static void flags(std::ostream& out);
+	static void script(std::ostream& out);
+	static void interrupts(std::ostream& out);
+	static void memory(std::ostream& out);
+	static void states(std::ostream& out);
+	static void idle(std::ostream& out);
+	static void startup(const char* rom, std::ostream& out);
+
+public:
+	/**
+	 * @brief Runs every benchmark and prints the results
+	 * @param rom - cartridge whose code is decoded and that is loaded (nullptr to skip these benchmarks)
+	*/
+	static void run(const char* rom, std::ostream& out);
+};
+
+#endif
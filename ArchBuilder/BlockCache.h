@@ -0,0 +1,134 @@
+#pragma once
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "MemoryMap.h"
+#include <unordered_map>
+#include <algorithm>
+
+/**
+ * @brief Instruction that was decoded ahead of execution
+ * @tparam Handler - handler type of the processor
+*/
+template <typename Handler>
+struct DecodedOp
+{
+	Handler handler;		// Resolved handler
+	unsigned int op;		// Opcode (operand fields are read from it by the handler)
+	unsigned char cond;		// Condition field
+	unsigned char cycles;	// Cycle cost when executed
+};
+
+/**
+ * @brief Sequence of decoded instructions that ends at a branch
+ * @tparam Handler - handler type of the processor
+*/
+template <typename Handler>
+struct CodeBlock
+{
+	unsigned int address;	// Address of the first instruction
+	unsigned int size;		// Number of bytes covered by the block
+	unsigned int executions;	// Number of times the block was executed
+	void* native;			// Compiled host code (nullptr if not compiled)
+	bool idle;				// Loops on itself and every iteration only depends on memory (no stores or carried registers)
+	std::vector<DecodedOp<Handler>> ops;
+
+	CodeBlock(const unsigned int add) : address(add), size(0), executions(0), native(nullptr), idle(false) {}
+};
+
+/**
+ * @brief Cache of decoded blocks keyed by address and processor state.
+ * Blocks are invalidated when the memory pages they were decoded from are written.
+ * @tparam Handler - handler type of the processor
+*/
+template <typename Handler>
+class BlockCache : public PageWatcher
+{
+private:
+	std::unordered_map<unsigned int, CodeBlock<Handler>*> blocks;
+	std::unordered_map<unsigned int, std::vector<unsigned int>> pages; // Keys of the blocks decoded from each page
+	std::vector<CodeBlock<Handler>*> retired; // Invalidated blocks that may still be executing
+	MemoryMap* mem_map;
+
+public:
+	bool invalidated; // Set when a block is invalidated
+
+	BlockCache() : mem_map(nullptr), invalidated(false) {}
+	~BlockCache() { clear(); release(); }
+
+	void attach(MemoryMap* map)
+	{
+		clear();
+		mem_map = map;
+		mem_map->setWatcher(this);
+	}
+
+	inline CodeBlock<Handler>* find(const unsigned int key) const
+	{
+		auto it = blocks.find(key);
+		return it != blocks.end() ? it->second : nullptr;
+	}
+
+	void insert(const unsigned int key, CodeBlock<Handler>* block)
+	{
+		blocks[key] = block;
+
+		const unsigned int first = mem_map->getPage(block->address);
+		const unsigned int last = mem_map->getPage(block->address + block->size - 1);
+		for (unsigned int page = first; page <= last; page++)
+		{
+			// Blocks decoded through a mirror watch the page it repeats, which receives its writes
+			const unsigned int source = mem_map->getSourcePage(page);
+			std::vector<unsigned int>& keys = pages[source];
+			if (std::find(keys.begin(), keys.end(), key) == keys.end())
+				keys.push_back(key);
+			mem_map->watchPage(source, true);
+		}
+	}
+
+	// Removes every block decoded from the page
+	void pageWritten(const unsigned int page) override
+	{
+		auto it = pages.find(page);
+		if (it == pages.end()) return;
+
+		for (const unsigned int key : it->second)
+		{
+			auto block = blocks.find(key);
+			if (block != blocks.end())
+			{
+				retired.push_back(block->second);
+				blocks.erase(block);
+			}
+		}
+
+		pages.erase(it);
+		mem_map->watchPage(page, false);
+		invalidated = true;
+	}
+
+	void clear()
+	{
+		for (auto& block : blocks)
+			retired.push_back(block.second);
+		blocks.clear();
+
+		for (auto& page : pages)
+			mem_map->watchPage(page.first, false);
+		pages.clear();
+		invalidated = true;
+	}
+
+	// Frees invalidated blocks (must not be called while a block is executing)
+	void release()
+	{
+		while (!retired.empty())
+		{
+			delete retired.back();
+			retired.pop_back();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,622 @@
+#include "Disassembler.h"
+#include "ARM7.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+constexpr unsigned int MNEMONIC_COLUMN = 18;
+constexpr unsigned int OPERAND_COLUMN = 27;
+
+static const char* const CONDITIONS[16] = { "EQ", "NE", "CS", "CC", "MI", "PL", "VS", "VC", "HI", "LS", "GE", "LT", "GT", "LE", "", "NV" };
+static const char* const REGISTERS[16] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9", "R10", "R11", "R12", "SP", "LR", "PC" };
+static const char* const SHIFTS[4] = { "LSL", "LSR", "ASR", "ROR" };
+static const char* const HEX_DIGITS = "0123456789ABCDEF";
+
+// Writes into a fixed width line, text past the end of the line is cut
+struct LineWriter
+{
+	char* const start;
+	char* p;
+	char* const end;
+
+	LineWriter(char* line) : start(line), p(line), end(line + DISASSEMBLY_LINE_WIDTH - 1) {}
+
+	inline void put(const char c) { if (p < end) *p++ = c; }
+	inline void put(const char* s) { while (*s) put(*s++); }
+
+	void hex(const unsigned int value, const unsigned int digits)
+	{
+		for (int i = digits - 1; i >= 0; i--)
+			put(HEX_DIGITS[(value >> (i << 2)) & 0xF]);
+	}
+
+	// Hexadecimal without leading zeros
+	void number(const unsigned int value)
+	{
+		unsigned int digits = 1;
+		while (digits < 8 && (value >> (digits << 2))) digits++;
+		put("0x");
+		hex(value, digits);
+	}
+
+	void decimal(const unsigned int value)
+	{
+		if (value >= 10) decimal(value / 10);
+		put((char)('0' + value % 10));
+	}
+
+	void imm(const unsigned int value) { put('#'); number(value); }
+
+	void signedImm(const unsigned int value, const bool up)
+	{
+		put(up ? "#" : "#-");
+		number(value);
+	}
+
+	void reg(const unsigned int n) { put(REGISTERS[n & 0xF]); }
+	void separator() { put(", "); }
+
+	// Continues at a column (at least one space after the previous text)
+	void column(const unsigned int c)
+	{
+		do put(' '); while (p < start + c);
+	}
+
+	void mnemonic(const char* name, const unsigned int cond = 0xE, const char* suffix = "")
+	{
+		column(MNEMONIC_COLUMN);
+		put(name);
+		put(CONDITIONS[cond]);
+		put(suffix);
+		column(OPERAND_COLUMN);
+	}
+
+	// Transfers put the condition between the operation and its size (LDREQB, SWPNEB)
+	void transferMnemonic(const char* name, const unsigned int cond, const char* suffix = "")
+	{
+		column(MNEMONIC_COLUMN);
+		put(name[0]);
+		put(name[1]);
+		put(name[2]);
+		put(CONDITIONS[cond]);
+		put(name + 3);
+		put(suffix);
+		column(OPERAND_COLUMN);
+	}
+
+	void registerList(const unsigned int list)
+	{
+		put('{');
+		bool first = true;
+		for (unsigned int i = 0; i < 16; i++)
+		{
+			if (!(list & (1 << i))) continue;
+
+			// Ranges of 3 or more registers are shortened
+			unsigned int last = i;
+			while (last < 15 && (list & (1 << (last + 1)))) last++;
+
+			if (!first) put(", ");
+			reg(i);
+			if (last >= i + 2)
+			{
+				put('-');
+				reg(last);
+				i = last;
+			}
+			first = false;
+		}
+		put('}');
+	}
+
+	void finish()
+	{
+		while (p < end) *p++ = ' ';
+		*p = '\n';
+	}
+};
+
+static inline unsigned int rotateRight(const unsigned int value, const unsigned int amount)
+{
+	return (value >> (amount & 31)) | (value << ((32 - amount) & 31));
+}
+
+// Rm, <shift> #n / Rm, <shift> Rs
+static void armShiftedRegister(LineWriter& w, const unsigned int op)
+{
+	const unsigned int type = (op >> 5) & 0x3;
+	w.reg(op & 0xF);
+
+	if (op & 0x10)
+	{
+		w.separator();
+		w.put(SHIFTS[type]);
+		w.put(' ');
+		w.reg(op >> 8);
+		return;
+	}
+
+	const unsigned int amount = (op >> 7) & 0x1F;
+	if (amount == 0 && type == 0) return;
+
+	w.separator();
+	if (amount == 0 && type == 3)
+	{
+		w.put("RRX");
+		return;
+	}
+
+	w.put(SHIFTS[type]);
+	w.put(" #");
+	w.decimal(amount ? amount : 32);
+}
+
+static void armDataProcessing(LineWriter& w, const unsigned int op, const InstructionSpec<ARMHandler>* in)
+{
+	const bool compare = in->id == TST || in->id == TEQ || in->id == CMP || in->id == CMN;
+	w.mnemonic(in->mnemonic, op >> 28, (op & 0x00100000) && !compare ? "S" : "");
+
+	if (!compare)
+	{
+		w.reg(op >> 12);
+		w.separator();
+	}
+	if (in->id != MOV && in->id != MVN)
+	{
+		w.reg(op >> 16);
+		w.separator();
+	}
+
+	if (op & 0x02000000)
+		w.imm(rotateRight(op & 0xFF, (op >> 7) & 0x1E));
+	else
+		armShiftedRegister(w, op);
+}
+
+// [Rn, offset]{!} or [Rn], offset
+static void armAddress(LineWriter& w, const unsigned int op, const bool immediate, const unsigned int offset)
+{
+	const bool pre = op & 0x01000000;
+	const bool up = op & 0x00800000;
+
+	w.put('[');
+	w.reg(op >> 16);
+	if (!pre) w.put(']');
+
+	if (!immediate || offset != 0)
+	{
+		w.separator();
+		if (immediate)
+			w.signedImm(offset, up);
+		else
+		{
+			if (!up) w.put('-');
+			armShiftedRegister(w, op & ~0x10);
+		}
+	}
+
+	if (pre)
+	{
+		w.put(']');
+		if (op & 0x00200000) w.put('!');
+	}
+}
+
+// Instructions are identified by the decode tables of the processor, only their operands are formatted here
+void Disassembler::formatARM(char* line, const unsigned int address, const unsigned int op)
+{
+	LineWriter w(line);
+	const unsigned int cond = op >> 28;
+
+	w.hex(address, 8);
+	w.put(' ');
+	w.hex(op, 8);
+
+	const InstructionSpec<ARMHandler>* in = ARM7TDMI::decodeARM(op).instr;
+	if (!in)
+	{
+		// Coprocessor instructions are not part of the instruction set
+		if ((op & 0x0C000000) == 0x0C000000)
+			w.mnemonic(op & 0x02000000 ? (op & 0x10 ? (op & 0x00100000 ? "MRC" : "MCR") : "CDP") : (op & 0x00100000 ? "LDC" : "STC"), cond);
+		else
+			w.mnemonic("UND", cond);
+		w.finish();
+		return;
+	}
+
+	switch (in->id)
+	{
+	case BX:
+	case BLX:
+		w.mnemonic(in->mnemonic, cond);
+		w.reg(op);
+		break;
+
+	case B:
+	case BL:
+		w.mnemonic(in->mnemonic, cond);
+		w.number(address + 8 + ((int)(op << 8) >> 6));
+		break;
+
+	case SWI:
+		w.mnemonic(in->mnemonic, cond);
+		w.imm(op & 0x00FFFFFF);
+		break;
+
+	case MUL:
+	case MLA:
+		w.mnemonic(in->mnemonic, cond, op & 0x00100000 ? "S" : "");
+		w.reg(op >> 16);
+		w.separator();
+		w.reg(op);
+		w.separator();
+		w.reg(op >> 8);
+		if (in->id == MLA)
+		{
+			w.separator();
+			w.reg(op >> 12);
+		}
+		break;
+
+	case UMULL:
+	case UMLAL:
+	case SMULL:
+	case SMLAL:
+		w.mnemonic(in->mnemonic, cond, op & 0x00100000 ? "S" : "");
+		w.reg(op >> 12);
+		w.separator();
+		w.reg(op >> 16);
+		w.separator();
+		w.reg(op);
+		w.separator();
+		w.reg(op >> 8);
+		break;
+
+	case SWP:
+	case SWPB:
+		w.transferMnemonic(in->mnemonic, cond);
+		w.reg(op >> 12);
+		w.separator();
+		w.reg(op);
+		w.put(", [");
+		w.reg(op >> 16);
+		w.put(']');
+		break;
+
+	case LDRH:
+	case STRH:
+	case LDRSB:
+	case LDRSH:
+	{
+		w.transferMnemonic(in->mnemonic, cond);
+		w.reg(op >> 12);
+		w.separator();
+
+		const bool immediate = op & 0x00400000;
+		armAddress(w, immediate ? op : op & ~0xFF0, immediate, ((op >> 4) & 0xF0) | (op & 0xF));
+		break;
+	}
+
+	case MRS:
+		w.mnemonic(in->mnemonic, cond);
+		w.reg(op >> 12);
+		w.put(op & 0x00400000 ? ", SPSR" : ", CPSR");
+		break;
+
+	case MSR:
+		w.mnemonic(in->mnemonic, cond);
+		w.put(op & 0x00400000 ? "SPSR_" : "CPSR_");
+		if (op & 0x00080000) w.put('f');
+		if (op & 0x00040000) w.put('s');
+		if (op & 0x00020000) w.put('x');
+		if (op & 0x00010000) w.put('c');
+		w.separator();
+
+		if (op & 0x02000000)
+			w.imm(rotateRight(op & 0xFF, (op >> 7) & 0x1E));
+		else
+			w.reg(op);
+		break;
+
+	case AND: case EOR: case SUB: case RSB: case ADD: case ADC: case SBC: case RSC:
+	case TST: case TEQ: case CMP: case CMN: case ORR: case MOV: case BIC: case MVN:
+		armDataProcessing(w, op, in);
+		break;
+
+	case LDR:
+	case STR:
+	case LDRB:
+	case STRB:
+	{
+		w.transferMnemonic(in->mnemonic, cond, (op & 0x01200000) == 0x00200000 ? "T" : "");
+		w.reg(op >> 12);
+		w.separator();
+
+		// PC relative loads show the address
+		const bool immediate = !(op & 0x02000000);
+		if (immediate && ((op >> 16) & 0xF) == 15 && (op & 0x01200000) == 0x01000000)
+			w.number(address + 8 + (op & 0x00800000 ? op & 0xFFF : 0 - (op & 0xFFF)));
+		else
+			armAddress(w, op, immediate, op & 0xFFF);
+		break;
+	}
+
+	case LDM:
+	case STM:
+	{
+		static const char* const modes[4] = { "DA", "IA", "DB", "IB" };
+		const unsigned int rn = (op >> 16) & 0xF;
+		const bool load = in->id == LDM;
+
+		// Stack operations use the push/pop names
+		if (rn == 13 && (op & 0x00200000) && ((op >> 23) & 3) == (load ? 1 : 2))
+		{
+			w.mnemonic(load ? "POP" : "PUSH", cond);
+		}
+		else
+		{
+			w.mnemonic(in->mnemonic, cond, modes[(op >> 23) & 0x3]);
+			w.reg(rn);
+			if (op & 0x00200000) w.put('!');
+			w.separator();
+		}
+
+		w.registerList(op & 0xFFFF);
+		if (op & 0x00400000) w.put('^');
+		break;
+	}
+
+	default: // UND
+		w.mnemonic(in->mnemonic, cond);
+		break;
+	}
+
+	w.finish();
+}
+
+void Disassembler::formatTHUMB(char* line, const unsigned int address, const unsigned int op, const unsigned int next)
+{
+	LineWriter w(line);
+	const unsigned int rd = op & 0x7;
+	const unsigned int rs = (op >> 3) & 0x7;
+
+	w.hex(address, 8);
+	w.put(' ');
+	w.hex(op, 4);
+
+	const InstructionSpec<ARMHandler>* in = ARM7TDMI::decodeTHUMB(op).instr;
+	if (!in)
+	{
+		w.mnemonic("UND");
+		w.finish();
+		return;
+	}
+
+	switch (in->id)
+	{
+	case T_LSL_IMM:
+	case T_LSR_IMM:
+	case T_ASR_IMM:
+	{
+		const unsigned int amount = (op >> 6) & 0x1F;
+		w.mnemonic(in->mnemonic);
+		w.reg(rd);
+		w.separator();
+		w.reg(rs);
+		w.put(", #");
+		w.decimal(amount == 0 && in->id != T_LSL_IMM ? 32 : amount);
+		break;
+	}
+
+	case T_ADD_REG:
+	case T_SUB_REG:
+	case T_ADD_IMM3:
+	case T_SUB_IMM3:
+		w.mnemonic(in->mnemonic);
+		w.reg(rd);
+		w.separator();
+		w.reg(rs);
+		w.separator();
+		if (in->id == T_ADD_IMM3 || in->id == T_SUB_IMM3)
+			w.imm((op >> 6) & 0x7);
+		else
+			w.reg((op >> 6) & 0x7);
+		break;
+
+	case T_MOV_IMM:
+	case T_CMP_IMM:
+	case T_ADD_IMM:
+	case T_SUB_IMM:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 8) & 0x7);
+		w.separator();
+		w.imm(op & 0xFF);
+		break;
+
+	case T_AND: case T_EOR: case T_LSL: case T_LSR: case T_ASR: case T_ADC: case T_SBC: case T_ROR:
+	case T_TST: case T_NEG: case T_CMP: case T_CMN: case T_ORR: case T_MUL: case T_BIC: case T_MVN:
+		w.mnemonic(in->mnemonic);
+		w.reg(rd);
+		w.separator();
+		w.reg(rs);
+		break;
+
+	case T_ADD_HI:
+	case T_CMP_HI:
+	case T_MOV_HI:
+		w.mnemonic(in->mnemonic);
+		w.reg(rd | ((op >> 4) & 0x8));
+		w.separator();
+		w.reg((op >> 3) & 0xF);
+		break;
+
+	case T_BX:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 3) & 0xF);
+		break;
+
+	case T_LDR_PC:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 8) & 0x7);
+		w.separator();
+		w.number(((address + 4) & ~2) + ((op & 0xFF) << 2));
+		break;
+
+	case T_STR_REG: case T_STRB_REG: case T_LDR_REG: case T_LDRB_REG:
+	case T_STRH_REG: case T_LDSB_REG: case T_LDRH_REG: case T_LDSH_REG:
+		w.mnemonic(in->mnemonic);
+		w.reg(rd);
+		w.put(", [");
+		w.reg(rs);
+		w.separator();
+		w.reg((op >> 6) & 0x7);
+		w.put(']');
+		break;
+
+	case T_STR_IMM:
+	case T_LDR_IMM:
+	case T_STRB_IMM:
+	case T_LDRB_IMM:
+	case T_STRH_IMM:
+	case T_LDRH_IMM:
+	{
+		// Offsets are scaled by the transfer size
+		const unsigned int shift = in->id == T_STRB_IMM || in->id == T_LDRB_IMM ? 0 : (in->id == T_STRH_IMM || in->id == T_LDRH_IMM ? 1 : 2);
+		w.mnemonic(in->mnemonic);
+		w.reg(rd);
+		w.put(", [");
+		w.reg(rs);
+		w.separator();
+		w.imm(((op >> 6) & 0x1F) << shift);
+		w.put(']');
+		break;
+	}
+
+	case T_STR_SP:
+	case T_LDR_SP:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 8) & 0x7);
+		w.put(", [SP, ");
+		w.imm((op & 0xFF) << 2);
+		w.put(']');
+		break;
+
+	case T_ADD_PC:
+	case T_ADD_SP:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 8) & 0x7);
+		w.put(in->id == T_ADD_SP ? ", SP, " : ", PC, ");
+		w.imm((op & 0xFF) << 2);
+		break;
+
+	case T_ADJ_SP:
+		w.mnemonic(in->mnemonic);
+		w.put("SP, ");
+		w.signedImm((op & 0x7F) << 2, !(op & 0x80));
+		break;
+
+	case T_PUSH:
+	case T_POP:
+		w.mnemonic(in->mnemonic);
+		w.registerList((op & 0xFF) | (op & 0x0100 ? (in->id == T_POP ? 0x8000 : 0x4000) : 0));
+		break;
+
+	case T_STMIA:
+	case T_LDMIA:
+		w.mnemonic(in->mnemonic);
+		w.reg((op >> 8) & 0x7);
+		w.put("!, ");
+		w.registerList(op & 0xFF);
+		break;
+
+	case T_SWI:
+		w.mnemonic(in->mnemonic);
+		w.imm(op & 0xFF);
+		break;
+
+	case T_BCOND:
+		w.mnemonic(in->mnemonic, (op >> 8) & 0xF);
+		w.number(address + 4 + ((int)(op << 24) >> 23));
+		break;
+
+	case T_B:
+		w.mnemonic(in->mnemonic);
+		w.number(address + 4 + ((int)(op << 21) >> 20));
+		break;
+
+	case T_BL_HI:
+		w.mnemonic(in->mnemonic);
+		if ((next & 0xF800) == 0xF800) // Both halves
+			w.number(address + 4 + (((int)(op << 21) >> 9) | ((next & 0x7FF) << 1)));
+		else
+		{
+			w.put("LR = ");
+			w.number(address + 4 + ((int)(op << 21) >> 9));
+		}
+		break;
+
+	case T_BL_LO:
+		w.mnemonic(in->mnemonic);
+		w.put("LR + ");
+		w.number((op & 0x7FF) << 1);
+		break;
+
+	default: // UND
+		w.mnemonic(in->mnemonic);
+		break;
+	}
+
+	w.finish();
+}
+
+void Disassembler::disassemble(const unsigned char* data, const unsigned int size, const unsigned int address, const bool thumb,
+	std::ostream& out, unsigned int threads)
+{
+	const unsigned int width = thumb ? 2 : 4;
+	const unsigned int chunks = (size + DISASSEMBLY_CHUNK_SIZE - 1) / DISASSEMBLY_CHUNK_SIZE;
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::max(1u, std::min(threads, chunks));
+
+	std::atomic<unsigned int> next_chunk(0);	// Next chunk to disassemble
+	std::atomic<unsigned int> written(0);		// Chunks written to the output (in order)
+
+	auto worker = [&]()
+	{
+		// Every line of a chunk has the same width, so the buffer never grows
+		std::vector<char> buffer((DISASSEMBLY_CHUNK_SIZE / width) * DISASSEMBLY_LINE_WIDTH);
+
+		for (unsigned int chunk = next_chunk++; chunk < chunks; chunk = next_chunk++)
+		{
+			const unsigned int start = chunk * DISASSEMBLY_CHUNK_SIZE;
+			const unsigned int end = std::min(start + DISASSEMBLY_CHUNK_SIZE, size - size % width);
+			char* line = buffer.data();
+
+			for (unsigned int offset = start; offset < end; offset += width, line += DISASSEMBLY_LINE_WIDTH)
+			{
+				if (thumb)
+				{
+					const unsigned int next = offset + 3 < size ? data[offset + 2] | (data[offset + 3] << 8) : 0;
+					formatTHUMB(line, address + offset, data[offset] | (data[offset + 1] << 8), next);
+				}
+				else
+					formatARM(line, address + offset, data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | (data[offset + 3] << 24));
+			}
+
+			// Waits for the previous chunks to be written
+			while (written.load(std::memory_order_acquire) != chunk)
+				std::this_thread::yield();
+
+			out.write(buffer.data(), line - buffer.data());
+			written.store(chunk + 1, std::memory_order_release);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+	worker();
+
+	for (std::thread& t : pool)
+		t.join();
+}
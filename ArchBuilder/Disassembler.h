@@ -0,0 +1,49 @@
+#pragma once
+
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <ostream>
+
+constexpr unsigned int DISASSEMBLY_LINE_WIDTH = 64; // Characters per line, including the new line
+constexpr unsigned int DISASSEMBLY_CHUNK_SIZE = 0x10000; // Bytes disassembled by a thread at a time
+
+/**
+ * @brief Bulk ARM7TDMI disassembler.
+ * Every instruction becomes a line of DISASSEMBLY_LINE_WIDTH characters, so a chunk of code
+ * fits into a buffer that is allocated once per thread.
+*/
+class Disassembler
+{
+public:
+	/**
+	 * @brief Formats an ARM instruction
+	 * @param line - output of DISASSEMBLY_LINE_WIDTH characters
+	 * @param address - address of the instruction
+	 * @param op - opcode
+	*/
+	static void formatARM(char* line, const unsigned int address, const unsigned int op);
+
+	/**
+	 * @brief Formats a THUMB instruction
+	 * @param line - output of DISASSEMBLY_LINE_WIDTH characters
+	 * @param address - address of the instruction
+	 * @param op - opcode
+	 * @param next - following opcode (second half of BL)
+	*/
+	static void formatTHUMB(char* line, const unsigned int address, const unsigned int op, const unsigned int next);
+
+	/**
+	 * @brief Disassembles a buffer on all cores, the lines are written in address order
+	 * @param data - code
+	 * @param size - number of bytes
+	 * @param address - address of the first byte
+	 * @param thumb - decodes THUMB instead of ARM instructions
+	 * @param out - output text stream
+	 * @param threads - number of worker threads (0 uses every core)
+	*/
+	static void disassemble(const unsigned char* data, const unsigned int size, const unsigned int address, const bool thumb,
+		std::ostream& out, unsigned int threads = 0);
+};
+
+#endif
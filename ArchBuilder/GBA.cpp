@@ -0,0 +1,660 @@
+#include "GBA.h"
+
+// Interrupts that end the stop mode
+constexpr unsigned short STOP_IRQS = IRQ_SERIAL | IRQ_KEYPAD | IRQ_GAMEPAK;
+
+// Timer prescaler selections (1, 64, 256 and 1024 cycles)
+constexpr unsigned int PRESCALER_SHIFT[4] = { 0, 6, 8, 10 };
+
+// IRQ vector of the boot ROM, calls the handler stored at 0x3007FFC through its 0x3FFFFFC mirror
+constexpr unsigned int BIOS_IRQ_ADDRESS = 0x128;
+constexpr unsigned int BIOS_IRQ_HANDLER[] = {
+	0xE92D500F,	// STMFD SP!, {R0-R3, R12, LR}
+	0xE3A00301,	// MOV R0, #0x4000000
+	0xE28FE000,	// ADD LR, PC, #0
+	0xE510F004,	// LDR PC, [R0, #-4]
+	0xE8BD500F,	// LDMFD SP!, {R0-R3, R12, LR}
+	0xE25EF004	// SUBS PC, LR, #4
+};
+
+IORegisters::IORegisters(GBA& gba) : IOComp("IO REGISTERS", IO_START, IO_END - IO_START + 1), owner(gba), registers() {}
+
+void IORegisters::define(const char* nm, const unsigned int add, const unsigned int width, const unsigned int read_mask,
+	const unsigned int write_mask, const ReadHandler read, const WriteHandler write)
+{
+	// Byte registers use the byte lane of their address
+	const unsigned int shift = (add & 1) << 3;
+	for (unsigned int i = 0; i < width; i += 2)
+	{
+		Register& reg = registers[((add & mask) >> 1) + (i >> 1)];
+		if (!reg.name)
+		{
+			reg.name = nm;
+			reg.width = (unsigned char)width;
+		}
+		reg.read_mask |= (unsigned short)((read_mask >> (i << 3)) << shift);
+		reg.write_mask |= (unsigned short)((write_mask >> (i << 3)) << shift);
+		if (read) reg.read = read;
+		if (write) reg.write = write;
+	}
+}
+
+inline unsigned short IORegisters::readHalf(const unsigned int offset)
+{
+	const Register& reg = registers[offset >> 1];
+	const unsigned short value = reg.read ? (owner.*reg.read)(cs + offset) : *(unsigned short*)(memory + offset);
+	return value & reg.read_mask;
+}
+
+inline void IORegisters::writeHalf(const unsigned int offset, const unsigned short value, const unsigned short lanes)
+{
+	const Register& reg = registers[offset >> 1];
+	unsigned short& stored = *(unsigned short*)(memory + offset);
+	const unsigned short bits = lanes & reg.write_mask;
+
+	stored = (stored & ~bits) | (value & bits);
+	if (reg.write) (owner.*reg.write)(cs + offset, value & lanes, lanes);
+}
+
+unsigned int IORegisters::read(const unsigned int add, const unsigned int width)
+{
+	const unsigned int offset = add & mask;
+	if (width == 4) return readHalf(offset) | (readHalf(offset + 2) << 16);
+
+	const unsigned int value = readHalf(offset & ~1);
+	return width == 2 ? value : (value >> ((offset & 1) << 3)) & 0xFF;
+}
+
+// Words are written as two halfwords, the handler of the low one is called first
+void IORegisters::write(const unsigned int add, const unsigned int value, const unsigned int width)
+{
+	const unsigned int offset = add & mask;
+	if (width == 4)
+	{
+		writeHalf(offset, (unsigned short)value, 0xFFFF);
+		writeHalf(offset + 2, (unsigned short)(value >> 16), 0xFFFF);
+	}
+	else if (width == 2)
+		writeHalf(offset, (unsigned short)value, 0xFFFF);
+	else
+	{
+		const unsigned int shift = (offset & 1) << 3;
+		writeHalf(offset & ~1, (unsigned short)(value << shift), (unsigned short)(0xFF << shift));
+	}
+}
+
+GBA::GBA() : map(28), io(new IORegisters(*this)), rom(new ROM("ROM/FLASH", 0x8000000, 0x2000000)), cpu(60), scheduler(this),
+	timers(), dma(), fifo_size(), vcount(0), stopped(false)
+{
+	ROM* bios = new ROM("SYSTEM ROM", 0x0, 0x400);
+	map.addComponent(bios);
+	map.addComponent(new RAM("ONBOARD WRAM", 0x2000000, 0x40000));
+	map.addComponent(new Mirror("ONBOARD WRAM (MIR)", 0x2000000, 0x1000000, 0x2000000, 0x40000));
+	map.addComponent(new RAM("INCHIP WRAM", 0x3000000, 0x8000));
+	map.addComponent(new Mirror("INCHIP WRAM (MIR)", 0x3000000, 0x1000000, 0x3000000, 0x8000));
+	// IO registers, reads and writes are masked by register
+	map.addComponent(io);
+	// LCD Registers
+	io->define("DISPCNT", 0x4000000, 2, 0xFFFF, 0xFFF7);
+	io->define("DISPSTAT", 0x4000004, 2, 0xFF3F, 0xFF38);
+	io->define("VCOUNT", 0x4000006, 2, 0x00FF, 0x0000);
+	io->define("BG0CNT", 0x4000008, 2, 0xDFFF, 0xDFFF);
+	io->define("BG1CNT", 0x400000A, 2, 0xDFFF, 0xDFFF);
+	io->define("BG2CNT", 0x400000C, 2, 0xFFFF, 0xFFFF);
+	io->define("BG3CNT", 0x400000E, 2, 0xFFFF, 0xFFFF);
+	io->define("BG0HOFS", 0x4000010, 2, 0x0000, 0x01FF);
+	io->define("BG0VOFS", 0x4000012, 2, 0x0000, 0x01FF);
+	io->define("BG1HOFS", 0x4000014, 2, 0x0000, 0x01FF);
+	io->define("BG1VOFS", 0x4000016, 2, 0x0000, 0x01FF);
+	io->define("BG2HOFS", 0x4000018, 2, 0x0000, 0x01FF);
+	io->define("BG2VOFS", 0x400001A, 2, 0x0000, 0x01FF);
+	io->define("BG3HOFS", 0x400001C, 2, 0x0000, 0x01FF);
+	io->define("BG3VOFS", 0x400001E, 2, 0x0000, 0x01FF);
+	io->define("BG2PA", 0x4000020, 2, 0x0000, 0xFFFF);
+	io->define("BG2PB", 0x4000022, 2, 0x0000, 0xFFFF);
+	io->define("BG2PC", 0x4000024, 2, 0x0000, 0xFFFF);
+	io->define("BG2PD", 0x4000026, 2, 0x0000, 0xFFFF);
+	io->define("BG2X", 0x4000028, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("BG2Y", 0x400002C, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("BG3PA", 0x4000030, 2, 0x0000, 0xFFFF);
+	io->define("BG3PB", 0x4000032, 2, 0x0000, 0xFFFF);
+	io->define("BG3PC", 0x4000034, 2, 0x0000, 0xFFFF);
+	io->define("BG3PD", 0x4000036, 2, 0x0000, 0xFFFF);
+	io->define("BG3X", 0x4000038, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("BG3Y", 0x400003C, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("WIN0H", 0x4000040, 2, 0x0000, 0xFFFF);
+	io->define("WIN1H", 0x4000042, 2, 0x0000, 0xFFFF);
+	io->define("WIN0V", 0x4000044, 2, 0x0000, 0xFFFF);
+	io->define("WIN1V", 0x4000046, 2, 0x0000, 0xFFFF);
+	io->define("WININ", 0x4000048, 2, 0x3F3F, 0x3F3F);
+	io->define("WINOUT", 0x400004A, 2, 0x3F3F, 0x3F3F);
+	io->define("MOSAIC", 0x400004C, 2, 0x0000, 0xFFFF);
+	io->define("BLDCNT", 0x4000050, 2, 0x3FFF, 0x3FFF);
+	io->define("BLDALPHA", 0x4000052, 2, 0x1F1F, 0x1F1F);
+	io->define("BLDY", 0x4000054, 2, 0x0000, 0x001F);
+	// Sound Registers
+	io->define("SOUND1CNT_L", 0x4000060, 2, 0x007F, 0x007F);
+	io->define("SOUND1CNT_H", 0x4000062, 2, 0xFFC0, 0xFFFF);
+	io->define("SOUND1CNT_X", 0x4000064, 2, 0x4000, 0xC7FF);
+	io->define("SOUND2CNT_L", 0x4000068, 2, 0xFFC0, 0xFFFF);
+	io->define("SOUND2CNT_H", 0x400006C, 2, 0x4000, 0xC7FF);
+	io->define("SOUND3CNT_L", 0x4000070, 2, 0x00E0, 0x00E0);
+	io->define("SOUND3CNT_H", 0x4000072, 2, 0xE000, 0xE0FF);
+	io->define("SOUND3CNT_X", 0x4000074, 2, 0x4000, 0xC7FF);
+	io->define("SOUND4CNT_L", 0x4000078, 2, 0xFF00, 0xFF3F);
+	io->define("SOUND4CNT_H", 0x400007C, 2, 0x40FF, 0xC0FF);
+	io->define("SOUNDCNT_L", 0x4000080, 2, 0xFF77, 0xFF77);
+	io->define("SOUNDCNT_H", 0x4000082, 2, 0x770F, 0xFF0F);
+	io->define("SOUNDCNT_X", 0x4000084, 2, 0x008F, 0x0080);
+	io->define("SOUNDBIAS", 0x4000088, 2, 0xC3FE, 0xC3FE);
+	for (unsigned int i = 0; i < 0x20; i += 4)
+		io->define("WAVE_RAM", 0x4000090 + i, 4, 0xFFFFFFFF, 0xFFFFFFFF);
+	io->define("FIFO_A", 0x40000A0, 4, 0x00000000, 0xFFFFFFFF);
+	io->define("FIFO_B", 0x40000A4, 4, 0x00000000, 0xFFFFFFFF);
+	// DMA Transfer Channels
+	io->define("DMA0SAD", 0x40000B0, 4, 0x00000000, 0x07FFFFFF);
+	io->define("DMA0DAD", 0x40000B4, 4, 0x00000000, 0x07FFFFFF);
+	io->define("DMA0CNT_L", 0x40000B8, 2, 0x0000, 0x3FFF);
+	io->define("DMA0CNT_H", 0x40000BA, 2, 0xF7E0, 0xF7E0, nullptr, &GBA::writeDMAControl);
+	io->define("DMA1SAD", 0x40000BC, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("DMA1DAD", 0x40000C0, 4, 0x00000000, 0x07FFFFFF);
+	io->define("DMA1CNT_L", 0x40000C4, 2, 0x0000, 0x3FFF);
+	io->define("DMA1CNT_H", 0x40000C6, 2, 0xF7E0, 0xF7E0, nullptr, &GBA::writeDMAControl);
+	io->define("DMA2SAD", 0x40000C8, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("DMA2DAD", 0x40000CC, 4, 0x00000000, 0x07FFFFFF);
+	io->define("DMA2CNT_L", 0x40000D0, 2, 0x0000, 0x3FFF);
+	io->define("DMA2CNT_H", 0x40000D2, 2, 0xF7E0, 0xF7E0, nullptr, &GBA::writeDMAControl);
+	io->define("DMA3SAD", 0x40000D4, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("DMA3DAD", 0x40000D8, 4, 0x00000000, 0x0FFFFFFF);
+	io->define("DMA3CNT_L", 0x40000DC, 2, 0x0000, 0xFFFF);
+	io->define("DMA3CNT_H", 0x40000DE, 2, 0xFFE0, 0xFFE0, nullptr, &GBA::writeDMAControl);
+	// Timer Registers (the counters are read from the timers, writes set the reload value)
+	io->define("TM0CNT_L", 0x4000100, 2, 0xFFFF, 0xFFFF, &GBA::readTimerCounter);
+	io->define("TM0CNT_H", 0x4000102, 2, 0x00C7, 0x00C7, nullptr, &GBA::writeTimerControl);
+	io->define("TM1CNT_L", 0x4000104, 2, 0xFFFF, 0xFFFF, &GBA::readTimerCounter);
+	io->define("TM1CNT_H", 0x4000106, 2, 0x00C7, 0x00C7, nullptr, &GBA::writeTimerControl);
+	io->define("TM2CNT_L", 0x4000108, 2, 0xFFFF, 0xFFFF, &GBA::readTimerCounter);
+	io->define("TM2CNT_H", 0x400010A, 2, 0x00C7, 0x00C7, nullptr, &GBA::writeTimerControl);
+	io->define("TM3CNT_L", 0x400010C, 2, 0xFFFF, 0xFFFF, &GBA::readTimerCounter);
+	io->define("TM3CNT_H", 0x400010E, 2, 0x00C7, 0x00C7, nullptr, &GBA::writeTimerControl);
+	// Serial Communication (1)
+	io->define("SIODATA32", 0x4000120, 4, 0xFFFFFFFF, 0xFFFFFFFF);
+	io->define("SIOMULTI0", 0x4000120, 2, 0xFFFF, 0xFFFF);
+	io->define("SIOMULTI1", 0x4000122, 2, 0xFFFF, 0xFFFF);
+	io->define("SIOMULTI2", 0x4000124, 2, 0xFFFF, 0xFFFF);
+	io->define("SIOMULTI3", 0x4000126, 2, 0xFFFF, 0xFFFF);
+	io->define("SIOCNT", 0x4000128, 2, 0xFFFF, 0xFFFF);
+	io->define("SIOMLT_SEND", 0x400012A, 2, 0xFFFF, 0xFFFF);
+	io->define("SIODATA8", 0x400012A, 2, 0xFFFF, 0xFFFF);
+	// Keypad Input
+	io->define("KEYINPUT", 0x4000130, 2, 0x03FF, 0x0000);
+	io->define("KEYCNT", 0x4000132, 2, 0xC3FF, 0xC3FF);
+	// Serial Communication (2)
+	io->define("RCNT", 0x4000134, 2, 0xC1FF, 0xC1FF);
+	io->define("JOYCNT", 0x4000140, 2, 0x0047, 0x0047);
+	io->define("JOY_RECV", 0x4000150, 4, 0xFFFFFFFF, 0xFFFFFFFF);
+	io->define("JOY_TRANS", 0x4000154, 4, 0xFFFFFFFF, 0xFFFFFFFF);
+	io->define("JOY_STAT", 0x4000158, 2, 0x003A, 0x0030);
+	// Interrupt Control Registers (IF bits are cleared by writing 1)
+	io->define("IE", 0x4000200, 2, 0x3FFF, 0x3FFF);
+	io->define("IF", 0x4000202, 2, 0x3FFF, 0x0000, nullptr, &GBA::writeIF);
+	io->define("WAITCNT", 0x4000204, 2, 0xDFFF, 0x5FFF);
+	io->define("IME", 0x4000208, 2, 0x0001, 0x0001);
+	io->define("POSTFLG", 0x4000300, 1, 0x01, 0x01);
+	io->define("HALTCNT", 0x4000301, 1, 0x00, 0x80, nullptr, &GBA::writeHaltControl);
+	map.addComponent(new IOPort16("?? (0x0FF)", 0x4000410));
+	map.addComponent(new IOPort32("MEM_CNT", 0x4000800));
+
+	/*
+	for (int i = 1; i < 256; i++)
+		map.addComponent(new IOPort32("MEM_CNT (MIR)", 0x4000800 + (i << 16)));
+	*/
+
+	map.addComponent(new RAM("CGRAM", 0x5000000, 0x400));
+	map.addComponent(new Mirror("CGRAM (MIR)", 0x5000000, 0x1000000, 0x5000000, 0x400));
+	// VRAM repeats every 128 KB, its last 32 KB repeat the 32 KB before them
+	map.addComponent(new RAM("VRAM", 0x6000000, 0x18000));
+	map.addComponent(new Mirror("VRAM (MIR)", 0x6018000, 0x8000, 0x6010000, 0x8000));
+	map.addComponent(new Mirror("VRAM (MIR)", 0x6000000, 0x1000000, 0x6000000, 0x20000));
+	map.addComponent(new RAM("OAM", 0x7000000, 0x400));
+	map.addComponent(new Mirror("OAM (MIR)", 0x7000000, 0x1000000, 0x7000000, 0x400));
+	map.addComponent(rom);
+	// Wait state 1 and 2 regions of the cartridge
+	map.addComponent(new Mirror("ROM/FLASH (WS1)", 0xA000000, 0x2000000, 0x8000000, 0x2000000));
+	map.addComponent(new Mirror("ROM/FLASH (WS2)", 0xC000000, 0x2000000, 0x8000000, 0x2000000));
+	map.addComponent(new RAM("SRAM", 0xE000000, 0x1000)); // Battery backed, the game writes its saves
+	map.addComponent(new Mirror("SRAM (MIR)", 0xE000000, 0x2000000, 0xE000000, 0x1000));
+
+	cpu.setMemoryMap(&map);
+	reg16(REG_KEYINPUT) = 0x03FF; // No key is pressed
+
+	// No boot ROM is loaded, only its IRQ vector is provided. BIOS functions (SWI) are not
+	// emulated, the SWI vector returns to the caller at once and leaves the registers unchanged.
+	unsigned int code[0x400 >> 2] = {};
+	code[VECTOR_SWI >> 2] = 0xE1B0F00E; // MOVS PC, LR
+	code[VECTOR_IRQ >> 2] = 0xEA000000 | ((BIOS_IRQ_ADDRESS - VECTOR_IRQ - 8) >> 2); // B 0x128
+	for (unsigned int i = 0; i < sizeof(BIOS_IRQ_HANDLER) / sizeof(unsigned int); i++)
+		code[(BIOS_IRQ_ADDRESS >> 2) + i] = BIOS_IRQ_HANDLER[i];
+	bios->loadData(0, code, sizeof(code));
+}
+
+void GBA::loadROM(const char* path)
+{
+	rom->loadROM(path);
+}
+
+void GBA::printDescription()
+{
+	cpu.printDescription();
+	map.printDescription();
+}
+
+void GBA::reset()
+{
+	cpu.reset();
+	scheduler.clear();
+
+	// Stacks set up by the boot ROM
+	cpu.setStackPointer(MODE_SYSTEM, 0x3007F00);
+	cpu.setStackPointer(MODE_IRQ, 0x3007FA0);
+	cpu.setStackPointer(MODE_SUPERVISOR, 0x3007FE0);
+
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		dma[i].active = false;
+		timers[i].enabled = false;
+	}
+	fifo_size[0] = fifo_size[1] = 0;
+	stopped = false;
+
+	// The display continues from the current position of the frame
+	const unsigned long long now = cpu.getCycles();
+	const unsigned long long line_start = now - now % CYCLES_PER_LINE;
+	vcount = (unsigned int)((now % CYCLES_PER_FRAME) / CYCLES_PER_LINE);
+	reg16(REG_VCOUNT) = vcount;
+	reg16(REG_DISPSTAT) &= 0xFFF8;
+	reg16(REG_IF) = 0;
+
+	if (line_start + HDRAW_CYCLES > now)
+		scheduler.schedule(EventType::HBLANK, line_start + HDRAW_CYCLES);
+	scheduler.schedule(EventType::LINE_END, line_start + CYCLES_PER_LINE);
+}
+
+std::shared_ptr<const GBA::SaveState> GBA::saveState()
+{
+	SaveState* state = new SaveState();
+	state->cpu = cpu.saveState();
+	state->scheduler = scheduler.saveState();
+	std::copy(timers, timers + 4, state->timers);
+	std::copy(dma, dma + 4, state->dma);
+	std::copy(fifo_size, fifo_size + 2, state->fifo_size);
+	state->vcount = vcount;
+	state->stopped = stopped;
+	state->memory = map.saveSnapshot();
+	return std::shared_ptr<const SaveState>(state);
+}
+
+void GBA::loadState(const SaveState& state)
+{
+	map.loadSnapshot(state.memory);
+	cpu.loadState(state.cpu);
+	scheduler.loadState(state.scheduler);
+	std::copy(state.timers, state.timers + 4, timers);
+	std::copy(state.dma, state.dma + 4, dma);
+	std::copy(state.fifo_size, state.fifo_size + 2, fifo_size);
+	vcount = state.vcount;
+	stopped = state.stopped;
+}
+
+StopReason GBA::run(const unsigned long long budget)
+{
+	const unsigned long long target = cpu.getCycles() + budget;
+
+	while (cpu.getCycles() < target)
+	{
+		const unsigned long long now = cpu.getCycles();
+		const unsigned long long deadline = std::min(scheduler.nextDeadline(), target);
+
+		if (deadline > now)
+		{
+			const StopReason reason = cpu.run(deadline - now);
+
+			// A halted processor sleeps until the next event
+			if (reason == StopReason::HALT)
+				cpu.addCycles(deadline - std::min(deadline, cpu.getCycles()));
+			else if (reason != StopReason::CYCLE_BUDGET)
+				return reason;
+		}
+
+		scheduler.dispatch(cpu.getCycles());
+		checkInterrupts();
+	}
+
+	return StopReason::CYCLE_BUDGET;
+}
+
+// Runs until the end of the current frame
+StopReason GBA::runFrame()
+{
+	return run(CYCLES_PER_FRAME - cpu.getCycles() % CYCLES_PER_FRAME);
+}
+
+void GBA::handleEvent(const EventType type, const unsigned long long time)
+{
+	switch (type)
+	{
+	case EventType::HBLANK:
+		hblank(time);
+		return;
+
+	case EventType::LINE_END:
+		lineEnd(time);
+		return;
+
+	case EventType::TIMER0:
+	case EventType::TIMER1:
+	case EventType::TIMER2:
+	case EventType::TIMER3:
+		timerOverflow((unsigned int)type - (unsigned int)EventType::TIMER0, time);
+		return;
+
+	case EventType::DMA0:
+	case EventType::DMA1:
+	case EventType::DMA2:
+	case EventType::DMA3:
+		transferDMA((unsigned int)type - (unsigned int)EventType::DMA0);
+		return;
+
+	case EventType::FIFO_A:
+	case EventType::FIFO_B:
+	{
+		// Refilled by DMA 1 or 2 with the special start timing
+		const unsigned int fifo = type == EventType::FIFO_A ? REG_FIFO_A : REG_FIFO_B;
+		for (unsigned int n = 1; n <= 2; n++)
+		{
+			const unsigned int base = REG_DMA0SAD + n * 12;
+			const unsigned short control = reg16(base + 10);
+			if ((control & 0x8000) && ((control >> 12) & 3) == DMA_SPECIAL && reg32(base + 4) == fifo)
+			{
+				transferDMA(n);
+				return;
+			}
+		}
+		return;
+	}
+
+	default:
+		return;
+	}
+}
+
+void GBA::writeIF(const unsigned int, const unsigned short value, const unsigned short)
+{
+	reg16(REG_IF) &= ~value;
+}
+
+// Halts until an enabled interrupt is requested, bit 7 stops until an enabled keypad, serial or cartridge
+// interrupt is (the devices keep running while stopped, their interrupts are taken once the stop ends)
+void GBA::writeHaltControl(const unsigned int, const unsigned short value, const unsigned short mask)
+{
+	if (!(mask & 0xFF00)) return;
+	stopped = (value & 0x8000) && !(reg16(REG_IE) & reg16(REG_IF) & STOP_IRQS);
+	if (stopped || !(reg16(REG_IE) & reg16(REG_IF)))
+		cpu.setHalted(true);
+}
+
+// Timers reload when their enable bit is set and stop when it is cleared,
+// a running timer keeps its counter when its prescaler or cascade bit changes
+void GBA::writeTimerControl(const unsigned int address, const unsigned short, const unsigned short)
+{
+	const unsigned int n = (address - REG_TM0CNT_L) >> 2;
+	const unsigned short control = reg16(address);
+	Timer& t = timers[n];
+	if (((control & 0x0080) != 0) != t.enabled)
+		startTimer(n);
+	else if (t.enabled && ((control ^ t.control) & 0x0007))
+	{
+		// The pending overflow was scheduled with the previous period
+		t.counter = std::min(timerCounter(n), 0xFFFFu);
+		t.start = cpu.getCycles();
+		t.control = control;
+		scheduleTimer(n, t.start + ((0x10000 - t.counter) << PRESCALER_SHIFT[control & 3]));
+	}
+}
+
+// DMA channels latch their addresses when enabled, a write to a running channel keeps them
+void GBA::writeDMAControl(const unsigned int address, const unsigned short, const unsigned short)
+{
+	const unsigned int n = (address - REG_DMA0SAD) / 12;
+	if (!((reg16(address) & 0x8000) && dma[n].active))
+		startDMA(n);
+}
+
+unsigned short GBA::readTimerCounter(const unsigned int address)
+{
+	const unsigned int n = (address - REG_TM0CNT_L) >> 2;
+
+	// A running timer counts without events, a loop polling it is not idle
+	if (timers[n].enabled && !(n > 0 && (reg16(address + 2) & 0x0004))) map.countLiveRead();
+	return (unsigned short)timerCounter(n);
+}
+
+void GBA::requestInterrupt(const unsigned short flag)
+{
+	reg16(REG_IF) |= flag;
+	if (!(reg16(REG_IE) & flag & (stopped ? STOP_IRQS : 0xFFFF))) return;
+	stopped = false;
+	cpu.setHalted(false);
+}
+
+// Enters the IRQ handler if an enabled interrupt is pending
+void GBA::checkInterrupts()
+{
+	if (!stopped && (reg16(REG_IME) & 1) && (reg16(REG_IE) & reg16(REG_IF)))
+		cpu.interrupt();
+}
+
+void GBA::hblank(const unsigned long long time)
+{
+	unsigned short& dispstat = reg16(REG_DISPSTAT);
+	dispstat |= 0x0002;
+	if (dispstat & 0x0010) requestInterrupt(IRQ_HBLANK);
+
+	if (vcount < VISIBLE_LINES) triggerDMA(DMA_HBLANK, time);
+}
+
+void GBA::lineEnd(const unsigned long long time)
+{
+	vcount = (vcount + 1) % TOTAL_LINES;
+	reg16(REG_VCOUNT) = vcount;
+
+	unsigned short& dispstat = reg16(REG_DISPSTAT);
+	dispstat &= ~0x0002;
+
+	if (vcount == VISIBLE_LINES)
+	{
+		dispstat |= 0x0001;
+		if (dispstat & 0x0008) requestInterrupt(IRQ_VBLANK);
+		triggerDMA(DMA_VBLANK, time);
+	}
+	else if (vcount == TOTAL_LINES - 1)
+		dispstat &= ~0x0001; // The flag is cleared on the last line
+
+	if (vcount == (unsigned int)(dispstat >> 8))
+	{
+		dispstat |= 0x0004;
+		if (dispstat & 0x0020) requestInterrupt(IRQ_VCOUNT);
+	}
+	else
+		dispstat &= ~0x0004;
+
+	scheduler.schedule(EventType::HBLANK, time + HDRAW_CYCLES);
+	scheduler.schedule(EventType::LINE_END, time + CYCLES_PER_LINE);
+}
+
+void GBA::startTimer(const unsigned int n)
+{
+	const unsigned int base = REG_TM0CNT_L + (n << 2);
+	const unsigned short control = reg16(base + 2);
+	const unsigned int reload = reg16(base);
+	const EventType event = (EventType)((unsigned int)EventType::TIMER0 + n);
+	Timer& t = timers[n];
+
+	// A stopped timer keeps its counter
+	if (!(control & 0x0080))
+	{
+		if (t.enabled) t.counter = timerCounter(n);
+		t.enabled = false;
+		scheduler.cancel(event);
+		return;
+	}
+
+	t.counter = reload;
+	t.start = cpu.getCycles();
+	t.period = (0x10000 - reload) << PRESCALER_SHIFT[control & 3];
+	t.control = control;
+	t.enabled = true;
+	scheduleTimer(n, t.start + t.period);
+}
+
+// Schedules the overflow of a running timer (replacing the pending one),
+// cascaded timers count the overflows of the previous timer instead
+void GBA::scheduleTimer(const unsigned int n, const unsigned long long time)
+{
+	const EventType event = (EventType)((unsigned int)EventType::TIMER0 + n);
+	if (n > 0 && (timers[n].control & 0x0004))
+		scheduler.cancel(event);
+	else
+		scheduler.schedule(event, time);
+}
+
+// Counter of a timer at the current cycle, cascaded and stopped timers keep theirs
+unsigned int GBA::timerCounter(const unsigned int n)
+{
+	const Timer& t = timers[n];
+	if (!t.enabled || (n > 0 && (t.control & 0x0004))) return t.counter;
+	return t.counter + (unsigned int)((cpu.getCycles() - t.start) >> PRESCALER_SHIFT[t.control & 3]);
+}
+
+void GBA::timerOverflow(const unsigned int n, const unsigned long long time)
+{
+	const unsigned int base = REG_TM0CNT_L + (n << 2);
+	const unsigned short control = reg16(base + 2);
+	const unsigned int reload = reg16(base);
+	Timer& t = timers[n];
+
+	t.counter = reload;
+	t.start = time;
+	t.period = (0x10000 - reload) << PRESCALER_SHIFT[control & 3];
+
+	if (control & 0x0040) requestInterrupt(IRQ_TIMER0 << n);
+
+	// The sound FIFOs play a sample on each overflow of their timer
+	if (n < 2)
+	{
+		const unsigned short soundcnt = reg16(REG_SOUNDCNT_H);
+		if ((soundcnt & 0x0300) && ((soundcnt >> 10) & 1) == n) consumeFIFO(0, time);
+		if ((soundcnt & 0x3000) && ((soundcnt >> 14) & 1) == n) consumeFIFO(1, time);
+	}
+
+	if (n < 3 && (reg16(base + 6) & 0x0084) == 0x0084 && ++timers[n + 1].counter > 0xFFFF)
+		timerOverflow(n + 1, time);
+
+	scheduleTimer(n, time + t.period);
+}
+
+void GBA::consumeFIFO(const unsigned int n, const unsigned long long time)
+{
+	if (fifo_size[n]) fifo_size[n]--;
+	if (fifo_size[n] <= 16) scheduler.schedule(n ? EventType::FIFO_B : EventType::FIFO_A, time);
+}
+
+void GBA::startDMA(const unsigned int n)
+{
+	const unsigned int base = REG_DMA0SAD + n * 12;
+	const unsigned short control = reg16(base + 10);
+	const EventType event = (EventType)((unsigned int)EventType::DMA0 + n);
+
+	dma[n].source = reg32(base);
+	dma[n].dest = reg32(base + 4);
+	dma[n].active = (control & 0x8000) != 0;
+
+	if (!dma[n].active)
+		scheduler.cancel(event);
+	else if (((control >> 12) & 3) == DMA_IMMEDIATE)
+		scheduler.schedule(event, cpu.getCycles() + 2);
+}
+
+void GBA::triggerDMA(const DMATiming timing, const unsigned long long time)
+{
+	for (unsigned int n = 0; n < 4; n++)
+	{
+		const unsigned short control = reg16(REG_DMA0SAD + n * 12 + 10);
+		if ((control & 0x8000) && ((control >> 12) & 3) == timing)
+			scheduler.schedule((EventType)((unsigned int)EventType::DMA0 + n), time);
+	}
+}
+
+// Address step of a DMA address control field
+static int dmaStep(const unsigned int control, const unsigned int width)
+{
+	switch (control)
+	{
+	case 1: return -(int)width;
+	case 2: return 0;
+	default: return (int)width;
+	}
+}
+
+void GBA::transferDMA(const unsigned int n)
+{
+	const unsigned int base = REG_DMA0SAD + n * 12;
+	unsigned short& control = reg16(base + 10);
+	if (!(control & 0x8000)) return;
+
+	DMAChannel& ch = dma[n];
+	if (!ch.active)
+	{
+		ch.source = reg32(base);
+		ch.dest = reg32(base + 4);
+		ch.active = true;
+	}
+
+	const DMATiming timing = (DMATiming)((control >> 12) & 3);
+	const bool fifo = timing == DMA_SPECIAL && (n == 1 || n == 2);
+	const unsigned int width = fifo || (control & 0x0400) ? 4 : 2;
+	const int src_step = dmaStep((control >> 7) & 3, width);
+	const int dst_step = fifo ? 0 : dmaStep((control >> 5) & 3, width);
+
+	unsigned int count = fifo ? 4 : reg16(base + 8);
+	if (count == 0) count = n == 3 ? 0x10000 : 0x4000;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (width == 4) map.write32(ch.dest, map.read32(ch.source & ~3));
+		else map.write16(ch.dest, map.read16(ch.source & ~1));
+		ch.source += src_step;
+		ch.dest += dst_step;
+	}
+
+	// The processor is stalled during the transfer
+	cpu.addCycles(2 + (count << 1));
+
+	if (fifo)
+	{
+		unsigned int& size = fifo_size[ch.dest == REG_FIFO_B];
+		size = std::min(size + 16, 32u);
+	}
+
+	if (control & 0x4000) requestInterrupt(IRQ_DMA0 << n);
+
+	if ((control & 0x0200) && timing != DMA_IMMEDIATE)
+	{
+		if (((control >> 5) & 3) == 3) ch.dest = reg32(base + 4);
+	}
+	else
+	{
+		control &= ~0x8000;
+		ch.active = false;
+	}
+}
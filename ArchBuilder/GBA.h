@@ -0,0 +1,223 @@
+#pragma once
+
+#ifndef GBA_H
+#define GBA_H
+
+#include "ARM7.h"
+#include "Scheduler.h"
+#include <memory>
+
+// Display timing
+constexpr unsigned int CYCLES_PER_LINE = 1232;
+constexpr unsigned int HDRAW_CYCLES = 960;
+constexpr unsigned int VISIBLE_LINES = 160;
+constexpr unsigned int TOTAL_LINES = 228;
+
+// IO registers handled by the system
+constexpr unsigned int REG_DISPSTAT = 0x4000004;
+constexpr unsigned int REG_VCOUNT = 0x4000006;
+constexpr unsigned int REG_SOUNDCNT_H = 0x4000082;
+constexpr unsigned int REG_FIFO_A = 0x40000A0;
+constexpr unsigned int REG_FIFO_B = 0x40000A4;
+constexpr unsigned int REG_DMA0SAD = 0x40000B0;	// DMA channels are 12 bytes apart
+constexpr unsigned int REG_TM0CNT_L = 0x4000100;	// Timers are 4 bytes apart
+constexpr unsigned int REG_KEYINPUT = 0x4000130;
+constexpr unsigned int REG_IE = 0x4000200;
+constexpr unsigned int REG_IF = 0x4000202;
+constexpr unsigned int REG_IME = 0x4000208;
+constexpr unsigned int REG_HALTCNT = 0x4000301;
+constexpr unsigned int IO_START = 0x4000000;
+constexpr unsigned int IO_END = 0x40003FF;
+
+// Interrupt flags
+constexpr unsigned short IRQ_VBLANK = 0x0001;
+constexpr unsigned short IRQ_HBLANK = 0x0002;
+constexpr unsigned short IRQ_VCOUNT = 0x0004;
+constexpr unsigned short IRQ_TIMER0 = 0x0008;
+constexpr unsigned short IRQ_SERIAL = 0x0080;
+constexpr unsigned short IRQ_DMA0 = 0x0100;
+constexpr unsigned short IRQ_KEYPAD = 0x1000;
+constexpr unsigned short IRQ_GAMEPAK = 0x2000;
+
+// DMA start timings
+enum DMATiming {
+	DMA_IMMEDIATE,
+	DMA_VBLANK,
+	DMA_HBLANK,
+	DMA_SPECIAL		// Sound FIFO (DMA 1, 2)
+};
+
+class GBA;
+
+/**
+ * @brief IO registers of the GBA (0x4000000-0x40003FF) in one register file.
+ * Each halfword has its access masks and handlers, so an access is routed by a single lookup.
+*/
+class IORegisters : public IOComp
+{
+public:
+	// Returns the value of a register that is not kept in memory
+	typedef unsigned short (GBA::*ReadHandler)(const unsigned int address);
+	// Called after a halfword was written with the written bits (value) and byte lanes (mask)
+	typedef void (GBA::*WriteHandler)(const unsigned int address, const unsigned short value, const unsigned short mask);
+
+	struct Register
+	{
+		const char* name;			// nullptr for unused halfwords
+		unsigned char width;		// Bytes of the register
+		unsigned short read_mask;	// Readable bits, the others read 0
+		unsigned short write_mask;	// Writable bits
+		ReadHandler read;
+		WriteHandler write;
+	};
+
+	static constexpr unsigned int COUNT = 512; // Halfwords
+
+private:
+	GBA& owner;
+	Register registers[COUNT];
+
+	unsigned short readHalf(const unsigned int offset);
+	void writeHalf(const unsigned int offset, const unsigned short value, const unsigned short lanes);
+
+public:
+	IORegisters(GBA& gba);
+
+	/**
+	 * @brief Describes a register, byte registers share the entry of their halfword
+	 * @param nm - name of the register
+	 * @param add - address of the register
+	 * @param width - bytes of the register (1, 2 or 4)
+	 * @param read_mask - readable bits
+	 * @param write_mask - writable bits
+	 * @param read - returns the value instead of the memory (nullptr to read the memory)
+	 * @param write - called after a write (nullptr if none)
+	*/
+	void define(const char* nm, const unsigned int add, const unsigned int width, const unsigned int read_mask,
+		const unsigned int write_mask, const ReadHandler read = nullptr, const WriteHandler write = nullptr);
+
+	const Register& getRegister(const unsigned int add) const { return registers[(add & mask) >> 1]; }
+
+	unsigned int read(const unsigned int add, const unsigned int width) override;
+	void write(const unsigned int add, const unsigned int value, const unsigned int width) override;
+};
+
+/**
+ * @brief Game Boy Advance system that owns the memory map, the processor and the event scheduler.
+ * The processor runs straight up to the next event, devices are never polled per instruction.
+ * A halted or stopped processor (and one spinning in an idle loop) skips straight to the next event.
+*/
+class GBA : public EventHandler
+{
+	friend class Benchmark;
+
+private:
+	struct Timer
+	{
+		unsigned long long start;	// Cycle the counter was last reloaded or latched
+		unsigned int counter;		// Counter of cascaded timers
+		unsigned int period;		// Cycles between overflows
+		unsigned short control;		// Prescaler and cascade bits the timer counts with
+		bool enabled;				// Enable bit of the control register when the timer was started
+	};
+
+	struct DMAChannel
+	{
+		unsigned int source;		// Internal source address
+		unsigned int dest;			// Internal destination address
+		bool active;				// Addresses were latched
+	};
+
+public:
+	// Snapshot of a whole machine (the memory pages are shared with the snapshots taken before it)
+	struct SaveState
+	{
+		ARM7TDMI::CPUState cpu;
+		Scheduler::State scheduler;
+		Timer timers[4];
+		DMAChannel dma[4];
+		unsigned int fifo_size[2];
+		unsigned int vcount;
+		bool stopped;
+		std::shared_ptr<const MemorySnapshot> memory;
+	};
+
+private:
+	MemoryMap map;
+	IORegisters* io;
+	ROM* rom;
+	ARM7TDMI cpu;
+	Scheduler scheduler;
+	Timer timers[4];
+	DMAChannel dma[4];
+	unsigned int fifo_size[2];	// Bytes queued in the sound FIFOs
+	unsigned int vcount;
+	bool stopped;				// Stop mode, only the keypad, serial and cartridge interrupts end it
+
+	// Registers are at a constant offset in the register file
+	inline unsigned short& reg16(const unsigned int address) { return *(unsigned short*)(io->getData() + (address - IO_START)); }
+	inline unsigned int& reg32(const unsigned int address) { return *(unsigned int*)(io->getData() + (address - IO_START)); }
+
+	void requestInterrupt(const unsigned short flag);
+	void checkInterrupts();
+
+	void hblank(const unsigned long long time);
+	void lineEnd(const unsigned long long time);
+	void timerOverflow(const unsigned int n, const unsigned long long time);
+	void consumeFIFO(const unsigned int n, const unsigned long long time);
+	void triggerDMA(const DMATiming timing, const unsigned long long time);
+	void transferDMA(const unsigned int n);
+	void scheduleTimer(const unsigned int n, const unsigned long long time);
+	unsigned int timerCounter(const unsigned int n);
+
+	// Register handlers
+	unsigned short readTimerCounter(const unsigned int address);
+	void writeTimerControl(const unsigned int address, const unsigned short value, const unsigned short mask);
+	void writeDMAControl(const unsigned int address, const unsigned short value, const unsigned short mask);
+	void writeIF(const unsigned int address, const unsigned short value, const unsigned short mask);
+	void writeHaltControl(const unsigned int address, const unsigned short value, const unsigned short mask);
+
+public:
+	GBA();
+	GBA(const GBA&) = delete; // Owns its memory map and components
+	GBA& operator=(const GBA&) = delete;
+
+	void loadROM(const char* path);
+	void reset();
+	StopReason run(const unsigned long long budget);
+	StopReason runFrame();
+
+	/**
+	 * @brief Starts or stops a timer after its control register was written
+	 * @param n - timer index (0-3)
+	*/
+	void startTimer(const unsigned int n);
+
+	/**
+	 * @brief Latches the addresses of a DMA channel after its control register was written
+	 * @param n - channel index (0-3)
+	*/
+	void startDMA(const unsigned int n);
+
+	void handleEvent(const EventType type, const unsigned long long time) override;
+
+	/**
+	 * @brief Takes a snapshot of the processor, memory and devices, only the memory pages
+	 * written since the previous snapshot (or restore) are copied
+	 * @return snapshot that can be restored any number of times
+	*/
+	std::shared_ptr<const SaveState> saveState();
+
+	/**
+	 * @brief Restores a snapshot, the cost depends on the pages written since the previous snapshot or restore
+	 * @param state - snapshot of this machine (or one running the same system)
+	*/
+	void loadState(const SaveState& state);
+
+	ARM7TDMI& getProcessor() { return cpu; }
+	MemoryMap& getMemoryMap() { return map; }
+	const ROM& getROM() const { return *rom; }
+	void printDescription();
+};
+
+#endif
@@ -4,6 +4,7 @@
 #define INSTRUCTION_H
 
 #include <vector>
+#include <type_traits>
 
 struct Instruction
 {
@@ -59,10 +60,160 @@ public:
 
 	const InstructionSuffix getSuffix(unsigned int i) const { return suffix[i]; }
 	const Instruction* getInstructionById(unsigned int i) const { return &set[i]; }
+
+	// Finds the instruction that matches an opcode by testing every instruction in priority order (nullptr if unknown)
+	const Instruction* getInstruction(const unsigned int op) const
+	{
+		for (const Instruction& in : set)
+			if ((op & in.mask) == in.code) return &in;
+		return nullptr;
+	}
+
 	const unsigned int size() const { return (unsigned int) set.size(); }
 	const char* getName() const { return name; }
 	const unsigned int getOpCodeMask() const { return opcode_mask; }
 	const unsigned int getSuffixMask() const { return suffix_mask; }
 };
 
+/**
+ * @brief Compile-time description of an instruction and the handler that executes it.
+ * An instruction set is a constexpr array of these, listed in decoding priority.
+ * Instructions with a specializer get the handler it returns for the opcode bits of every
+ * decode table index instead (a template instantiation per operand form).
+ * @tparam Handler - handler type
+*/
+template <typename Handler>
+struct InstructionSpec
+{
+	unsigned int id;
+	const char* mnemonic;
+	unsigned int min_arg;
+	unsigned int mask;
+	unsigned int code;
+	const char* description;
+	Handler handler;
+	Handler (*specialize)(const unsigned int bits) = nullptr;
+};
+
+/**
+ * @brief Decoded instruction (instr is nullptr if the opcode is unknown)
+*/
+template <typename Handler>
+struct DecodeEntry
+{
+	const InstructionSpec<Handler>* instr;
+	Handler handler;
+};
+
+/**
+ * @brief Adds the instructions of a description to a runtime instruction set (used by the script and printDescription)
+*/
+template <typename Handler, unsigned int N>
+void addInstructions(InstructionSet& set, const InstructionSpec<Handler> (&isa)[N])
+{
+	for (const InstructionSpec<Handler>& in : isa)
+		set.addInstruction(Instruction(in.id, in.mnemonic, in.min_arg, in.mask, in.code, in.description));
+}
+
+/**
+ * @brief Visits the instructions of a description that can match opcodes with some of their bits known
+ * @param bits - known opcode bits
+ * @param visit - called with the position of every candidate (in priority order)
+*/
+template <const auto& Isa, unsigned int IndexMask, typename Visit>
+constexpr void forEachCandidate(const unsigned int bits, Visit visit)
+{
+	for (unsigned int j = 0; j < std::extent_v<std::remove_reference_t<decltype(Isa)>>; j++)
+	{
+		const unsigned int covered = Isa[j].mask & IndexMask;
+
+		if ((bits & covered) != (Isa[j].code & covered)) continue;
+		if ((Isa[j].code & ~Isa[j].mask) != 0) continue; // Can never match (ex. PRINT)
+
+		visit(j);
+
+		// The remaining instructions can never be reached
+		if (covered == Isa[j].mask) break;
+	}
+}
+
+/**
+ * @brief Number of entries in a decode table (the candidates and terminator of every index)
+*/
+template <const auto& Isa, unsigned int Size, unsigned int IndexMask, unsigned int (*Expand)(const unsigned int)>
+constexpr unsigned int countDecodeEntries()
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < Size; i++)
+	{
+		forEachCandidate<Isa, IndexMask>(Expand(i), [&](const unsigned int) { n++; });
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @brief Table that resolves an opcode to its instruction and handler, generated at compile time.
+ * The table is indexed by a subset of the opcode bits. Every entry lists the instructions
+ * that can match opcodes with those bits (in the same priority as the description)
+ * followed by a terminator that holds the fallback handler.
+ * @tparam Handler - handler type
+ * @tparam Isa - constexpr array of InstructionSpec
+ * @tparam Size - number of table entries
+ * @tparam IndexMask - opcode bits that are covered by the table index
+ * @tparam Expand - converts a table index back into the opcode bits it covers
+ * @tparam Fallback - handler used when no instruction matches
+*/
+template <typename Handler, const auto& Isa, unsigned int Size, unsigned int IndexMask,
+	unsigned int (*Expand)(const unsigned int), Handler Fallback>
+class DecodeTable
+{
+public:
+	using Entry = DecodeEntry<Handler>;
+
+private:
+	struct Layout
+	{
+		unsigned int offset[Size];
+		Entry entries[countDecodeEntries<Isa, Size, IndexMask, Expand>()];
+	};
+
+	static constexpr Layout layout = []
+	{
+		Layout t = {};
+		unsigned int n = 0;
+		for (unsigned int i = 0; i < Size; i++)
+		{
+			t.offset[i] = n;
+			forEachCandidate<Isa, IndexMask>(Expand(i), [&](const unsigned int j) { t.entries[n++] = { &Isa[j], Isa[j].specialize ? Isa[j].specialize(Expand(i)) : Isa[j].handler }; });
+			t.entries[n++] = { nullptr, Fallback };
+		}
+		return t;
+	}();
+
+public:
+	/**
+	 * @brief Finds the instruction that matches an opcode
+	 * @param index - table index of the opcode
+	 * @param op - opcode
+	 * @return matching entry (instr is nullptr if the opcode is unknown)
+	*/
+	static inline const Entry& find(const unsigned int index, const unsigned int op)
+	{
+		const Entry* e = layout.entries + layout.offset[index];
+		while (e->instr && (op & e->instr->mask) != e->instr->code) e++;
+		return *e;
+	}
+
+	/**
+	 * @brief Counts the entries that find() visits for an opcode (the terminator included)
+	 * @param index - table index of the opcode
+	 * @param op - opcode
+	*/
+	static inline unsigned int compares(const unsigned int index, const unsigned int op)
+	{
+		return (unsigned int)(&find(index, op) - (layout.entries + layout.offset[index])) + 1;
+	}
+};
+
 #endif
@@ -2,9 +2,6 @@
 
 using namespace arc;
 
-// Last status parsed in midi file
-u8 last_status = 0;
-
 /**
  * @brief Loads a MidiFile
  * @param path - path of the file
@@ -118,7 +115,7 @@ bool MidiSequence::addNextEvent(u8*& data, const u8* data_end, MidiTrack& track,
 	// Set the tick location forward based on change in time
 	tick += delta_time;
 
-	MidiEvent ev(data, tick, 0, last_status);
+	MidiEvent ev(data, tick, 0, running_status);
 
 	// Check if status byte exists
 	if (data[0] & 0x80)
@@ -128,9 +125,9 @@ bool MidiSequence::addNextEvent(u8*& data, const u8* data_end, MidiTrack& track,
 		ev.status = data[0];
 		data++;
 	}
-	else if (last_status == 0) throw std::exception("Missing status byte at start of file");
+	else if (running_status == 0) throw std::exception("Missing status byte at start of file");
 
-	last_status = ev.status;
+	running_status = ev.status;
 
 	// Determine size based on the status id
 	if (ev.status == 0xFF)
@@ -82,6 +82,8 @@ typedef std::vector<MidiEvent> MidiTrack;
 // The sequence for processing midi events
 class MidiSequence : public ARCFile
 {
+	u8 running_status = 0; // Last status parsed in the file
+
 	bool addNextEvent(u8*& data, const u8* data_end, MidiTrack& track, u64& tick);
 	bool convertToTrack(const MidiChunk& chunk, MidiTrack& track);
 	bool load(const char* filepath) override;
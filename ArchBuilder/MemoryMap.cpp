@@ -0,0 +1,180 @@
+#include "MemoryMap.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#pragma comment(lib, "onecore.lib") // VirtualAlloc2 and MapViewOfFile3
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// Views and allocations replace placeholders in units of the allocation granularity (64KB)
+static unsigned int allocationGranularity()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+}
+
+// Size of the reservation of a component
+static size_t reservedSize(const unsigned int size)
+{
+	const size_t granularity = allocationGranularity();
+	return (size + granularity - 1) & ~(granularity - 1);
+}
+#endif
+
+// Reserved pages are only backed by memory once they are touched
+ROM::ROM(const char* nm, unsigned int add, unsigned int sz) : MemoryComp(nm, add, sz, false)
+{
+#ifdef _WIN32
+	// The placeholder keeps the address while a file view replaces its first pages (the memory map keeps pointers to it)
+	const size_t reserved = reservedSize(size);
+	memory = (unsigned char*)VirtualAlloc2(nullptr, nullptr, reserved, MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, nullptr, 0);
+	if (memory && !VirtualAlloc2(nullptr, memory, reserved, MEM_RESERVE | MEM_COMMIT | MEM_REPLACE_PLACEHOLDER, PAGE_READONLY, nullptr, 0))
+	{
+		VirtualFree(memory, 0, MEM_RELEASE);
+		memory = nullptr;
+	}
+#else
+	void* pages = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	memory = pages == MAP_FAILED ? nullptr : (unsigned char*)pages;
+#endif
+	if (!memory) exit(-1);
+}
+
+ROM::~ROM()
+{
+#ifdef _WIN32
+	if (view) UnmapViewOfFile(memory);
+	if (view < reservedSize(size)) VirtualFree(memory + view, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+	memory = nullptr;
+}
+
+void ROM::loadROM(const char* path)
+{
+	std::cout << "\nLOADING " << path << std::endl;
+
+#ifdef _WIN32
+	const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size))
+	{
+		std::cout << path << " cannot be read!\n";
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		return;
+	}
+
+	const size_t length = std::min((size_t)file_size.QuadPart, (size_t)size);
+	if ((size_t)file_size.QuadPart > size) std::cout << path << " is larger than " << name << ", it is truncated\n";
+
+	// The contents of a previous file are released back to a single placeholder
+	const size_t reserved = reservedSize(size);
+	if (view)
+	{
+		UnmapViewOfFile2(GetCurrentProcess(), memory, MEM_PRESERVE_PLACEHOLDER);
+		if (view < reserved)
+		{
+			VirtualFree(memory + view, reserved - view, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
+			VirtualFree(memory, reserved, MEM_RELEASE | MEM_COALESCE_PLACEHOLDERS);
+		}
+	}
+	else VirtualFree(memory, reserved, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
+
+	// The whole granules of the file are mapped read-only (a view cannot extend past the end of the file)
+	view = (unsigned int)(length & ~(size_t)(allocationGranularity() - 1));
+	if (view)
+	{
+		const HANDLE section = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (view < reserved) VirtualFree(memory, view, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
+		if (!section || !MapViewOfFile3(section, nullptr, memory, 0, view, MEM_REPLACE_PLACEHOLDER, PAGE_READONLY, nullptr, 0))
+		{
+			// Files that cannot be mapped are read
+			if (view < reserved) VirtualFree(memory, reserved, MEM_RELEASE | MEM_COALESCE_PLACEHOLDERS);
+			view = 0;
+		}
+		if (section) CloseHandle(section); // The view keeps the section open
+	}
+
+	// The rest of the component is committed separately, it holds the end of the file and zeros
+	if (view < reserved && !VirtualAlloc2(nullptr, memory + view, reserved - view,
+		MEM_RESERVE | MEM_COMMIT | MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, nullptr, 0))
+		exit(-1);
+	LARGE_INTEGER offset;
+	offset.QuadPart = view;
+	size_t done = view;
+	DWORD n;
+	if (SetFilePointerEx(file, offset, nullptr, FILE_BEGIN))
+		for (; done < length && ReadFile(file, memory + done, (DWORD)(length - done), &n, nullptr) && n; done += n);
+	if (view < reserved)
+	{
+		DWORD protect;
+		VirtualProtect(memory + view, reserved - view, PAGE_READONLY, &protect);
+	}
+	loaded = (unsigned int)done;
+	CloseHandle(file);
+#else
+	const int file = open(path, O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) != 0)
+	{
+		std::cout << path << " cannot be read!\n";
+		if (file >= 0) close(file);
+		return;
+	}
+
+	const size_t length = std::min((size_t)info.st_size, (size_t)size);
+	if ((size_t)info.st_size > size) std::cout << path << " is larger than " << name << ", it is truncated\n";
+
+	// The contents of a previous file are replaced by zero pages, then the file is mapped at the same
+	// address (the memory map keeps pointers to it). The previous file stays if the pages cannot be replaced.
+	if (mmap(memory, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+	{
+		std::cout << path << " cannot be mapped!\n";
+		close(file);
+		return;
+	}
+	if (length && mmap(memory, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0) == MAP_FAILED)
+	{
+		// Files that cannot be mapped (pipes, some network file systems) are read
+		mprotect(memory, length, PROT_READ | PROT_WRITE);
+		size_t done = 0;
+		for (ssize_t n; done < length && (n = read(file, memory + done, length - done)) > 0; done += n);
+		mprotect(memory, length, PROT_READ);
+		loaded = (unsigned int)done;
+	}
+	else
+	{
+		// Reads the file ahead in the background
+		if (length) madvise(memory, length, MADV_WILLNEED);
+		loaded = (unsigned int)length;
+	}
+	close(file);
+#endif
+}
+
+void ROM::loadData(const unsigned int offset, const void* data, const unsigned int length)
+{
+	if (offset >= size) return;
+	const unsigned int end = std::min(offset + length, size);
+
+#ifdef _WIN32
+	// The file view is read-only, only the committed pages after it can be written
+	if (offset < view) return;
+	DWORD protect;
+	VirtualProtect(memory + offset, end - offset, PAGE_READWRITE, &protect);
+	std::memcpy(memory + offset, data, end - offset);
+	VirtualProtect(memory + offset, end - offset, PAGE_READONLY, &protect);
+#else
+	mprotect(memory, end, PROT_READ | PROT_WRITE);
+	std::memcpy(memory + offset, data, end - offset);
+	mprotect(memory, end, PROT_READ);
+#endif
+}
@@ -4,6 +4,10 @@
 #define MEMORY_MAP_H
 
 #include "core.h"
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <cstring>
 
 class MemoryComp
 {
@@ -19,9 +23,10 @@ public:
 	unsigned int cs_mask;
 	unsigned int mask;
 
-	MemoryComp(const char* nm, unsigned int add, unsigned int sz) : name(nm), address(add), size(sz), sub_mem(false)
+	// Components that provide their own memory (mapped files) do not allocate it
+	MemoryComp(const char* nm, unsigned int add, unsigned int sz, const bool allocate = true) : name(nm), address(add), size(sz), sub_mem(false)
 	{
-		memory = new unsigned char[size];
+		memory = allocate ? new unsigned char[size]() : nullptr; // Machines start from the same state
 
 		if (size == 0) exit(-1); // Size cannot be 0
 
@@ -30,22 +35,34 @@ public:
 			if ((sz & 0xFFFFFFFE) && (sz & 1))
 				sub_mem = true;
 
+		if (sub_mem) bits++; // The mask covers the whole capacity, decodes() stops at its end
 		mask = arc::ipow(2, bits) - 1; // Determines mask applied to the memory
 		cs_mask = ~mask;
 		cs = address & cs_mask; // Determines mask applied to the memory
 	}
 
-	~MemoryComp() { delete[] memory; }
+	virtual ~MemoryComp() { delete[] memory; }
 
+	// Accesses go through the page table of the map, which resolves the mirrors when pages are decoded
 	unsigned char* getPointer(const unsigned int ptr) 
 	{ 
 		return memory + (ptr & mask); 
 	}
 
+	// Addresses from cs to the end of the capacity
+	bool decodes(const unsigned int ptr) const { return (ptr & cs_mask) == cs && (ptr & mask) < size; }
+
 	const char* getName() const { return name; }
 	unsigned int getCapacity() const { return size; }
 	unsigned int getAddress() const { return address; }
-
+	unsigned char* getData() { return memory; }
+
+	// Read-only components are not part of save states
+	virtual bool isReadOnly() const { return false; }
+	// IO components (IOComp) handle their own accesses
+	virtual bool isIO() const { return false; }
+	// Mirrors (Mirror) repeat other addresses and have no memory
+	virtual bool isMirror() const { return false; }
 	virtual void update() {};
 	virtual void printDescription() {
 		std::cout << "\n--- " << name << " ---\n";
@@ -53,28 +70,40 @@ public:
 	}
 };
 
-constexpr unsigned int BUFFER_SIZE = 16777216; // 16 MB
+/**
+ * @brief Read-only memory backed by a cartridge file.
+ * The address range is reserved without being touched (unused space reads 0), then the file is
+ * mapped over it, so instances loading the same file share its pages. The pages are mapped
+ * read-only and the memory map drops the stores to them.
+*/
 class ROM : public MemoryComp
 {
-public:
-	ROM(const char* nm, unsigned int add, unsigned int sz) : MemoryComp(nm, add, sz) {  }
+	unsigned int loaded = 0; // Bytes of the file in the component
+#ifdef _WIN32
+	unsigned int view = 0; // Bytes of the file mapped as a view, the pages after it are committed separately
+#endif
 
-	void loadROM(const char* path)
-	{
-		std::cout << "\nLOADING " << path << std::endl;
-		std::ifstream stream;
-		stream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-		try
-		{
-			stream.open(path, std::ios::in | std::ios::binary);
-			stream.read((char*)memory, BUFFER_SIZE);
-			stream.close();
-		}
-		catch (std::ifstream::failure e) { std::cout << path << " cannot be read!\n"; }
-	}
+public:
+	ROM(const char* nm, unsigned int add, unsigned int sz);
+	~ROM();
+
+	/**
+	 * @brief Loads a file at the start of the component, files larger than the component are truncated
+	 * @param path - path of the file
+	*/
+	void loadROM(const char* path);
+
+	/**
+	 * @brief Copies data into the component (boot code), its pages are only writable during the copy
+	 * @param offset - first byte written
+	 * @param data - data copied
+	 * @param length - size of the data in bytes
+	*/
+	void loadData(const unsigned int offset, const void* data, const unsigned int length);
 
 	const unsigned char* getROM() const { return memory; }
+	unsigned int getLoadedSize() const { return loaded; }
+	bool isReadOnly() const override { return true; }
 
 	virtual void printDescription() override {
 		std::cout << "\n--- " << name << " ---\n";
@@ -95,9 +124,38 @@ public:
 	}
 };
 
+/**
+ * @brief Address range that repeats the memory of the components added before it.
+ * The map decodes its pages to the pages it repeats, so accesses through a mirror cost the same
+ * as accesses to the memory. The address and size must be aligned to a power of 2.
+ * A mirror that covers whole 16 MB regions shares the page table of the region it repeats,
+ * which then also repeats the components added to that region after the mirror.
+*/
 class Mirror : public MemoryComp {
+	const unsigned int source;
+	const unsigned int period;
+
 public:
-	Mirror(const char* nm, unsigned int add, unsigned int sz) : MemoryComp(nm, add, sz) { }
+	/**
+	 * @param nm - name of the mirror
+	 * @param add - first address of the mirror
+	 * @param sz - size of the mirror
+	 * @param src - first repeated address
+	 * @param per - size of the repeated range
+	*/
+	Mirror(const char* nm, unsigned int add, unsigned int sz, unsigned int src, unsigned int per) : MemoryComp(nm, add, sz, false),
+		source(src), period(per) { }
+
+	// Repeated address of an address of the mirror
+	unsigned int resolve(const unsigned int ptr) const { return source + (ptr - cs) % period; }
+	unsigned int getPeriod() const { return period; }
+	bool isMirror() const override { return true; }
+
+	virtual void printDescription() override {
+		std::cout << "\n--- " << name << " ---\n";
+		std::cout << "ADDRESS: 0x" << std::hex << address << std::endl;
+		std::cout << "REPEATS: 0x" << source << " (" << std::dec << period / 1024 << "KB)\n";
+	}
 };
 
 class IOPort8 : public MemoryComp{
@@ -106,36 +164,251 @@ public:
 };
 
 class IOPort16: public MemoryComp{
-	unsigned short value;
 public:
-	IOPort16(const char* nm, unsigned int add) : MemoryComp(nm, add, 2) { value = 0; }
+	IOPort16(const char* nm, unsigned int add) : MemoryComp(nm, add, 2) {}
 };
 
 class IOPort32 : public MemoryComp{
-	unsigned int value;
 public:
-	IOPort32(const char* nm, unsigned int add) : MemoryComp(nm, add, 4) { value = 0; }
+	IOPort32(const char* nm, unsigned int add) : MemoryComp(nm, add, 4) {}
+};
+
+/**
+ * @brief Component that handles its own accesses (IO registers with side effects).
+ * The map routes the accesses of the pages it decodes whole through read and write,
+ * getPointer still returns its memory.
+*/
+class IOComp : public MemoryComp
+{
+public:
+	IOComp(const char* nm, unsigned int add, unsigned int sz) : MemoryComp(nm, add, sz) {}
+
+	/**
+	 * @brief Reads an aligned value
+	 * @param address - address of the value
+	 * @param width - bytes read (1, 2 or 4)
+	 * @return value
+	*/
+	virtual unsigned int read(const unsigned int address, const unsigned int width) = 0;
+
+	/**
+	 * @brief Writes an aligned value
+	 * @param address - address of the value
+	 * @param value - value written
+	 * @param width - bytes written (1, 2 or 4)
+	*/
+	virtual void write(const unsigned int address, const unsigned int value, const unsigned int width) = 0;
+
+	bool isIO() const override { return true; }
+};
+
+// Receives a notification when a watched page is written
+class PageWatcher
+{
+public:
+	virtual void pageWritten(const unsigned int page) = 0;
 };
 
+// Receives every write to the IO register pages
+class IOHandler
+{
+public:
+	/**
+	 * @brief Handles a write after the memory was updated
+	 * @param address - first written byte (aligned to the width)
+	 * @param width - bytes written
+	*/
+	virtual void ioWritten(const unsigned int address, const unsigned int width) = 0;
+};
+
+// Page of a memory component, shared by every snapshot that did not change it
+typedef std::shared_ptr<const std::vector<unsigned char>> SavedPage;
+
+/**
+ * @brief Copy-on-write snapshot of the writable memory components of a MemoryMap.
+ * Components of at least a page are split into pages, the smaller ones (IO registers) are copied whole.
+*/
+struct MemorySnapshot
+{
+	std::vector<SavedPage> pages;		// Pages of the paged components
+	std::vector<unsigned char> small;	// Contents of the small components, in map order
+};
+
+// Page flags of the address space
+constexpr unsigned char PAGE_WATCHED = 1;	// Notifies the watcher when written
+constexpr unsigned char PAGE_DIRTY = 2;		// Written since the last snapshot was taken or restored
+constexpr unsigned char PAGE_IO = 4;		// Notifies the IO handler of every write
+constexpr unsigned char PAGE_MIRROR = 8;	// Decoded through a mirror, its writes change the repeated page
+
 class MemoryMap {
 private:
+	// Host memory of an address page: the memory of the component that decodes all of it,
+	// the IO component that handles its accesses, or a pointer per byte when it is shared
+	// by several components or partly unmapped
+	struct PageEntry
+	{
+		unsigned char* host;			// nullptr for the other pages
+		unsigned char* const* bytes;	// Pointers read, then pointers written (defmem for read-only bytes)
+		IOComp* io;
+		bool read_only;					// Stores to the host memory are dropped
+		unsigned int source;			// Page its writes change (the repeated page of a mirrored page)
+	};
+
+	// Page table of a 16 MB region (top address byte), a mirror that covers the region shares the table it repeats
+	struct Region
+	{
+		const PageEntry* pages;	// Table of the source region
+		unsigned int count;		// Pages decoded, the pages after them are unmapped
+		unsigned int mask;		// Index of the repeated page in the table
+		unsigned int source;	// Region whose table is used
+	};
+
+	// Writable component split into snapshot pages
+	struct PagedComp
+	{
+		MemoryComp* comp;
+		unsigned int first;	// Index of its first page in MemorySnapshot::pages
+	};
+
 	std::vector<MemoryComp*> map;
+	std::vector<unsigned char> page_flags;
+	std::vector<unsigned int> dirty_pages;	// Address pages with PAGE_DIRTY set
+	PageWatcher* watcher;
+	IOHandler* io_handler;
+	std::vector<PagedComp> paged;			// Sorted by address
+	std::vector<MemoryComp*> small;
+	unsigned int num_pages;					// Snapshot pages of the paged components
+	std::shared_ptr<const MemorySnapshot> base; // Snapshot the memory matched when the dirty pages were cleared
+	std::vector<PageEntry> tables[256];		// Decoded pages of each 16 MB region (top address byte)
+	Region regions[256];
+	std::vector<std::unique_ptr<unsigned char*[]>> byte_tables; // Pointers per byte of the pages decoded by bytes
+	std::unique_ptr<unsigned char*[]> unmapped;	// Every byte of an unmapped page reads defmem
+	unsigned long long live_reads;	// Reads of values that change without a write or an event
 	unsigned char* defmem;
 	unsigned char bits;
 	unsigned int address_mask;
 	unsigned int size;
 
+	void pageWrite(unsigned int page, const unsigned int address, const unsigned int width)
+	{
+		page = getSourcePage(page);
+		if (!(page_flags[page] & PAGE_DIRTY))
+		{
+			page_flags[page] |= PAGE_DIRTY;
+			dirty_pages.push_back(page);
+		}
+		if (page_flags[page] & PAGE_WATCHED) watcher->pageWritten(page);
+		if (page_flags[page] & PAGE_IO) io_handler->ioWritten(address, width);
+	}
+
+	// Index of the first of the components from first to count that decodes an address, count if none does
+	size_t findComp(const unsigned int ptr, const size_t first, const size_t count) const
+	{
+		size_t i = first;
+		while (i < count && !map[i]->decodes(ptr)) i++;
+		return i;
+	}
+
+	// Memory of an address in the first of the first count components that decodes it,
+	// mirrors repeat the components added before them. Read-only memory is not written.
+	unsigned char* decode(const unsigned int ptr, const size_t count, const bool write = false)
+	{
+		const size_t i = findComp(ptr, 0, count);
+		if (i == count) return defmem;
+		if (map[i]->isMirror()) return decode(static_cast<Mirror*>(map[i])->resolve(ptr), i, write);
+		return write && map[i]->isReadOnly() ? defmem : map[i]->getPointer(ptr);
+	}
+
+	// Address a mirrored address repeats, other addresses are returned as they are
+	unsigned int resolve(const unsigned int ptr, const size_t count) const
+	{
+		const size_t i = findComp(ptr, 0, count);
+		return i < count && map[i]->isMirror() ? resolve(static_cast<const Mirror*>(map[i])->resolve(ptr), i) : ptr;
+	}
+
+	// Decoded through a mirror by the components from first to the last one
+	bool isMirrored(const unsigned int ptr, const size_t first) const
+	{
+		const size_t i = findComp(ptr, first, map.size());
+		return i < map.size() && map[i]->isMirror();
+	}
+
+	inline const PageEntry* findPage(const unsigned int ptr) const
+	{
+		const Region& region = regions[ptr >> 24];
+		const unsigned int page = (ptr & 0xFFFFFF) >> PAGE_BITS;
+		return page < region.count ? &region.pages[page & region.mask] : nullptr;
+	}
+
+	// Aligned access, pages of one component are accessed in place or by their IO component,
+	// the others byte by byte so an access can span several components, unmapped bytes read 0
+	template <typename T>
+	inline T read(const unsigned int address) const
+	{
+		const PageEntry* entry = findPage(address);
+		const unsigned int offset = address & (PAGE_SIZE - 1);
+		if (entry && entry->host) return *(const T*)(entry->host + offset);
+
+		T value = 0;
+		if (entry && entry->io)
+			value = (T)entry->io->read(address, sizeof(T));
+		else if (entry)
+			for (unsigned int i = 0; i < sizeof(T); i++)
+				if (entry->bytes[offset + i] != defmem) value |= (T)(*entry->bytes[offset + i] << (i << 3));
+		return value;
+	}
+
+	// Unmapped and read-only bytes are not written, the IO handler receives the whole access
+	template <typename T>
+	inline void write(const unsigned int address, const T value)
+	{
+		const PageEntry* entry = findPage(address);
+		if (!entry || entry->read_only) return;
+
+		const unsigned int offset = address & (PAGE_SIZE - 1);
+		if (entry->host)
+			*(T*)(entry->host + offset) = value;
+		else if (entry->io)
+			entry->io->write(address, value, sizeof(T));
+		else
+			for (unsigned int i = 0; i < sizeof(T); i++)
+				if (entry->bytes[PAGE_SIZE + offset + i] != defmem) *entry->bytes[PAGE_SIZE + offset + i] = (unsigned char)(value >> (i << 3));
+		notifyWrite(address, sizeof(T));
+	}
+
+	// Pages of a region repeated by a mirror are not decoded, the components added after the mirror are hidden
+	bool isRepeated(const unsigned int region) const
+	{
+		return regions[region].source != region || regions[region].mask != REGION_PAGES - 1;
+	}
+
+	void growRegion(const unsigned int region, const size_t pages);
+	bool repeatRegion(const Mirror* mirror, const unsigned int region);
+	void decodePage(const unsigned int base);
+	bool decodeWhole(const unsigned int base, const size_t first, const size_t count, PageEntry& entry);
+	void buildPageLayout();
+	void markSnapshotPages(std::vector<unsigned char>& marks) const;
+	void clearDirty();
+
 public:
-	MemoryMap(unsigned int b) : bits(b)
+	static constexpr unsigned int PAGE_BITS = 10; // 1 KB pages
+	static constexpr unsigned int PAGE_SIZE = 1 << PAGE_BITS;
+	static constexpr unsigned int REGION_PAGES = 1 << (24 - PAGE_BITS);
+
+	MemoryMap(unsigned int b) : watcher(nullptr), io_handler(nullptr), num_pages(0), live_reads(0), bits(b)
 	{
-		defmem = new unsigned char;
+		defmem = new unsigned char[4](); // Large enough for a word access
+		unmapped.reset(new unsigned char*[PAGE_SIZE * 2]);
+		std::fill(unmapped.get(), unmapped.get() + PAGE_SIZE * 2, defmem);
 		size = arc::ipow(2, b);
 		address_mask = size - 1;
+		page_flags.resize((size >> PAGE_BITS) + 1, 0);
+		for (unsigned int i = 0; i < 256; i++)
+			regions[i] = { nullptr, 0, REGION_PAGES - 1, i };
 	}
-
 	~MemoryMap()
 	{
-		delete defmem;
+		delete[] defmem;
 		for (unsigned int i = 0; i < map.size(); i++)
 			delete map[i];
 	}
@@ -143,6 +416,19 @@ public:
 	void addComponent(MemoryComp* comp)
 	{
 		map.push_back(comp);
+
+		// Only the pages the component decodes can change
+		const unsigned long long last = (unsigned long long)comp->cs + comp->getCapacity() - 1;
+		for (unsigned int region = comp->cs >> 24; region <= last >> 24; region++)
+		{
+			if (isRepeated(region) || (comp->isMirror() && repeatRegion(static_cast<Mirror*>(comp), region))) continue;
+
+			// Regions grow once to the end of the component
+			const unsigned long long end = std::min(last, ((unsigned long long)region << 24) | 0xFFFFFF);
+			growRegion(region, (end & 0xFFFFFF) / PAGE_SIZE + 1);
+			for (unsigned long long page = std::max((unsigned long long)comp->cs, (unsigned long long)region << 24) & ~(PAGE_SIZE - 1); page <= end; page += PAGE_SIZE)
+				decodePage((unsigned int)page);
+		}
 	}
 
 	void printDescription() {
@@ -174,23 +460,389 @@ public:
 		}
 	}
 
+	unsigned int getPage(const unsigned int address) const { return (address & address_mask) >> PAGE_BITS; }
+
+	// Page of the memory an address page decodes to (the repeated page of a mirrored page)
+	unsigned int getSourcePage(const unsigned int page) const
+	{
+		return page_flags[page] & PAGE_MIRROR ? findPage(page << PAGE_BITS)->source : page;
+	}
+	void setWatcher(PageWatcher* w) { watcher = w; }
+	void watchPage(const unsigned int page, const bool watch)
+	{
+		page_flags[page] = watch ? page_flags[page] | PAGE_WATCHED : page_flags[page] & ~PAGE_WATCHED;
+	}
+
+	/**
+	 * @brief Sends the writes to the pages of an address range to an IO handler
+	 * @param handler - receives the writes
+	 * @param first - first address of the range
+	 * @param last - last address of the range
+	*/
+	void setIOHandler(IOHandler* handler, const unsigned int first, const unsigned int last)
+	{
+		io_handler = handler;
+		for (unsigned int page = getPage(first); page <= getPage(last); page++)
+			page_flags[page] |= PAGE_IO;
+	}
+
+	// Must be called after writing to memory
+	inline void notifyWrite(const unsigned int address, const unsigned int width = 1)
+	{
+		const unsigned int page = getPage(address);
+		if (page_flags[page] != PAGE_DIRTY) pageWrite(page, address, width);
+	}
+
+	// Must be called after writing to a range returned by getRange
+	inline void notifyRange(const unsigned int address, const unsigned int size)
+	{
+		for (unsigned int page = getPage(address); page <= getPage(address + size - 1); page++)
+			if (page_flags[page] != PAGE_DIRTY) pageWrite(page, address, size);
+	}
+
+	/**
+	 * @brief Finds the host memory of an address range, for accesses that move it at once
+	 * @param address - first address of the range
+	 * @param size - size of the range in bytes
+	 * @param write - the range is written
+	 * @return pointer to the first byte, nullptr if the range is not contiguous in one component,
+	 * has IO pages or is written and read-only
+	*/
+	unsigned char* getRange(const unsigned int address, const unsigned int size, const bool write = false)
+	{
+		const PageEntry* entry = findPage(address);
+		if (!entry || !entry->host || (write && entry->read_only)) return nullptr;
+
+		// Following pages must continue the host memory of the first one
+		unsigned char* const host = entry->host;
+		for (unsigned int page = 1; page <= ((address & (PAGE_SIZE - 1)) + size - 1) >> PAGE_BITS; page++)
+		{
+			const PageEntry* next = findPage(address + (page << PAGE_BITS));
+			if (!next || next->host != host + (page << PAGE_BITS)) return nullptr;
+		}
+
+		for (unsigned int page = getPage(address); page <= getPage(address + size - 1); page++)
+			if (page_flags[page] & PAGE_IO) return nullptr;
+		return host + (address & (PAGE_SIZE - 1));
+	}
+
+	/**
+	 * @brief Takes a snapshot of the writable components, only the pages written since
+	 * the previous snapshot (or restore) are copied, the others are shared with it
+	 * @return snapshot
+	*/
+	std::shared_ptr<const MemorySnapshot> saveSnapshot();
+
+	/**
+	 * @brief Restores a snapshot taken from this map (or one with the same components),
+	 * only the pages that were written or differ from the previous snapshot are copied
+	 * @param snapshot - snapshot to restore
+	*/
+	void loadSnapshot(const std::shared_ptr<const MemorySnapshot>& snapshot);
+
+	// Counts a read of a value that changes without a write or an event (a running timer),
+	// an idle loop that polls it cannot be skipped
+	void countLiveRead() { live_reads++; }
+	unsigned long long getLiveReads() const { return live_reads; }
+
+	unsigned int getDirtyPageCount() const { return (unsigned int)dirty_pages.size(); }
+
 	//unsigned char* getPointer(const unsigned int ptr) { return memory + (ptr & address_mask); }
 
-	unsigned char* getPointer(const unsigned int ptr) 
-	{ 
-		for(unsigned int i = 0; i < map.size(); i++)
-			if((ptr & map[i]->cs_mask) == map[i]->cs)
-				return map[i]->getPointer(ptr); 
-		return defmem;
+	unsigned char* getPointer(const unsigned int ptr)
+	{
+		const PageEntry* entry = findPage(ptr);
+		if (!entry) return defmem;
+		const unsigned int offset = ptr & (PAGE_SIZE - 1);
+		if (entry->host) return entry->host + offset;
+		return entry->io ? entry->io->getPointer(ptr) : entry->bytes[offset];
+	}
+
+	// Memory that a store to an address changes, nullptr for read-only and unmapped bytes
+	unsigned char* getWritePointer(const unsigned int ptr)
+	{
+		const PageEntry* entry = findPage(ptr);
+		if (!entry || entry->read_only) return nullptr;
+		const unsigned int offset = ptr & (PAGE_SIZE - 1);
+		if (entry->host) return entry->host + offset;
+		if (entry->io) return entry->io->getPointer(ptr);
+		return entry->bytes[PAGE_SIZE + offset] != defmem ? entry->bytes[PAGE_SIZE + offset] : nullptr;
 	}
 
 	unsigned int readInt(const unsigned int address)
 	{
-		for (unsigned int i = 0; i < map.size(); i++)
-			if ((address & map[i]->cs_mask) == map[i]->cs)
-				return *((unsigned int*)map[i]->getPointer(address));
-		return 0;
+		const unsigned char* p = getPointer(address);
+		return p == defmem ? 0 : *((const unsigned int*)p);
+	}
+
+	// Bus accesses are aligned to their width, unaligned reads are rotated as on the ARM7TDMI bus
+	inline unsigned int read32(const unsigned int address)
+	{
+		return std::rotr(read<unsigned int>(address & ~3), (address & 3) << 3);
+	}
+
+	inline unsigned int read16(const unsigned int address)
+	{
+		return std::rotr((unsigned int)read<unsigned short>(address & ~1), (address & 1) << 3);
+	}
+
+	inline unsigned int read8(const unsigned int address)
+	{
+		return read<unsigned char>(address);
+	}
+
+	inline void write32(const unsigned int address, const unsigned int value)
+	{
+		write<unsigned int>(address & ~3, value);
+	}
+
+	inline void write16(const unsigned int address, const unsigned int value)
+	{
+		write<unsigned short>(address & ~1, (unsigned short)value);
+	}
+
+	inline void write8(const unsigned int address, const unsigned int value)
+	{
+		write<unsigned char>(address, (unsigned char)value);
 	}
 };
 
+// Grows the table of a region, the regions that repeat it follow the new entries
+inline void MemoryMap::growRegion(const unsigned int region, const size_t pages)
+{
+	std::vector<PageEntry>& table = tables[region];
+	if (table.size() >= pages) return;
+	table.resize(pages, { nullptr, unmapped.get(), nullptr, false, 0 });
+	for (Region& r : regions)
+		if (r.source == region) r.pages = table.data();
+	if (!isRepeated(region)) regions[region].count = (unsigned int)pages;
+}
+
+// Shares the table of the region a mirror repeats when the mirror covers the whole region, repeats
+// a power of 2 of whole pages from the start of a region and the components added before it do not
+// decode the pages that repeat (the other mirrors decode each page)
+inline bool MemoryMap::repeatRegion(const Mirror* mirror, const unsigned int region)
+{
+	const unsigned long long base = (unsigned long long)region << 24;
+	const unsigned long long end = (unsigned long long)mirror->cs + mirror->getCapacity() - 1;
+	if (mirror->cs > base || end < (base | 0xFFFFFF)) return false;
+
+	const unsigned int period = mirror->getPeriod();
+	const unsigned int source = mirror->resolve((unsigned int)base);
+	const unsigned int repeated = source >> 24;
+	if ((source & 0xFFFFFF) || period < PAGE_SIZE || (period & (std::min(period, 0x1000000u) - 1)) || regions[repeated].source != repeated)
+		return false;
+
+	// A region that repeats its own first pages is repeated with them
+	const unsigned int pages = std::min(std::min(period, 0x1000000u) >> PAGE_BITS, regions[repeated].mask + 1);
+	const std::vector<PageEntry>& own = tables[region];
+	for (size_t i = repeated == region ? pages : 0; i < own.size(); i++)
+		if (own[i].bytes != unmapped.get()) return false;
+
+	// The repeated pages are unmapped up to the period
+	growRegion(repeated, pages);
+	regions[region] = { tables[repeated].data(), REGION_PAGES, pages - 1, repeated };
+
+	// Writes through the mirror are notified to the page it repeats
+	const std::vector<PageEntry>& table = tables[repeated];
+	for (unsigned int i = 0; i < REGION_PAGES; i++)
+	{
+		const PageEntry& entry = table[i & (pages - 1)];
+		const unsigned int page = getPage((unsigned int)base + (i << PAGE_BITS));
+		if (entry.bytes != unmapped.get() && entry.source != page) page_flags[page] |= PAGE_MIRROR;
+	}
+	return true;
+}
+
+// Finds the memory of every byte of a page again, after a component decoding it was added
+inline void MemoryMap::decodePage(const unsigned int base)
+{
+	PageEntry& entry = tables[base >> 24][(base & 0xFFFFFF) >> PAGE_BITS];
+
+	// A page that was never decoded does not overlap the components added before the last one
+	const size_t first = entry.bytes == unmapped.get() ? map.size() - 1 : 0;
+
+	// Writes through a mirror are notified to the page it repeats
+	const size_t comp = findComp(base, first, map.size());
+	bool mirrored = comp < map.size() && map[comp]->isMirror();
+	if (!decodeWhole(base, first, map.size(), entry))
+	{
+		// Shared or partly mapped page, its table is kept when it is decoded again
+		unsigned char** bytes = const_cast<unsigned char**>(entry.bytes);
+		if (!bytes || bytes == unmapped.get())
+		{
+			byte_tables.emplace_back(new unsigned char*[PAGE_SIZE * 2]);
+			bytes = byte_tables.back().get();
+		}
+		for (unsigned int i = 0; i < PAGE_SIZE; i++)
+		{
+			bytes[i] = decode(base + i, map.size());
+			bytes[PAGE_SIZE + i] = decode(base + i, map.size(), true);
+			mirrored = mirrored || isMirrored(base + i, 0);
+		}
+		// Pages mirrored by some of their bytes search the components for the repeated page
+		entry = { nullptr, bytes, nullptr, false, getPage(mirrored ? resolve(base, map.size()) : base) };
+	}
+
+	// The repeated page is found once, writes through the mirror look it up
+	const unsigned int page = getPage(base);
+	page_flags[page] = mirrored ? page_flags[page] | PAGE_MIRROR : page_flags[page] & ~PAGE_MIRROR;
+}
+
+// Decodes a page with the components from first to count when the first of them that overlaps it covers it,
+// a mirror takes the entry of the page it repeats
+inline bool MemoryMap::decodeWhole(const unsigned int base, const size_t first, const size_t count, PageEntry& entry)
+{
+	const unsigned int last = base + PAGE_SIZE - 1;
+	for (size_t i = first; i < count; i++)
+	{
+		MemoryComp* comp = map[i];
+		const unsigned int end = comp->cs + comp->getCapacity() - 1;
+		if (end < base || comp->cs > last) continue;
+		if (comp->cs > base || end < last) return false;
+
+		if (comp->isMirror())
+		{
+			// The repeated range must continue for the whole page
+			const Mirror* mirror = static_cast<const Mirror*>(comp);
+			const unsigned int source = mirror->resolve(base);
+			if ((source & (PAGE_SIZE - 1)) || (mirror->getPeriod() & (PAGE_SIZE - 1))) return false;
+
+			// Pages decoded whole keep their entry when components are added
+			const PageEntry* repeated = findPage(source);
+			if (repeated && (repeated->host || repeated->io))
+			{
+				entry = *repeated;
+				return true;
+			}
+			return decodeWhole(source, 0, i, entry);
+		}
+		if (comp->isIO()) entry = { nullptr, nullptr, static_cast<IOComp*>(comp), false, getPage(base) };
+		else entry = { comp->getPointer(base), nullptr, nullptr, comp->isReadOnly(), getPage(base) };
+		return true;
+	}
+	return false;
+}
+
+inline void MemoryMap::buildPageLayout()
+{
+	paged.clear();
+	small.clear();
+	num_pages = 0;
+
+	for (MemoryComp* comp : map)
+	{
+		// Mirrors have no memory of their own
+		if (comp->isReadOnly() || comp->isMirror()) continue;
+
+		// IO components change without bus writes, they are copied whole
+		if (comp->getCapacity() >= PAGE_SIZE && !comp->isIO())
+		{
+			paged.push_back({ comp, num_pages });
+			num_pages += (comp->getCapacity() + PAGE_SIZE - 1) >> PAGE_BITS;
+		}
+		else
+			small.push_back(comp);
+	}
+}
+
+// Marks the snapshot pages that overlap the dirty address pages
+inline void MemoryMap::markSnapshotPages(std::vector<unsigned char>& marks) const
+{
+	for (const unsigned int page : dirty_pages)
+	{
+		const unsigned int start = page << PAGE_BITS;
+		const unsigned int end = start + PAGE_SIZE;
+
+		for (const PagedComp& p : paged)
+		{
+			const unsigned int address = p.comp->getAddress() & address_mask;
+			const unsigned int limit = address + p.comp->getCapacity();
+			if (end <= address || start >= limit) continue;
+
+			const unsigned int first = (std::max(start, address) - address) >> PAGE_BITS;
+			const unsigned int last = (std::min(end, limit) - 1 - address) >> PAGE_BITS;
+			for (unsigned int k = first; k <= last; k++)
+				marks[p.first + k] = 1;
+		}
+	}
+}
+
+inline void MemoryMap::clearDirty()
+{
+	for (const unsigned int page : dirty_pages)
+		page_flags[page] &= ~PAGE_DIRTY;
+	dirty_pages.clear();
+}
+
+inline std::shared_ptr<const MemorySnapshot> MemoryMap::saveSnapshot()
+{
+	if (!base) buildPageLayout();
+
+	MemorySnapshot* snapshot = new MemorySnapshot();
+	std::vector<unsigned char> marks(num_pages, base ? 0 : 1);
+
+	// Unchanged pages are shared with the previous snapshot
+	if (base) snapshot->pages = base->pages;
+	else snapshot->pages.resize(num_pages);
+	markSnapshotPages(marks);
+
+	for (const PagedComp& p : paged)
+	{
+		const unsigned int capacity = p.comp->getCapacity();
+		for (unsigned int offset = 0, k = p.first; offset < capacity; offset += PAGE_SIZE, k++)
+		{
+			if (!marks[k]) continue;
+			const unsigned char* data = p.comp->getData() + offset;
+			snapshot->pages[k] = std::make_shared<const std::vector<unsigned char>>(data, data + std::min(PAGE_SIZE, capacity - offset));
+		}
+	}
+
+	for (MemoryComp* comp : small)
+		snapshot->small.insert(snapshot->small.end(), comp->getData(), comp->getData() + comp->getCapacity());
+
+	base.reset(snapshot);
+	clearDirty();
+	return base;
+}
+
+inline void MemoryMap::loadSnapshot(const std::shared_ptr<const MemorySnapshot>& snapshot)
+{
+	if (!base) buildPageLayout();
+
+	// Pages written since the previous snapshot and pages that differ between the two snapshots
+	std::vector<unsigned char> marks(num_pages, base ? 0 : 1);
+	markSnapshotPages(marks);
+	if (base && base != snapshot)
+		for (unsigned int k = 0; k < num_pages; k++)
+			marks[k] |= base->pages[k] != snapshot->pages[k];
+
+	for (const PagedComp& p : paged)
+	{
+		const unsigned int address = p.comp->getAddress() & address_mask;
+		const unsigned int capacity = p.comp->getCapacity();
+
+		for (unsigned int offset = 0, k = p.first; offset < capacity; offset += PAGE_SIZE, k++)
+		{
+			if (!marks[k]) continue;
+			const std::vector<unsigned char>& page = *snapshot->pages[k];
+			std::memcpy(p.comp->getData() + offset, page.data(), page.size());
+
+			// Code decoded from the page is stale
+			for (unsigned int a = getPage(address + offset); a <= getPage(address + offset + (unsigned int)page.size() - 1); a++)
+				if (page_flags[a] & PAGE_WATCHED) watcher->pageWritten(a);
+		}
+	}
+
+	const unsigned char* data = snapshot->small.data();
+	for (MemoryComp* comp : small)
+	{
+		std::memcpy(comp->getData(), data, comp->getCapacity());
+		data += comp->getCapacity();
+	}
+
+	base = snapshot;
+	clearDirty();
+}
+
 #endif
\ No newline at end of file
@@ -16,6 +16,7 @@ protected:
 	unsigned int* r;
 	unsigned int num_reg;
 	unsigned long clock_time;
+	unsigned long long cycles; // Number of elapsed clock cycles
 
 	// Helper for removing characters from strings
 	void remove(std::string& s, char c)
@@ -75,13 +76,13 @@ protected:
 
 public:
 	Processor(unsigned char b, unsigned long clock, unsigned int regs)
-		: bits(b), num_reg(regs), clock_time(clock), mem_map(new MemoryMap(0))
+		: mem_map(new MemoryMap(0)), bits(b), num_reg(regs), clock_time(clock), cycles(0)
 	{
 		instructions = nullptr;
-		r = new unsigned int[num_reg];
+		r = new unsigned int[num_reg]();
 	}
 
-	void setMemoryMap(MemoryMap* map)
+	virtual void setMemoryMap(MemoryMap* map)
 	{
 		delete mem_map;
 		mem_map = map;
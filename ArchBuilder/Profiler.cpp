@@ -0,0 +1,75 @@
+#include "Profiler.h"
+#include "ARM7.h"
+#include <algorithm>
+#include <iomanip>
+
+void Profiler::reset(const unsigned int log2_size)
+{
+	table.assign(1ULL << log2_size, { EMPTY, 0, 0, 0, 0 });
+	used = 0;
+	shift = 32 - log2_size;
+}
+
+// Doubles the table and inserts the blocks again
+void Profiler::grow()
+{
+	std::vector<BlockProfile> old;
+	old.swap(table);
+	reset(33 - shift);
+
+	const unsigned int mask = (unsigned int)table.size() - 1;
+	for (const BlockProfile& p : old)
+	{
+		if (p.pc == EMPTY) continue;
+
+		unsigned int i = slot(p.pc);
+		while (table[i].pc != EMPTY) i = (i + 1) & mask;
+		table[i] = p;
+		used++;
+	}
+}
+
+std::vector<BlockProfile> Profiler::getBlocks() const
+{
+	std::vector<BlockProfile> blocks;
+	blocks.reserve(used);
+	for (const BlockProfile& p : table)
+		if (p.pc != EMPTY) blocks.push_back(p);
+
+	std::sort(blocks.begin(), blocks.end(), [](const BlockProfile& a, const BlockProfile& b) { return a.cycles > b.cycles; });
+	return blocks;
+}
+
+unsigned long long Profiler::getTotalCycles() const
+{
+	unsigned long long total = 0;
+	for (const BlockProfile& p : table)
+		if (p.pc != EMPTY) total += p.cycles;
+	return total;
+}
+
+void Profiler::print(ARM7TDMI& cpu, MemoryMap& map, std::ostream& out, const unsigned int count) const
+{
+	const std::vector<BlockProfile> blocks = getBlocks();
+	const double total = (double)std::max(1ULL, getTotalCycles());
+	char buffer[arc::HEX_BUFFER_SIZE];
+
+	out << "ADDRESS     EXECUTIONS        CYCLES  CYCLES%  TAKEN%  FIRST INSTRUCTION\n";
+	for (unsigned int i = 0; i < blocks.size() && i < count; i++)
+	{
+		const BlockProfile& p = blocks[i];
+		const bool thumb = p.pc & 1;
+		const unsigned int address = p.pc & ~1;
+
+		unsigned int op = 0;
+		std::memcpy(&op, map.getPointer(address), thumb ? 2 : 4);
+
+		out << arc::toHex(buffer, address, 32) << (thumb ? "T" : " ");
+		out << std::dec << std::setw(13) << p.executions << std::setw(14) << p.cycles;
+		out << std::fixed << std::setprecision(2) << std::setw(9) << 100.0 * p.cycles / total;
+		out << std::setprecision(1) << std::setw(8) << 100.0 * p.taken / p.executions << "  ";
+		out << arc::toHex(buffer, op, thumb ? 16 : 32) << (thumb ? cpu.identify((unsigned short)op) : cpu.identify(op)) << "\n";
+	}
+
+	out << std::dec << blocks.size() << " blocks, " << (unsigned long long)total << " cycles" << std::endl;
+}
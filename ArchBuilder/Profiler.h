@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "MemoryMap.h"
+#include <vector>
+#include <ostream>
+
+// Counters of a block (keyed by its address, bit 0 is set in THUMB state)
+struct BlockProfile
+{
+	unsigned int pc;
+	unsigned int reserved;
+	unsigned long long executions;
+	unsigned long long cycles;	// Cycles spent in the block
+	unsigned long long taken;	// Executions that left the block by a branch (the others fell through)
+};
+
+class ARM7TDMI;
+
+/**
+ * @brief Counting profiler of guest blocks.
+ * The processor updates a flat open addressing table once per executed block,
+ * so it can stay enabled during long runs.
+*/
+class Profiler
+{
+private:
+	static constexpr unsigned int EMPTY = 0xFFFFFFFF;
+
+	std::vector<BlockProfile> table;
+	unsigned int used;
+	unsigned int shift; // 32 - log2 of the table size
+
+	inline unsigned int slot(const unsigned int pc) const
+	{
+		return (pc * 0x9E3779B1u) >> shift;
+	}
+
+	void grow();
+
+public:
+	/**
+	 * @brief Creates an empty profile
+	 * @param log2_size - log2 of the initial number of slots (grows when half full)
+	*/
+	Profiler(const unsigned int log2_size = 12) { reset(log2_size); }
+
+	/**
+	 * @brief Adds an execution of a block
+	 * @param pc - address of the block (bit 0 is set in THUMB state)
+	 * @param cycles - cycles spent in the block
+	 * @param taken - the block ended with a taken branch
+	*/
+	inline void record(const unsigned int pc, const unsigned int cycles, const bool taken)
+	{
+		const unsigned int mask = (unsigned int)table.size() - 1;
+		unsigned int i = slot(pc);
+		while (table[i].pc != pc)
+		{
+			if (table[i].pc == EMPTY)
+			{
+				if (++used * 2 > table.size())
+				{
+					grow();
+					record(pc, cycles, taken);
+					return;
+				}
+				table[i].pc = pc;
+				break;
+			}
+			i = (i + 1) & mask;
+		}
+
+		BlockProfile& p = table[i];
+		p.executions++;
+		p.cycles += cycles;
+		p.taken += taken;
+	}
+
+	void reset(const unsigned int log2_size = 12);
+
+	/**
+	 * @brief Lists the profiled blocks
+	 * @return blocks sorted by cycles, highest first
+	*/
+	std::vector<BlockProfile> getBlocks() const;
+
+	unsigned long long getTotalCycles() const;
+	unsigned int getBlockCount() const { return used; }
+
+	/**
+	 * @brief Prints the hottest blocks with their first instruction
+	 * @param cpu - processor used to identify the opcodes
+	 * @param map - memory the blocks were executed from
+	 * @param out - output text stream
+	 * @param count - number of blocks printed
+	*/
+	void print(ARM7TDMI& cpu, MemoryMap& map, std::ostream& out, const unsigned int count = 32) const;
+};
+
+#endif
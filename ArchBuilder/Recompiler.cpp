@@ -0,0 +1,653 @@
+#include "Recompiler.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace x64;
+
+constexpr size_t ARENA_PAGE_SIZE = 4096; // Protection granularity of the arena
+
+// Code pages are executable and only writable while code is copied into them
+static bool setWritable(void* address, const size_t size, const bool writable)
+{
+#ifdef _WIN32
+	DWORD previous;
+	return VirtualProtect(address, size, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous) != 0;
+#else
+	return mprotect(address, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+x64::CodeArena::CodeArena(const size_t size) : memory(nullptr), capacity(0), used(0)
+{
+#ifdef _WIN32
+	void* ptr = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ);
+#else
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) ptr = nullptr;
+#endif
+
+	if (!ptr)
+	{
+		std::cout << "Error: could not allocate executable memory!" << std::endl;
+		return;
+	}
+
+	memory = (unsigned char*)ptr;
+	capacity = size;
+}
+
+x64::CodeArena::~CodeArena()
+{
+	if (!memory) return;
+
+#ifdef _WIN32
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, capacity);
+#endif
+}
+
+void* x64::CodeArena::place(const Emitter& emitter)
+{
+	const size_t size = (emitter.size() + 15) & ~size_t(15);
+	if (used + size > capacity) return nullptr;
+
+	// Only the pages of the new code are made writable, blocks are never running while one is placed
+	unsigned char* ptr = memory + used;
+	unsigned char* first = memory + (used & ~(ARENA_PAGE_SIZE - 1));
+	const size_t length = ptr + emitter.size() - first;
+	if (!setWritable(first, length, true)) return nullptr;
+	std::memcpy(ptr, emitter.getCode().data(), emitter.size());
+	setWritable(first, length, false);
+
+	used += size;
+	return ptr;
+}
+
+#ifdef ARC_X64
+
+// Callee-saved host registers that guest registers are cached in
+constexpr Reg CACHE_REGS[] = { RBX, RBP, R12, R13, R14 };
+constexpr unsigned int NUM_CACHE_REGS = sizeof(CACHE_REGS) / sizeof(Reg);
+
+constexpr Reg GUEST = R15;					// Holds the address of the guest registers
+constexpr unsigned char FRAME_SIZE = 40;	// Keeps the stack aligned and reserves the Win64 shadow space
+
+Recompiler::Recompiler(ARM7TDMI& processor)
+	: cpu(processor), arena(CODE_ARENA_SIZE), host_reg(), uses(), flags(FLAGS_NONE), cycles(0), pc_read(0), exited(false)
+{
+
+}
+
+bool Recompiler::compile(ARMBlock& block)
+{
+	// The first pass only counts register accesses
+	for (unsigned int i = 0; i < 16; i++)
+	{
+		host_reg[i] = -1;
+		uses[i] = 0;
+	}
+	translate(block);
+
+	for (unsigned int n = 0; n < NUM_CACHE_REGS; n++)
+	{
+		int best = -1;
+		for (unsigned int i = 0; i < 15; i++)
+			if (host_reg[i] < 0 && uses[i] > 0 && (best < 0 || uses[i] > uses[best]))
+				best = i;
+
+		if (best < 0) break;
+		host_reg[best] = CACHE_REGS[n];
+	}
+
+	translate(block);
+
+	void* code = arena.place(emit);
+	if (!code)
+	{
+		// Every compiled block is discarded with the arena
+		cpu.block_cache.clear();
+		arena.reset();
+		return false;
+	}
+
+	block.native = code;
+	return true;
+}
+
+void Recompiler::translate(const ARMBlock& block)
+{
+	const unsigned int width = cpu.isThumb() ? 2 : 4;
+
+	emit.clear();
+	flags = FLAGS_NONE;
+	cycles = 0;
+	exited = false;
+
+	emit.push(RBX);
+	emit.push(RBP);
+	emit.push(R12);
+	emit.push(R13);
+	emit.push(R14);
+	emit.push(R15);
+	emit.subRSP(FRAME_SIZE);
+	emit.mov64(GUEST, (unsigned long long)cpu.r);
+	loadCached();
+
+	for (unsigned int i = 0; i < block.ops.size() && !exited; i++)
+	{
+		const DecodedOp<ARMHandler>& d = block.ops[i];
+		const unsigned int pc = block.address + i * width;
+		pc_read = pc + (width << 1);
+
+		const bool native = cpu.isThumb() ? compileThumb(d.op, pc) : compileARM(d.op, pc);
+		if (!native)
+			interpret(d, pc);
+		else if (!exited)
+			cycles += d.cycles;
+	}
+
+	if (!exited) exitTo(block.address + block.size);
+}
+
+void Recompiler::getReg(const Reg dst, const unsigned int reg)
+{
+	if (reg == 15)
+	{
+		emit.mov(dst, pc_read);
+		return;
+	}
+
+	uses[reg]++;
+	if (host_reg[reg] >= 0)
+		emit.mov(dst, (Reg)host_reg[reg]);
+	else
+		emit.load(dst, GUEST, reg << 2);
+}
+
+void Recompiler::setReg(const unsigned int reg, const Reg src)
+{
+	uses[reg]++;
+	if (host_reg[reg] >= 0)
+		emit.mov((Reg)host_reg[reg], src);
+	else
+		emit.store(GUEST, reg << 2, src);
+}
+
+void Recompiler::loadCached()
+{
+	for (unsigned int i = 0; i < 15; i++)
+		if (host_reg[i] >= 0)
+			emit.load((Reg)host_reg[i], GUEST, i << 2);
+}
+
+void Recompiler::storeCached()
+{
+	for (unsigned int i = 0; i < 15; i++)
+		if (host_reg[i] >= 0)
+			emit.store(GUEST, i << 2, (Reg)host_reg[i]);
+}
+
+// Writes the guest flags held in the host flags to the CPSR (clobbers RCX, RDX, R8, R9 and R11)
+void Recompiler::emitFlags()
+{
+	if (flags == FLAGS_NONE) return;
+
+	const bool carry = flags != FLAGS_LOGIC;
+	const bool overflow = flags == FLAGS_ADD || flags == FLAGS_SUB;
+
+	// Every flag is captured before the packing modifies the host flags
+	emit.setcc(CC_S, RCX);
+	emit.setcc(CC_E, RDX);
+	if (carry) emit.setcc(flags == FLAGS_SUB ? CC_AE : CC_B, R8);
+	if (overflow) emit.setcc(CC_O, R9);
+
+	unsigned int mask = CPSR_N | CPSR_Z;
+	unsigned char shift = 30;
+
+	emit.movzx8(RCX, RCX);
+	emit.movzx8(RDX, RDX);
+	emit.shl(RCX, 1);
+	emit.or_(RCX, RDX);
+
+	if (carry)
+	{
+		emit.movzx8(R8, R8);
+		emit.shl(RCX, 1);
+		emit.or_(RCX, R8);
+		mask |= CPSR_C;
+		shift--;
+	}
+
+	if (overflow)
+	{
+		emit.movzx8(R9, R9);
+		emit.shl(RCX, 1);
+		emit.or_(RCX, R9);
+		mask |= CPSR_V;
+		shift--;
+	}
+
+	emit.shl(RCX, shift);
+	emit.mov64(R11, (unsigned long long)&cpu.cpsr);
+	emit.load(RDX, R11, 0);
+	emit.and_(RDX, ~mask);
+	emit.or_(RDX, RCX);
+	emit.store(R11, 0, RDX);
+}
+
+void Recompiler::materialize()
+{
+	emitFlags();
+	flags = FLAGS_NONE;
+}
+
+// Stores the pending flags that the next operation would lose
+void Recompiler::prepare(const HostFlags next)
+{
+	switch (next)
+	{
+	case FLAGS_NONE:
+		materialize();
+		return;
+	case FLAGS_ADD:
+	case FLAGS_SUB:
+		return;
+	case FLAGS_SHIFT:
+		if (flags != FLAGS_SHIFT && flags != FLAGS_LOGIC) materialize();
+		return;
+	case FLAGS_LOGIC:
+		if (flags != FLAGS_LOGIC) materialize();
+		return;
+	}
+}
+
+// Maps a guest condition to a host condition code, returns false if the host flags cannot evaluate it
+bool Recompiler::hostCondition(const unsigned int cond, Cond& cc) const
+{
+	const bool nz = flags != FLAGS_NONE;
+	const bool carry = flags == FLAGS_ADD || flags == FLAGS_SUB || flags == FLAGS_SHIFT;
+	const bool overflow = flags == FLAGS_ADD || flags == FLAGS_SUB;
+
+	switch (cond)
+	{
+	case 0x0: cc = CC_E; return nz;										// EQ
+	case 0x1: cc = CC_NE; return nz;									// NE
+	case 0x2: cc = flags == FLAGS_SUB ? CC_AE : CC_B; return carry;		// CS
+	case 0x3: cc = flags == FLAGS_SUB ? CC_B : CC_AE; return carry;		// CC
+	case 0x4: cc = CC_S; return nz;										// MI
+	case 0x5: cc = CC_NS; return nz;									// PL
+	case 0x6: cc = CC_O; return overflow;								// VS
+	case 0x7: cc = CC_NO; return overflow;								// VC
+	case 0x8: cc = CC_A; return flags == FLAGS_SUB;						// HI
+	case 0x9: cc = CC_BE; return flags == FLAGS_SUB;					// LS
+	case 0xA: cc = CC_GE; return overflow;								// GE
+	case 0xB: cc = CC_L; return overflow;								// LT
+	case 0xC: cc = CC_G; return overflow;								// GT
+	case 0xD: cc = CC_LE; return overflow;								// LE
+	default: return false;
+	}
+}
+
+void Recompiler::emitReturn()
+{
+	if (cycles)
+	{
+		emit.mov64(R11, (unsigned long long)&cpu.cycles);
+		emit.add64(R11, cycles);
+	}
+
+	emit.addRSP(FRAME_SIZE);
+	emit.pop(R15);
+	emit.pop(R14);
+	emit.pop(R13);
+	emit.pop(R12);
+	emit.pop(RBP);
+	emit.pop(RBX);
+	emit.ret();
+}
+
+void Recompiler::exitTo(const unsigned int address)
+{
+	emitFlags();
+	storeCached();
+	emit.storeImm(GUEST, 15 << 2, address);
+	emitReturn();
+}
+
+void Recompiler::exitToRegister(const Reg address)
+{
+	emitFlags();
+	storeCached();
+	emit.store(GUEST, 15 << 2, address);
+	emitReturn();
+}
+
+// Calls the interpreter for an instruction, the block exits if it branched
+void Recompiler::interpret(const DecodedOp<ARMHandler>& d, const unsigned int pc)
+{
+	materialize();
+	storeCached();
+	emit.storeImm(GUEST, 15 << 2, pc);
+
+	emit.mov64(ARG0, (unsigned long long)&cpu);
+	emit.mov64(ARG1, (unsigned long long)&d);
+	emit.call(reinterpret_cast<const void*>(&ARM7TDMI::interpretOp));
+
+	emit.test8(RAX);
+	const unsigned int resume = emit.jcc(CC_E);
+	emitReturn();
+	emit.bind(resume);
+
+	loadCached();
+}
+
+bool Recompiler::compileBranch(const unsigned int cond, const unsigned int next, const unsigned int target, const unsigned int link)
+{
+	const unsigned int base = cycles;
+	Cond cc;
+
+	if (cond != 0xE)
+	{
+		if (!hostCondition(cond, cc)) return false;
+
+		const unsigned int taken = emit.jcc(cc);
+		cycles = base + 1;
+		exitTo(next);
+		emit.bind(taken);
+	}
+
+	cycles = base + 3;
+	if (link)
+	{
+		emit.mov(RAX, link);
+		setReg(14, RAX);
+	}
+	exitTo(target);
+
+	exited = true;
+	return true;
+}
+
+bool Recompiler::compileThumb(const unsigned int op, const unsigned int pc)
+{
+	const unsigned int rd = op & 0x7;
+	const unsigned int rs = (op >> 3) & 0x7;
+
+	switch (op >> 13)
+	{
+	case 0:
+		if ((op & 0x1800) == 0x1800) // ADD, SUB
+		{
+			getReg(RAX, rs);
+			if (op & 0x0400)
+				emit.mov(RCX, (op >> 6) & 0x7);
+			else
+				getReg(RCX, (op >> 6) & 0x7);
+
+			if (op & 0x0200)
+			{
+				emit.sub(RAX, RCX);
+				flags = FLAGS_SUB;
+			}
+			else
+			{
+				emit.add(RAX, RCX);
+				flags = FLAGS_ADD;
+			}
+			setReg(rd, RAX);
+			return true;
+		}
+		else // LSL, LSR, ASR
+		{
+			const unsigned char offset = (op >> 6) & 0x1F;
+			const unsigned int type = (op >> 11) & 0x3;
+			if (offset == 0 && type != 0) return false; // Shift by 32
+
+			const HostFlags result = offset ? FLAGS_SHIFT : FLAGS_LOGIC;
+			prepare(result);
+			getReg(RAX, rs);
+
+			if (offset == 0) emit.test(RAX, RAX);
+			else if (type == 0) emit.shl(RAX, offset);
+			else if (type == 1) emit.shr(RAX, offset);
+			else emit.sar(RAX, offset);
+
+			setReg(rd, RAX);
+			flags = result;
+			return true;
+		}
+
+	case 1: // MOV, CMP, ADD, SUB with immediate
+	{
+		const unsigned int reg = (op >> 8) & 0x7;
+		const unsigned int imm = op & 0xFF;
+
+		switch ((op >> 11) & 0x3)
+		{
+		case 0:
+			prepare(FLAGS_LOGIC);
+			emit.mov(RAX, imm);
+			emit.test(RAX, RAX);
+			setReg(reg, RAX);
+			flags = FLAGS_LOGIC;
+			return true;
+		case 1:
+			getReg(RAX, reg);
+			emit.cmp(RAX, imm);
+			flags = FLAGS_SUB;
+			return true;
+		case 2:
+			getReg(RAX, reg);
+			emit.add(RAX, imm);
+			setReg(reg, RAX);
+			flags = FLAGS_ADD;
+			return true;
+		default:
+			getReg(RAX, reg);
+			emit.sub(RAX, imm);
+			setReg(reg, RAX);
+			flags = FLAGS_SUB;
+			return true;
+		}
+	}
+
+	case 2:
+		if ((op & 0xFC00) == 0x4000) // ALU operations
+		{
+			switch ((op >> 6) & 0xF)
+			{
+			case 0x0: // AND
+			case 0x1: // EOR
+			case 0xC: // ORR
+			case 0xD: // MUL
+				prepare(FLAGS_LOGIC);
+				getReg(RAX, rd);
+				getReg(RCX, rs);
+				switch ((op >> 6) & 0xF)
+				{
+				case 0x0: emit.and_(RAX, RCX); break;
+				case 0x1: emit.xor_(RAX, RCX); break;
+				case 0xC: emit.or_(RAX, RCX); break;
+				default: emit.imul(RAX, RCX); emit.test(RAX, RAX); break;
+				}
+				setReg(rd, RAX);
+				flags = FLAGS_LOGIC;
+				return true;
+
+			case 0x8: // TST
+				prepare(FLAGS_LOGIC);
+				getReg(RAX, rd);
+				getReg(RCX, rs);
+				emit.test(RAX, RCX);
+				flags = FLAGS_LOGIC;
+				return true;
+
+			case 0x9: // NEG
+				getReg(RCX, rs);
+				emit.mov(RAX, 0u);
+				emit.sub(RAX, RCX);
+				setReg(rd, RAX);
+				flags = FLAGS_SUB;
+				return true;
+
+			case 0xA: // CMP
+				getReg(RAX, rd);
+				getReg(RCX, rs);
+				emit.cmp(RAX, RCX);
+				flags = FLAGS_SUB;
+				return true;
+
+			case 0xB: // CMN
+				getReg(RAX, rd);
+				getReg(RCX, rs);
+				emit.add(RAX, RCX);
+				flags = FLAGS_ADD;
+				return true;
+
+			case 0xE: // BIC
+				prepare(FLAGS_LOGIC);
+				getReg(RCX, rs);
+				emit.not_(RCX);
+				getReg(RAX, rd);
+				emit.and_(RAX, RCX);
+				setReg(rd, RAX);
+				flags = FLAGS_LOGIC;
+				return true;
+
+			case 0xF: // MVN
+				prepare(FLAGS_LOGIC);
+				getReg(RAX, rs);
+				emit.not_(RAX);
+				emit.test(RAX, RAX);
+				setReg(rd, RAX);
+				flags = FLAGS_LOGIC;
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		if ((op & 0xFC00) == 0x4400) // Hi register operations
+		{
+			const unsigned int hd = rd | ((op >> 4) & 0x8);
+			const unsigned int hs = (op >> 3) & 0xF;
+
+			switch ((op >> 8) & 0x3)
+			{
+			case 0: // ADD (lea leaves the flags untouched)
+				if (hd == 15) return false;
+				getReg(RAX, hd);
+				getReg(RCX, hs);
+				emit.lea(RAX, RAX, RCX);
+				setReg(hd, RAX);
+				return true;
+			case 1: // CMP
+				getReg(RAX, hd);
+				getReg(RCX, hs);
+				emit.cmp(RAX, RCX);
+				flags = FLAGS_SUB;
+				return true;
+			case 2: // MOV
+				if (hd == 15) return false;
+				getReg(RAX, hs);
+				setReg(hd, RAX);
+				return true;
+			default: // BX
+				return false;
+			}
+		}
+		return false;
+
+	case 5:
+		if ((op & 0xF000) == 0xA000) // ADD Rd, PC/SP, #imm
+		{
+			const unsigned int reg = (op >> 8) & 0x7;
+			const unsigned int offset = (op & 0xFF) << 2;
+
+			if (op & 0x0800)
+			{
+				getReg(RAX, 13);
+				emit.lea(RAX, RAX, (int)offset);
+			}
+			else
+				emit.mov(RAX, (pc_read & ~3) + offset);
+
+			setReg(reg, RAX);
+			return true;
+		}
+
+		if ((op & 0xFF00) == 0xB000) // ADD SP, #imm
+		{
+			const int offset = (op & 0x7F) << 2;
+			getReg(RAX, 13);
+			emit.lea(RAX, RAX, op & 0x80 ? -offset : offset);
+			setReg(13, RAX);
+			return true;
+		}
+		return false;
+
+	case 6:
+		if ((op & 0xF000) == 0xD000 && ((op >> 8) & 0xF) < 0xE) // B{cond}
+			return compileBranch((op >> 8) & 0xF, pc + 2, pc_read + ((int)(op << 24) >> 23), 0);
+		return false;
+
+	case 7:
+		if ((op & 0xF800) == 0xE000) // B
+			return compileBranch(0xE, pc + 2, pc_read + ((int)(op << 21) >> 20), 0);
+
+		if ((op & 0xF800) == 0xF000) // BL (high offset)
+		{
+			emit.mov(RAX, pc_read + ((int)(op << 21) >> 9));
+			setReg(14, RAX);
+			return true;
+		}
+
+		if ((op & 0xF800) == 0xF800) // BL (low offset)
+		{
+			getReg(RAX, 14);
+			emit.lea(RAX, RAX, (int)((op & 0x7FF) << 1));
+			emit.mov(RCX, (pc + 2) | 1);
+			setReg(14, RCX);
+
+			cycles += 3;
+			exitToRegister(RAX);
+			exited = true;
+			return true;
+		}
+		return false;
+
+	default:
+		return false;
+	}
+}
+
+bool Recompiler::compileARM(const unsigned int op, const unsigned int pc)
+{
+	if ((op & 0x0E000000) == 0x0A000000) // B, BL
+		return compileBranch(op >> 28, pc + 4, pc_read + ((int)(op << 8) >> 6), op & 0x01000000 ? pc + 4 : 0);
+
+	return false;
+}
+
+#else
+
+Recompiler::Recompiler(ARM7TDMI& processor)
+	: cpu(processor), arena(CODE_ARENA_SIZE), host_reg(), uses(), flags(FLAGS_NONE), cycles(0), pc_read(0), exited(false)
+{
+
+}
+
+bool Recompiler::compile(ARMBlock& block)
+{
+	return false;
+}
+
+#endif
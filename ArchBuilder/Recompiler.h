@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include "ARM7.h"
+#include "X64Emitter.h"
+
+constexpr unsigned int RECOMPILE_THRESHOLD = 16; // Executions before a block is compiled
+constexpr size_t CODE_ARENA_SIZE = 16777216; // 16 MB
+
+typedef void (*CompiledBlock)();
+
+/**
+ * @brief Translates ARM7TDMI blocks into x86-64 host code.
+ * The most used guest registers of a block are kept in host registers and flags are
+ * left in the host flags until an instruction, the interpreter or the block exit needs them.
+ * Memory accesses and uncommon instructions are executed by calling the interpreter.
+*/
+class Recompiler
+{
+private:
+	// Guest flags that are currently held in the host flags
+	enum HostFlags {
+		FLAGS_NONE,		// Guest flags are up to date
+		FLAGS_ADD,		// NZCV from an addition (C = CF)
+		FLAGS_SUB,		// NZCV from a subtraction (C = NOT CF)
+		FLAGS_LOGIC,	// NZ from a logical operation
+		FLAGS_SHIFT		// NZC from a shift (C = CF)
+	};
+
+	ARM7TDMI& cpu;
+	x64::CodeArena arena;
+	x64::Emitter emit;
+
+	int host_reg[16];			// Host register that holds each guest register (-1 if in memory)
+	unsigned int uses[16];		// Number of accesses to each guest register
+	HostFlags flags;
+	unsigned int cycles;		// Cycles of the compiled instructions emitted so far
+	unsigned int pc_read;		// Value of the PC read by the current instruction
+	bool exited;				// The block exit was emitted
+
+	void getReg(const x64::Reg dst, const unsigned int reg);
+	void setReg(const unsigned int reg, const x64::Reg src);
+	void loadCached();
+	void storeCached();
+
+	void emitFlags();
+	void materialize();
+	void prepare(const HostFlags next);
+	bool hostCondition(const unsigned int cond, x64::Cond& cc) const;
+
+	void emitReturn();
+	void exitTo(const unsigned int address);
+	void exitToRegister(const x64::Reg address);
+	void interpret(const DecodedOp<ARMHandler>& d, const unsigned int pc);
+
+	bool compileThumb(const unsigned int op, const unsigned int pc);
+	bool compileARM(const unsigned int op, const unsigned int pc);
+	bool compileBranch(const unsigned int cond, const unsigned int next, const unsigned int target, const unsigned int link);
+	void translate(const ARMBlock& block);
+
+public:
+	Recompiler(ARM7TDMI& processor);
+
+	// Compiles the block, the cache is flushed if there is no space left
+	bool compile(ARMBlock& block);
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "Rewind.h"
+
+static unsigned char* writeLength(unsigned char* out, unsigned int n)
+{
+	for (; n >= 0x80; n >>= 7)
+		*out++ = (unsigned char)(n | 0x80);
+	*out++ = (unsigned char)n;
+	return out;
+}
+
+static unsigned int readLength(const unsigned char*& in)
+{
+	unsigned int n = 0;
+	for (unsigned int shift = 0;; shift += 7)
+	{
+		const unsigned char b = *in++;
+		n |= (b & 0x7F) << shift;
+		if (!(b & 0x80)) return n;
+	}
+}
+
+static inline unsigned int loadWord(const unsigned char* p)
+{
+	unsigned int w;
+	std::memcpy(&w, p, 4);
+	return w;
+}
+
+// Encodes the words of data ^ previous as pairs of (unchanged words, changed words)
+template <bool Delta>
+static unsigned char* encodeWords(const unsigned char* data, const unsigned char* previous, const unsigned int words, unsigned char* out)
+{
+	auto diff = [&](const unsigned int i) { return Delta ? loadWord(data + i * 4) ^ loadWord(previous + i * 4) : loadWord(data + i * 4); };
+
+	unsigned int pos = 0;
+	while (pos < words)
+	{
+		const unsigned int zero_start = pos;
+		while (pos < words && diff(pos) == 0) pos++;
+
+		const unsigned int literal_start = pos;
+		while (pos < words && diff(pos) != 0) pos++;
+
+		out = writeLength(out, literal_start - zero_start);
+		out = writeLength(out, pos - literal_start);
+		for (unsigned int i = literal_start; i < pos; i++, out += 4)
+		{
+			const unsigned int w = diff(i);
+			std::memcpy(out, &w, 4);
+		}
+	}
+	return out;
+}
+
+// Encodes data ^ previous (previous is zero if nullptr), the bytes after the last whole word are stored as is
+void RewindBuffer::encode(const unsigned char* data, const unsigned char* previous, const unsigned int size, std::vector<unsigned char>& out)
+{
+	const unsigned int words = size >> 2;
+	const size_t at = out.size();
+	out.resize(at + size + 6 * (words + 1)); // Every pair has a changed word
+
+	unsigned char* end = previous ? encodeWords<true>(data, previous, words, out.data() + at)
+		: encodeWords<false>(data, previous, words, out.data() + at);
+
+	for (unsigned int i = words << 2; i < size; i++)
+		*end++ = previous ? data[i] ^ previous[i] : data[i];
+
+	out.resize(end - out.data());
+}
+
+// Applies an encoded page to its previous contents
+const unsigned char* RewindBuffer::decode(const unsigned char* in, unsigned char* data, const unsigned int size)
+{
+	const unsigned int words = size >> 2;
+	unsigned int pos = 0;
+	while (pos < words)
+	{
+		pos += readLength(in);
+		const unsigned int literal = readLength(in);
+		for (unsigned int i = 0; i < literal; i++, pos++, in += 4)
+		{
+			const unsigned int w = loadWord(data + pos * 4) ^ loadWord(in);
+			std::memcpy(data + pos * 4, &w, 4);
+		}
+	}
+
+	for (unsigned int i = words << 2; i < size; i++)
+		data[i] ^= *in++;
+	return in;
+}
+
+// Drops the oldest keyframe and its frames, the newest keyframe is always kept
+bool RewindBuffer::dropOldest()
+{
+	size_t n = 1;
+	while (n < frames.size() && !frames[n].keyframe) n++;
+	if (n == frames.size()) return false;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		usage -= frames.front().getSize();
+		frames.pop_front();
+	}
+	first_frame += n;
+	return true;
+}
+
+void RewindBuffer::capture(GBA& gba)
+{
+	// Frames after the current one belong to a discarded timeline
+	while (!frames.empty() && getLastFrame() > current)
+	{
+		usage -= frames.back().getSize();
+		frames.pop_back();
+	}
+
+	const std::shared_ptr<const GBA::SaveState> state = gba.saveState();
+	const MemorySnapshot& memory = *state->memory;
+
+	Frame frame;
+	frame.state = *state;
+	frame.state.memory.reset();
+
+	// A keyframe every keyframe_interval frames (the oldest frame is always one)
+	frame.keyframe = !last || frames.empty();
+	if (!frame.keyframe)
+	{
+		size_t key = frames.size() - 1;
+		while (!frames[key].keyframe) key--;
+		frame.keyframe = frames.size() - key >= keyframe_interval;
+	}
+
+	// Pages that were not written since the previous frame are shared with it
+	for (unsigned int i = 0; i < memory.pages.size(); i++)
+	{
+		if (!frame.keyframe && memory.pages[i] == last->memory->pages[i]) continue;
+
+		frame.pages.push_back((unsigned short)i);
+		encode(memory.pages[i]->data(), frame.keyframe ? nullptr : last->memory->pages[i]->data(),
+			(unsigned int)memory.pages[i]->size(), frame.data);
+	}
+	encode(memory.small.data(), frame.keyframe ? nullptr : last->memory->small.data(), (unsigned int)memory.small.size(), frame.data);
+
+	current = frames.empty() ? first_frame : getLastFrame() + 1;
+	usage += frame.getSize();
+	frames.push_back(std::move(frame));
+	last = state;
+
+	while (usage > budget && dropOldest());
+}
+
+bool RewindBuffer::seek(GBA& gba, const unsigned long long frame)
+{
+	if (frames.empty() || frame < first_frame || frame > getLastFrame()) return false;
+
+	const size_t target = (size_t)(frame - first_frame);
+	size_t key = target;
+	while (!frames[key].keyframe) key--;
+
+	// Replays the frames from the keyframe (which starts from zeroed pages)
+	const MemorySnapshot& layout = *last->memory;
+	std::vector<std::vector<unsigned char>> pages(layout.pages.size());
+	for (unsigned int i = 0; i < pages.size(); i++)
+		pages[i].resize(layout.pages[i]->size());
+	std::vector<unsigned char> small(layout.small.size());
+
+	for (size_t i = key; i <= target; i++)
+	{
+		const unsigned char* in = frames[i].data.data();
+		for (const unsigned short page : frames[i].pages)
+			in = decode(in, pages[page].data(), (unsigned int)pages[page].size());
+		decode(in, small.data(), (unsigned int)small.size());
+	}
+
+	MemorySnapshot* memory = new MemorySnapshot();
+	memory->pages.resize(pages.size());
+	for (unsigned int i = 0; i < pages.size(); i++)
+		memory->pages[i] = std::make_shared<const std::vector<unsigned char>>(std::move(pages[i]));
+	memory->small = std::move(small);
+
+	GBA::SaveState* state = new GBA::SaveState(frames[target].state);
+	state->memory.reset(memory);
+	gba.loadState(*state);
+
+	// The next frame is encoded against the restored state
+	last.reset(state);
+	current = frame;
+	return true;
+}
+
+void RewindBuffer::rewind(GBA& gba, const unsigned long long count)
+{
+	if (frames.empty()) return;
+	seek(gba, current - std::min(count, current - first_frame));
+}
+
+void RewindBuffer::clear()
+{
+	frames.clear();
+	last.reset();
+	first_frame = current = 0;
+	usage = 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "GBA.h"
+#include <deque>
+
+/**
+ * @brief Fixed-memory history of machine states, one entry per captured frame.
+ * A keyframe stores every memory page, the other frames only the pages written since the
+ * previous frame (found through the dirty pages of the snapshots). Pages are stored as the
+ * XOR with their previous contents (zero for keyframes), run-length encoded by 32-bit words.
+*/
+class RewindBuffer
+{
+private:
+	struct Frame
+	{
+		GBA::SaveState state;				// Processor and device state (the memory is not kept)
+		bool keyframe;
+		std::vector<unsigned short> pages;	// Pages stored in data, in order
+		std::vector<unsigned char> data;	// Encoded pages followed by the encoded small components
+
+		size_t getSize() const { return sizeof(Frame) + pages.size() * sizeof(unsigned short) + data.size() + state.scheduler.heap.capacity() * sizeof(state.scheduler.heap[0]); }
+	};
+
+	std::deque<Frame> frames;
+	std::shared_ptr<const GBA::SaveState> last;	// State of the current frame (the base of the next delta)
+	unsigned long long first_frame;				// Number of the oldest frame
+	unsigned long long current;					// Number of the frame the machine is at
+	size_t budget;
+	size_t usage;
+	unsigned int keyframe_interval;
+
+	static void encode(const unsigned char* data, const unsigned char* previous, const unsigned int size, std::vector<unsigned char>& out);
+	static const unsigned char* decode(const unsigned char* in, unsigned char* data, const unsigned int size);
+
+	bool dropOldest();
+
+public:
+	/**
+	 * @brief Creates an empty history
+	 * @param memory_budget - bytes used by the frames at most (the oldest frames are dropped)
+	 * @param interval - frames between two keyframes
+	*/
+	RewindBuffer(const size_t memory_budget = 64 << 20, const unsigned int interval = 60)
+		: first_frame(0), current(0), budget(memory_budget), usage(0), keyframe_interval(interval) {}
+
+	/**
+	 * @brief Records the state of the machine as the frame after the current one,
+	 * frames after the current one (left by a rewind) are discarded
+	 * @param gba - machine
+	*/
+	void capture(GBA& gba);
+
+	/**
+	 * @brief Restores a recorded frame
+	 * @param gba - machine the frames were captured from
+	 * @param frame - frame number (between getFirstFrame and getLastFrame)
+	 * @return false if the frame is not in the history
+	*/
+	bool seek(GBA& gba, const unsigned long long frame);
+
+	/**
+	 * @brief Steps back in the history
+	 * @param gba - machine the frames were captured from
+	 * @param count - number of frames (stops at the oldest frame)
+	*/
+	void rewind(GBA& gba, const unsigned long long count = 1);
+
+	void clear();
+
+	bool empty() const { return frames.empty(); }
+	unsigned long long getFirstFrame() const { return first_frame; }
+	unsigned long long getLastFrame() const { return first_frame + frames.size() - 1; }
+	unsigned long long getCurrentFrame() const { return current; }
+	size_t getMemoryUsage() const { return usage; }
+};
+
+#endif
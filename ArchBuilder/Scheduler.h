@@ -0,0 +1,168 @@
+#pragma once
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <vector>
+#include <algorithm>
+
+// Hardware events, each type has at most one pending occurrence
+enum class EventType : unsigned char {
+	HBLANK,			// Horizontal blank of the current line
+	LINE_END,		// Next line (VCount and VBlank transitions)
+	TIMER0, TIMER1, TIMER2, TIMER3, // Timer overflows
+	DMA0, DMA1, DMA2, DMA3,			// DMA transfers
+	FIFO_A, FIFO_B,	// Sound FIFO refill requests
+	COUNT
+};
+
+constexpr unsigned int NUM_EVENT_TYPES = (unsigned int)EventType::COUNT;
+
+// Receives the events of a scheduler
+class EventHandler
+{
+public:
+	virtual ~EventHandler() = default;
+
+	/**
+	 * @brief Handles an event that is due
+	 * @param type - event type
+	 * @param time - cycle the event was scheduled for (may be earlier than the current cycle)
+	*/
+	virtual void handleEvent(const EventType type, const unsigned long long time) = 0;
+};
+
+/**
+ * @brief Min-heap of cycle-timestamped hardware events.
+ * Rescheduled and cancelled events are left in the heap and skipped when they reach the top.
+*/
+class Scheduler
+{
+private:
+	struct Event
+	{
+		unsigned long long time;
+		unsigned int generation;
+		EventType type;
+	};
+
+	// Orders the heap by the earliest time
+	struct Later
+	{
+		bool operator()(const Event& a, const Event& b) const { return a.time > b.time; }
+	};
+
+	std::vector<Event> heap;
+	unsigned int generation[NUM_EVENT_TYPES];	// Current generation of each type (older events are stale)
+	bool pending[NUM_EVENT_TYPES];
+	EventHandler* handler;
+
+public:
+	// Pending events stored in save states
+	struct State
+	{
+		std::vector<Event> heap;
+		unsigned int generation[NUM_EVENT_TYPES];
+		bool pending[NUM_EVENT_TYPES];
+	};
+
+private:
+
+	void discardStale()
+	{
+		while (!heap.empty() && heap.front().generation != generation[(unsigned int)heap.front().type])
+		{
+			std::pop_heap(heap.begin(), heap.end(), Later());
+			heap.pop_back();
+		}
+	}
+
+public:
+	Scheduler(EventHandler* h) : generation(), pending(), handler(h)
+	{
+		heap.reserve(NUM_EVENT_TYPES * 2);
+	}
+
+	/**
+	 * @brief Schedules an event, a pending event of the same type is replaced
+	 * @param type - event type
+	 * @param time - cycle the event is due
+	*/
+	void schedule(const EventType type, const unsigned long long time)
+	{
+		const unsigned int t = (unsigned int)type;
+		if (pending[t]) generation[t]++;
+		pending[t] = true;
+
+		heap.push_back({ time, generation[t], type });
+		std::push_heap(heap.begin(), heap.end(), Later());
+	}
+
+	void cancel(const EventType type)
+	{
+		const unsigned int t = (unsigned int)type;
+		if (!pending[t]) return;
+		generation[t]++;
+		pending[t] = false;
+	}
+
+	bool isScheduled(const EventType type) const { return pending[(unsigned int)type]; }
+
+	/**
+	 * @brief Returns the cycle of the earliest pending event
+	 * @return cycle of the next event (maximum value if there is none)
+	*/
+	unsigned long long nextDeadline()
+	{
+		discardStale();
+		return heap.empty() ? ~0ULL : heap.front().time;
+	}
+
+	/**
+	 * @brief Handles every event that is due in time order
+	 * @param now - current cycle
+	*/
+	void dispatch(const unsigned long long now)
+	{
+		for (;;)
+		{
+			discardStale();
+			if (heap.empty() || heap.front().time > now) return;
+
+			const Event e = heap.front();
+			std::pop_heap(heap.begin(), heap.end(), Later());
+			heap.pop_back();
+
+			pending[(unsigned int)e.type] = false;
+			handler->handleEvent(e.type, e.time);
+		}
+	}
+
+	State saveState() const
+	{
+		State state;
+		state.heap = heap;
+		std::copy(generation, generation + NUM_EVENT_TYPES, state.generation);
+		std::copy(pending, pending + NUM_EVENT_TYPES, state.pending);
+		return state;
+	}
+
+	void loadState(const State& state)
+	{
+		heap = state.heap;
+		std::copy(state.generation, state.generation + NUM_EVENT_TYPES, generation);
+		std::copy(state.pending, state.pending + NUM_EVENT_TYPES, pending);
+	}
+
+	void clear()
+	{
+		heap.clear();
+		for (unsigned int i = 0; i < NUM_EVENT_TYPES; i++)
+		{
+			generation[i]++;
+			pending[i] = false;
+		}
+	}
+};
+
+#endif
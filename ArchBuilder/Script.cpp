@@ -0,0 +1,285 @@
+#include "ARM7.h"
+#include <charconv>
+#include <cstring>
+#include <cctype>
+
+// Script lines are compiled once and executed from bytecode
+
+static inline bool isSeparator(const char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+// Removes the next token from the line, separators inside brackets are kept
+static std::string_view nextToken(std::string_view& line)
+{
+	size_t start = 0;
+	while (start < line.size() && isSeparator(line[start])) start++;
+
+	size_t end = start;
+	unsigned int depth = 0;
+	while (end < line.size() && (depth > 0 || !isSeparator(line[end])))
+	{
+		if (line[end] == '[') depth++;
+		else if (line[end] == ']' && depth > 0) depth--;
+		end++;
+	}
+
+	const std::string_view token = line.substr(start, end - start);
+	line.remove_prefix(end);
+	return token;
+}
+
+// Parses a decimal or 0x prefixed hexadecimal number (stops at the first invalid character)
+static unsigned int parseNumber(std::string_view word)
+{
+	const bool negative = !word.empty() && word[0] == '-';
+	if (negative) word.remove_prefix(1);
+
+	int base = 10;
+	if (word.size() > 2 && word[0] == '0' && (word[1] == 'x' || word[1] == 'X'))
+	{
+		base = 16;
+		word.remove_prefix(2);
+	}
+
+	unsigned int value = 0;
+	std::from_chars(word.data(), word.data() + word.size(), value, base);
+	return negative ? 0 - value : value;
+}
+
+// Parses a register (Rn) or an immediate (#n)
+static bool parseValue(const std::string_view word, const unsigned int line, unsigned int& value, bool& is_register)
+{
+	is_register = !word.empty() && (word[0] == 'r' || word[0] == 'R');
+	value = parseNumber(word.empty() ? word : word[0] == '#' || is_register ? word.substr(1) : word);
+
+	if (is_register && value > 0xF)
+	{
+		std::cout << "Error: Register id is too large on line " << std::dec << line << "!" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Returns the index of the instruction with a mnemonic (0 is UND)
+unsigned int ARM7TDMI::findInstruction(const std::string_view mnemonic) const
+{
+	for (unsigned int i = 0; i < instructions->size(); i++)
+	{
+		const Instruction* instr = instructions->getInstructionById(i);
+		if (std::strlen(instr->mnemonic) != mnemonic.size()) continue;
+
+		unsigned int c = 0;
+		while (c < mnemonic.size() && std::toupper((unsigned char)mnemonic[c]) == instr->mnemonic[c]) c++;
+		if (c == mnemonic.size()) return i;
+	}
+
+	return 0;
+}
+
+bool ARM7TDMI::compileScriptLine(const std::string_view line, const unsigned int number, ScriptOp& op) const
+{
+	std::string_view rest = line;
+	const Instruction* instr = instructions->getInstructionById(findInstruction(nextToken(rest)));
+
+	if (instr->id == UND)
+	{
+		std::cout << "Error: unknown command on line " << std::dec << number << "!" << std::endl;
+		return false;
+	}
+
+	op.id = instr->id;
+	op.line = number;
+	for (ScriptOperand& arg : op.args)
+		arg = { 0, 0, SCRIPT_NONE, false, false };
+
+	unsigned int argc = 0;
+	for (std::string_view token = nextToken(rest); !token.empty() && argc < 4; token = nextToken(rest))
+	{
+		ScriptOperand& arg = op.args[argc++];
+
+		// The described instruction is resolved now (by index)
+		if (op.id == EXPLAIN)
+		{
+			arg.base = findInstruction(token);
+			arg.type = SCRIPT_IMMEDIATE;
+			continue;
+		}
+
+		if (token[0] != '[')
+		{
+			if (!parseValue(token, number, arg.base, arg.base_register)) return false;
+			arg.type = arg.base_register ? SCRIPT_REGISTER : SCRIPT_IMMEDIATE;
+			continue;
+		}
+
+		// [base, offset] or [base, offset]!
+		std::string_view inner = token.substr(1);
+		const size_t close = inner.rfind(']');
+		if (close == std::string_view::npos)
+		{
+			std::cout << "Error: missing ] on line " << std::dec << number << "!" << std::endl;
+			return false;
+		}
+
+		const bool write_back = token.back() == '!';
+		inner = inner.substr(0, close);
+		const std::string_view base = nextToken(inner);
+		const std::string_view offset = nextToken(inner);
+
+		if ((!base.empty() && base[0] == '[') || (!offset.empty() && offset[0] == '['))
+		{
+			std::cout << "Error: nested memory operand on line " << std::dec << number << "!" << std::endl;
+			return false;
+		}
+
+		if (base.empty())
+			arg.base_register = true; // R0
+		else if (!parseValue(base, number, arg.base, arg.base_register))
+			return false;
+
+		if (!offset.empty() && !parseValue(offset, number, arg.offset, arg.offset_register))
+			return false;
+
+		arg.type = write_back && !offset.empty() ? SCRIPT_WRITE_BACK : SCRIPT_MEMORY;
+	}
+
+	if (argc < instr->min_arg)
+	{
+		std::cout << "Error: missing arguments on line " << std::dec << number << "!" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool ARM7TDMI::compileScript(std::istream& stream, std::vector<ScriptOp>& script) const
+{
+	std::string line;
+	unsigned int number = 0;
+	bool success = true;
+
+	while (std::getline(stream, line))
+	{
+		number++;
+		if (line.find_first_not_of(" \t\r,;") == std::string::npos) continue;
+
+		ScriptOp op;
+		if (compileScriptLine(line, number, op))
+			script.push_back(op);
+		else
+			success = false;
+	}
+
+	return success;
+}
+
+// Memory operand, stores to read-only or unmapped memory only change a copy of the value
+static inline unsigned int* memoryOperand(MemoryMap* map, const unsigned int address, unsigned int& imm)
+{
+	if (unsigned char* host = map->getWritePointer(address)) return (unsigned int*)host;
+	imm = map->readInt(address);
+	return &imm;
+}
+
+// Returns a pointer to the value of an operand (immediates are stored in imm)
+inline unsigned int* ARM7TDMI::scriptOperand(const ScriptOperand& arg, unsigned int& imm)
+{
+	switch (arg.type)
+	{
+	case SCRIPT_REGISTER:
+		return r + arg.base;
+
+	case SCRIPT_IMMEDIATE:
+		imm = arg.base;
+		return &imm;
+
+	case SCRIPT_MEMORY:
+	{
+		const unsigned int base = arg.base_register ? r[arg.base] : arg.base;
+		const unsigned int offset = arg.offset_register ? r[arg.offset] : arg.offset;
+		return memoryOperand(mem_map, base + offset, imm);
+	}
+
+	case SCRIPT_WRITE_BACK:
+	{
+		unsigned int* base = arg.base_register ? r + arg.base : &imm;
+		if (!arg.base_register) imm = arg.base;
+		*base += arg.offset_register ? r[arg.offset] : arg.offset;
+		return memoryOperand(mem_map, *base, imm);
+	}
+
+	default:
+		return r;
+	}
+}
+
+void ARM7TDMI::executeScript(const ScriptOp& op)
+{
+	unsigned int imm[4];
+	unsigned int* Rd = scriptOperand(op.args[0], imm[0]);
+	unsigned int* Rm = scriptOperand(op.args[1], imm[1]);
+	unsigned int* Rs = scriptOperand(op.args[2], imm[2]);
+	unsigned int* Rn = scriptOperand(op.args[3], imm[3]);
+	unsigned int tmp;
+
+	switch (op.id)
+	{
+	default: std::cout << "Error: unknown command!" << std::endl; return;
+
+	case B	: r[15] = *Rd; return;
+	case BL : r[14] = r[15];  r[15] = *Rd; return;
+	case BX : r[15] = *Rd; setThumb(r[15] & 0x1); return;
+	case BLX: r[14] = r[15]; setThumb(r[15] & 0x1); r[15] = *Rd; return;
+	case AND: *Rd = *Rm & *Rs; return;
+	case EOR: *Rd = *Rm ^ *Rs; return;
+	case SUB: *Rd = *Rm - *Rs; return;
+	case ADD: *Rd = *Rm + *Rs; return;
+	case ADC: *Rd = *Rm + *Rs + carry(); return;
+	case SBC: *Rd = *Rm - *Rs + carry() - 1; return;
+	case RSC: *Rd = *Rs - *Rm + carry() - 1; return;
+	case TST: setNZ((*Rd) & (*Rm)); return;
+	case TEQ: setNZ((*Rd) ^ (*Rm)); return;
+	case CMP: subFlags(*Rd, *Rm); return;
+	case CMN: addFlags(*Rd, *Rm, 0); return;
+
+	case ORR: *Rd = *Rm | *Rs; return;
+	case MOV: *Rd = *Rm; return;
+	case BIC: *Rd = *Rm & ~(*Rs); return;
+	case MVN: *Rd = ~(*Rm); return;
+
+	case MUL: *Rd = (*Rm) * (*Rs); return;
+	case MLA: *Rd = (*Rm) * (*Rs) + (*Rn); return;
+
+	case LDR: *Rd = *Rm; return;
+	case STR: *Rm = *Rd; return;
+
+	case SWP:
+		tmp = *Rd;
+		*Rd = *Rm;
+		*Rm = tmp;
+		return;
+
+	// OTHER ACTIONS
+	case PRINT:
+		char buffer[arc::HEX_BUFFER_SIZE];
+		std::cout << arc::toHex(buffer, *Rd, bits) << std::endl;
+		return;
+
+	case EXPLAIN: std::cout << instructions->getInstructionById(*Rd)->description << std::endl; return;
+	}
+}
+
+void ARM7TDMI::runScript(const std::vector<ScriptOp>& script)
+{
+	for (const ScriptOp& op : script)
+		executeScript(op);
+}
+
+void ARM7TDMI::interpret(const std::string_view line)
+{
+	ScriptOp op;
+	if (compileScriptLine(line, 1, op)) executeScript(op);
+}
@@ -0,0 +1,571 @@
+#include "ARM7.h"
+#include <bit>
+
+// THUMB (16-bit) instruction set, ordered by decoding priority
+constexpr InstructionSpec<ARMHandler> THUMB_ISA[] =
+{
+	{ T_UND     , "UND"  , 0, 0xFF00, 0xDE00, "Undefined", &ARM7TDMI::undefined },
+
+	{ T_ADD_REG , "ADD"  , 3, 0xFE00, 0x1800, "Add register (Rd = Rs + Rn)", &ARM7TDMI::thumbAddSub },
+	{ T_SUB_REG , "SUB"  , 3, 0xFE00, 0x1A00, "Subtract register (Rd = Rs - Rn)", &ARM7TDMI::thumbAddSub },
+	{ T_ADD_IMM3, "ADD"  , 3, 0xFE00, 0x1C00, "Add 3-bit immediate (Rd = Rs + #)", &ARM7TDMI::thumbAddSub },
+	{ T_SUB_IMM3, "SUB"  , 3, 0xFE00, 0x1E00, "Subtract 3-bit immediate (Rd = Rs - #)", &ARM7TDMI::thumbAddSub },
+	{ T_LSL_IMM , "LSL"  , 3, 0xF800, 0x0000, "Logical shift left by immediate", &ARM7TDMI::thumbShift },
+	{ T_LSR_IMM , "LSR"  , 3, 0xF800, 0x0800, "Logical shift right by immediate", &ARM7TDMI::thumbShift },
+	{ T_ASR_IMM , "ASR"  , 3, 0xF800, 0x1000, "Arithmetic shift right by immediate", &ARM7TDMI::thumbShift },
+
+	{ T_MOV_IMM , "MOV"  , 2, 0xF800, 0x2000, "Move 8-bit immediate (Rd = #)", &ARM7TDMI::thumbImmediate },
+	{ T_CMP_IMM , "CMP"  , 2, 0xF800, 0x2800, "Compare 8-bit immediate", &ARM7TDMI::thumbImmediate },
+	{ T_ADD_IMM , "ADD"  , 2, 0xF800, 0x3000, "Add 8-bit immediate (Rd = Rd + #)", &ARM7TDMI::thumbImmediate },
+	{ T_SUB_IMM , "SUB"  , 2, 0xF800, 0x3800, "Subtract 8-bit immediate (Rd = Rd - #)", &ARM7TDMI::thumbImmediate },
+
+	{ T_AND     , "AND"  , 2, 0xFFC0, 0x4000, "AND (Rd = Rd & Rs)", &ARM7TDMI::thumbALU },
+	{ T_EOR     , "EOR"  , 2, 0xFFC0, 0x4040, "Exclusive OR (Rd = Rd ^ Rs)", &ARM7TDMI::thumbALU },
+	{ T_LSL     , "LSL"  , 2, 0xFFC0, 0x4080, "Logical shift left (Rd = Rd << Rs)", &ARM7TDMI::thumbALU },
+	{ T_LSR     , "LSR"  , 2, 0xFFC0, 0x40C0, "Logical shift right (Rd = Rd >> Rs)", &ARM7TDMI::thumbALU },
+	{ T_ASR     , "ASR"  , 2, 0xFFC0, 0x4100, "Arithmetic shift right (Rd = Rd >> Rs)", &ARM7TDMI::thumbALU },
+	{ T_ADC     , "ADC"  , 2, 0xFFC0, 0x4140, "Add with carry (Rd = Rd + Rs + C)", &ARM7TDMI::thumbALU },
+	{ T_SBC     , "SBC"  , 2, 0xFFC0, 0x4180, "Subtract with carry (Rd = Rd - Rs + C - 1)", &ARM7TDMI::thumbALU },
+	{ T_ROR     , "ROR"  , 2, 0xFFC0, 0x41C0, "Rotate right (Rd = Rd ROR Rs)", &ARM7TDMI::thumbALU },
+	{ T_TST     , "TST"  , 2, 0xFFC0, 0x4200, "Test bits", &ARM7TDMI::thumbALU },
+	{ T_NEG     , "NEG"  , 2, 0xFFC0, 0x4240, "Negate (Rd = -Rs)", &ARM7TDMI::thumbALU },
+	{ T_CMP     , "CMP"  , 2, 0xFFC0, 0x4280, "Compare", &ARM7TDMI::thumbALU },
+	{ T_CMN     , "CMN"  , 2, 0xFFC0, 0x42C0, "Compare Negative", &ARM7TDMI::thumbALU },
+	{ T_ORR     , "ORR"  , 2, 0xFFC0, 0x4300, "OR (Rd = Rd | Rs)", &ARM7TDMI::thumbALU },
+	{ T_MUL     , "MUL"  , 2, 0xFFC0, 0x4340, "Multiply (Rd = Rd * Rs)", &ARM7TDMI::thumbALU },
+	{ T_BIC     , "BIC"  , 2, 0xFFC0, 0x4380, "Bit Clear (Rd = Rd & ~Rs)", &ARM7TDMI::thumbALU },
+	{ T_MVN     , "MVN"  , 2, 0xFFC0, 0x43C0, "Move negative register (Rd = ~Rs)", &ARM7TDMI::thumbALU },
+
+	{ T_ADD_HI  , "ADD"  , 2, 0xFF00, 0x4400, "Add high register (Rd = Rd + Rs)", &ARM7TDMI::thumbHiRegister },
+	{ T_CMP_HI  , "CMP"  , 2, 0xFF00, 0x4500, "Compare high register", &ARM7TDMI::thumbHiRegister },
+	{ T_MOV_HI  , "MOV"  , 2, 0xFF00, 0x4600, "Move high register (Rd = Rs)", &ARM7TDMI::thumbHiRegister },
+	{ T_BX      , "BX"   , 1, 0xFF00, 0x4700, "Branch with Exchange", &ARM7TDMI::thumbHiRegister },
+
+	{ T_LDR_PC  , "LDR"  , 2, 0xF800, 0x4800, "Load PC-relative word", &ARM7TDMI::thumbLoadPC },
+
+	{ T_STR_REG , "STR"  , 3, 0xFE00, 0x5000, "Store word (register offset)", &ARM7TDMI::thumbLoadStoreReg },
+	{ T_STRB_REG, "STRB" , 3, 0xFE00, 0x5400, "Store byte (register offset)", &ARM7TDMI::thumbLoadStoreReg },
+	{ T_LDR_REG , "LDR"  , 3, 0xFE00, 0x5800, "Load word (register offset)", &ARM7TDMI::thumbLoadStoreReg },
+	{ T_LDRB_REG, "LDRB" , 3, 0xFE00, 0x5C00, "Load byte (register offset)", &ARM7TDMI::thumbLoadStoreReg },
+	{ T_STRH_REG, "STRH" , 3, 0xFE00, 0x5200, "Store half-word (register offset)", &ARM7TDMI::thumbLoadStoreSigned },
+	{ T_LDSB_REG, "LDSB" , 3, 0xFE00, 0x5600, "Load sign extended byte (register offset)", &ARM7TDMI::thumbLoadStoreSigned },
+	{ T_LDRH_REG, "LDRH" , 3, 0xFE00, 0x5A00, "Load half-word (register offset)", &ARM7TDMI::thumbLoadStoreSigned },
+	{ T_LDSH_REG, "LDSH" , 3, 0xFE00, 0x5E00, "Load sign extended half-word (register offset)", &ARM7TDMI::thumbLoadStoreSigned },
+
+	{ T_STR_IMM , "STR"  , 3, 0xF800, 0x6000, "Store word (immediate offset)", &ARM7TDMI::thumbLoadStoreImm },
+	{ T_LDR_IMM , "LDR"  , 3, 0xF800, 0x6800, "Load word (immediate offset)", &ARM7TDMI::thumbLoadStoreImm },
+	{ T_STRB_IMM, "STRB" , 3, 0xF800, 0x7000, "Store byte (immediate offset)", &ARM7TDMI::thumbLoadStoreImm },
+	{ T_LDRB_IMM, "LDRB" , 3, 0xF800, 0x7800, "Load byte (immediate offset)", &ARM7TDMI::thumbLoadStoreImm },
+	{ T_STRH_IMM, "STRH" , 3, 0xF800, 0x8000, "Store half-word (immediate offset)", &ARM7TDMI::thumbLoadStoreHalf },
+	{ T_LDRH_IMM, "LDRH" , 3, 0xF800, 0x8800, "Load half-word (immediate offset)", &ARM7TDMI::thumbLoadStoreHalf },
+
+	{ T_STR_SP  , "STR"  , 2, 0xF800, 0x9000, "Store word (SP-relative)", &ARM7TDMI::thumbLoadStoreSP },
+	{ T_LDR_SP  , "LDR"  , 2, 0xF800, 0x9800, "Load word (SP-relative)", &ARM7TDMI::thumbLoadStoreSP },
+	{ T_ADD_PC  , "ADD"  , 2, 0xF800, 0xA000, "Load address (Rd = PC + #)", &ARM7TDMI::thumbLoadAddress },
+	{ T_ADD_SP  , "ADD"  , 2, 0xF800, 0xA800, "Load address (Rd = SP + #)", &ARM7TDMI::thumbLoadAddress },
+	{ T_ADJ_SP  , "ADD"  , 1, 0xFF00, 0xB000, "Add offset to stack pointer", &ARM7TDMI::thumbAdjustSP },
+	{ T_PUSH    , "PUSH" , 1, 0xFE00, 0xB400, "Push registers (and LR)", &ARM7TDMI::thumbPushPop },
+	{ T_POP     , "POP"  , 1, 0xFE00, 0xBC00, "Pop registers (and PC)", &ARM7TDMI::thumbPushPop },
+	{ T_STMIA   , "STMIA", 2, 0xF800, 0xC000, "Store multiple (increment after)", &ARM7TDMI::thumbLoadStoreMultiple },
+	{ T_LDMIA   , "LDMIA", 2, 0xF800, 0xC800, "Load multiple (increment after)", &ARM7TDMI::thumbLoadStoreMultiple },
+
+	{ T_SWI     , "SWI"  , 1, 0xFF00, 0xDF00, "Software Interrupt", &ARM7TDMI::thumbSoftwareInterrupt },
+	{ T_BCOND   , "B"    , 1, 0xF000, 0xD000, "Conditional branch", &ARM7TDMI::thumbBranchCond },
+	{ T_B       , "B"    , 1, 0xF800, 0xE000, "Branch", &ARM7TDMI::thumbBranch },
+	{ T_BL_HI   , "BL"   , 1, 0xF800, 0xF000, "Branch with Link (high offset)", &ARM7TDMI::thumbBranchLink },
+	{ T_BL_LO   , "BL"   , 1, 0xF800, 0xF800, "Branch with Link (low offset)", &ARM7TDMI::thumbBranchLink },
+};
+
+// Generated at compile time from THUMB_ISA
+using THUMBDecodeTable = DecodeTable<ARMHandler, THUMB_ISA, THUMB_DECODE_SIZE, THUMB_DECODE_MASK, thumbDecodeBits, &ARM7TDMI::undefined>;
+
+const DecodeEntry<ARMHandler>& ARM7TDMI::decodeTHUMB(const unsigned int op)
+{
+	return THUMBDecodeTable::find(thumbDecodeIndex(op), op);
+}
+
+unsigned int ARM7TDMI::thumbDecodeCompares(const unsigned int op)
+{
+	return THUMBDecodeTable::compares(thumbDecodeIndex(op), op);
+}
+
+std::string ARM7TDMI::identify(unsigned short op)
+{
+	const InstructionSpec<ARMHandler>* in = THUMBDecodeTable::find(thumbDecodeIndex(op), op).instr;
+	if (in)
+	{
+		std::string str = " [";
+		str += in->mnemonic;
+		str += " - ";
+		str += in->description;
+		str += "]";
+		return str;
+	}
+
+	return " [UNKNOWN INSTRUCTION]";
+}
+
+void ARM7TDMI::execute(unsigned short op)
+{
+	(this->*THUMBDecodeTable::find(thumbDecodeIndex(op), op).handler)(op);
+}
+
+// LSL, LSR, ASR Rd, Rs, #Offset5
+void ARM7TDMI::thumbShift(const unsigned int op)
+{
+	const unsigned int offset = (op >> 6) & 0x1F;
+	const unsigned int value = r[(op >> 3) & 0x7];
+	unsigned int& Rd = r[op & 0x7];
+
+	switch ((op >> 11) & 0x3)
+	{
+	case 0: Rd = shiftLSL(value, offset); break;
+	case 1: Rd = shiftLSR(value, offset ? offset : 32); break;
+	case 2: Rd = shiftASR(value, offset ? offset : 32); break;
+	}
+
+	setNZ(Rd);
+}
+
+// ADD, SUB Rd, Rs, Rn / #Offset3
+void ARM7TDMI::thumbAddSub(const unsigned int op)
+{
+	const unsigned int operand = op & 0x0400 ? (op >> 6) & 0x7 : r[(op >> 6) & 0x7];
+	const unsigned int value = r[(op >> 3) & 0x7];
+	r[op & 0x7] = op & 0x0200 ? subFlags(value, operand) : addFlags(value, operand, 0);
+}
+
+// MOV, CMP, ADD, SUB Rd, #Offset8
+void ARM7TDMI::thumbImmediate(const unsigned int op)
+{
+	const unsigned int offset = op & 0xFF;
+	unsigned int& Rd = r[(op >> 8) & 0x7];
+
+	switch ((op >> 11) & 0x3)
+	{
+	case 0: Rd = offset; setNZ(Rd); break;
+	case 1: subFlags(Rd, offset); break;
+	case 2: Rd = addFlags(Rd, offset, 0); break;
+	case 3: Rd = subFlags(Rd, offset); break;
+	}
+}
+
+// Data processing between low registers
+void ARM7TDMI::thumbALU(const unsigned int op)
+{
+	const unsigned int Rs = r[(op >> 3) & 0x7];
+	unsigned int& Rd = r[op & 0x7];
+
+	switch ((op >> 6) & 0xF)
+	{
+	case 0x0: Rd &= Rs; setNZ(Rd); return;
+	case 0x1: Rd ^= Rs; setNZ(Rd); return;
+	case 0x2: Rd = shiftLSL(Rd, Rs & 0xFF); setNZ(Rd); return;
+	case 0x3: Rd = shiftLSR(Rd, Rs & 0xFF); setNZ(Rd); return;
+	case 0x4: Rd = shiftASR(Rd, Rs & 0xFF); setNZ(Rd); return;
+	case 0x5: Rd = addFlags(Rd, Rs, carry()); return;
+	case 0x6: Rd = subFlags(Rd, Rs, carry()); return;
+	case 0x7: Rd = shiftROR(Rd, Rs & 0xFF); setNZ(Rd); return;
+	case 0x8: setNZ(Rd & Rs); return;
+	case 0x9: Rd = subFlags(0, Rs); return;
+	case 0xA: subFlags(Rd, Rs); return;
+	case 0xB: addFlags(Rd, Rs, 0); return;
+	case 0xC: Rd |= Rs; setNZ(Rd); return;
+	case 0xD: Rd *= Rs; setNZ(Rd); return;
+	case 0xE: Rd &= ~Rs; setNZ(Rd); return;
+	case 0xF: Rd = ~Rs; setNZ(Rd); return;
+	}
+}
+
+// ADD, CMP, MOV and BX with access to the high registers (R8-R15)
+void ARM7TDMI::thumbHiRegister(const unsigned int op)
+{
+	const unsigned int rd = (op & 0x7) | ((op >> 4) & 0x8);
+	const unsigned int Rs = r[(op >> 3) & 0xF];
+
+	switch ((op >> 8) & 0x3)
+	{
+	case 0:
+		if (rd == 15) jump((r[15] + Rs) & 0xFFFFFFFE);
+		else r[rd] += Rs;
+		return;
+	case 1: subFlags(r[rd], Rs); return;
+	case 2:
+		if (rd == 15) jump(Rs & 0xFFFFFFFE);
+		else r[rd] = Rs;
+		return;
+	case 3:
+		setThumb(Rs & 0x1);
+		jump(Rs & (isThumb() ? 0xFFFFFFFE : 0xFFFFFFFC));
+		return;
+	}
+}
+
+// LDR Rd, [PC, #Imm]
+void ARM7TDMI::thumbLoadPC(const unsigned int op)
+{
+	r[(op >> 8) & 0x7] = read32((r[15] & 0xFFFFFFFC) + ((op & 0xFF) << 2));
+}
+
+// LDR, LDRB, STR, STRB Rd, [Rb, Ro]
+void ARM7TDMI::thumbLoadStoreReg(const unsigned int op)
+{
+	const unsigned int address = r[(op >> 3) & 0x7] + r[(op >> 6) & 0x7];
+	unsigned int& Rd = r[op & 0x7];
+
+	switch ((op >> 10) & 0x3)
+	{
+	case 0: write32(address, Rd); return;
+	case 1: write8(address, Rd); return;
+	case 2: Rd = read32(address); return;
+	case 3: Rd = read8(address); return;
+	}
+}
+
+// STRH, LDSB, LDRH, LDSH Rd, [Rb, Ro]
+void ARM7TDMI::thumbLoadStoreSigned(const unsigned int op)
+{
+	const unsigned int address = r[(op >> 3) & 0x7] + r[(op >> 6) & 0x7];
+	unsigned int& Rd = r[op & 0x7];
+
+	// Unaligned LDRH is rotated, unaligned LDRSH loads a signed byte
+	switch ((op >> 10) & 0x3)
+	{
+	case 0: write16(address, Rd); return;
+	case 1: Rd = (int)(signed char)read8(address); return;
+	case 2: Rd = read16(address); return;
+	case 3: Rd = address & 1 ? (int)(signed char)read8(address) : (int)(short)read16(address); return;
+	}
+}
+
+// LDR, LDRB, STR, STRB Rd, [Rb, #Imm]
+void ARM7TDMI::thumbLoadStoreImm(const unsigned int op)
+{
+	const unsigned int offset = (op >> 6) & 0x1F;
+	const unsigned int base = r[(op >> 3) & 0x7];
+	unsigned int& Rd = r[op & 0x7];
+
+	switch ((op >> 11) & 0x3)
+	{
+	case 0: write32(base + (offset << 2), Rd); return;
+	case 1: Rd = read32(base + (offset << 2)); return;
+	case 2: write8(base + offset, Rd); return;
+	case 3: Rd = read8(base + offset); return;
+	}
+}
+
+// LDRH, STRH Rd, [Rb, #Imm]
+void ARM7TDMI::thumbLoadStoreHalf(const unsigned int op)
+{
+	const unsigned int address = r[(op >> 3) & 0x7] + (((op >> 6) & 0x1F) << 1);
+	unsigned int& Rd = r[op & 0x7];
+
+	if (op & 0x0800) Rd = read16(address);
+	else write16(address, Rd);
+}
+
+// LDR, STR Rd, [SP, #Imm]
+void ARM7TDMI::thumbLoadStoreSP(const unsigned int op)
+{
+	const unsigned int address = r[13] + ((op & 0xFF) << 2);
+	unsigned int& Rd = r[(op >> 8) & 0x7];
+
+	if (op & 0x0800) Rd = read32(address);
+	else write32(address, Rd);
+}
+
+// ADD Rd, PC / SP, #Imm
+void ARM7TDMI::thumbLoadAddress(const unsigned int op)
+{
+	const unsigned int base = op & 0x0800 ? r[13] : r[15] & 0xFFFFFFFC;
+	r[(op >> 8) & 0x7] = base + ((op & 0xFF) << 2);
+}
+
+// ADD SP, #+/-Imm
+void ARM7TDMI::thumbAdjustSP(const unsigned int op)
+{
+	const unsigned int offset = (op & 0x7F) << 2;
+	if (op & 0x80) r[13] -= offset;
+	else r[13] += offset;
+}
+
+// PUSH {Rlist, LR} / POP {Rlist, PC}
+void ARM7TDMI::thumbPushPop(const unsigned int op)
+{
+	if (!(op & 0x1FF)) return; // Empty lists are unpredictable
+
+	// Registers are transferred in ascending order, LR / PC last
+	unsigned int values[9];
+	unsigned int count = 0;
+
+	if (op & 0x0800)
+	{
+		count = std::popcount(op & 0x1FF);
+		readWords(r[13], values, count);
+		r[13] += count << 2;
+
+		unsigned int k = 0;
+		for (unsigned int list = op & 0xFF; list; list &= list - 1)
+			r[std::countr_zero(list)] = values[k++];
+
+		if (op & 0x0100) jump(values[k] & 0xFFFFFFFE);
+	}
+	else
+	{
+		for (unsigned int list = op & 0xFF; list; list &= list - 1)
+			values[count++] = r[std::countr_zero(list)];
+		if (op & 0x0100) values[count++] = r[14];
+
+		r[13] -= count << 2;
+		writeWords(r[13], values, count);
+	}
+}
+
+// LDMIA, STMIA Rb!, {Rlist}
+void ARM7TDMI::thumbLoadStoreMultiple(const unsigned int op)
+{
+	const unsigned int rb = (op >> 8) & 0x7;
+	const unsigned int address = r[rb];
+
+	// An empty list transfers the PC and adds 0x40 to the base
+	if ((op & 0xFF) == 0)
+	{
+		if (op & 0x0800) jump(read32(address) & 0xFFFFFFFE);
+		else write32(address, r[15] + 2);
+		r[rb] += 0x40;
+		return;
+	}
+
+	unsigned int values[8];
+	unsigned int count = 0;
+
+	if (op & 0x0800)
+	{
+		count = std::popcount(op & 0xFF);
+		readWords(address, values, count);
+
+		unsigned int k = 0;
+		for (unsigned int list = op & 0xFF; list; list &= list - 1)
+			r[std::countr_zero(list)] = values[k++];
+
+		// Base is not written back if it was loaded
+		if (!(op & (1 << rb))) r[rb] = address + (count << 2);
+	}
+	else
+	{
+		for (unsigned int list = op & 0xFF; list; list &= list - 1)
+			values[count++] = r[std::countr_zero(list)];
+
+		writeWords(address, values, count);
+		r[rb] = address + (count << 2);
+	}
+}
+
+// SWI Value8
+void ARM7TDMI::thumbSoftwareInterrupt(const unsigned int)
+{
+	enterException(MODE_SUPERVISOR, VECTOR_SWI, r[15] - 2);
+}
+
+// B{cond} Label
+void ARM7TDMI::thumbBranchCond(const unsigned int op)
+{
+	if (condition((op >> 8) & 0xF))
+		jump(r[15] + ((int)(op << 24) >> 23));
+}
+
+// B Label
+void ARM7TDMI::thumbBranch(const unsigned int op)
+{
+	jump(r[15] + ((int)(op << 21) >> 20));
+}
+
+// BL Label (executed as two consecutive instructions)
+void ARM7TDMI::thumbBranchLink(const unsigned int op)
+{
+	if (op & 0x0800)
+	{
+		const unsigned int next = r[15] - 2;
+		jump(r[14] + ((op & 0x7FF) << 1));
+		r[14] = next | 1;
+	}
+	else
+		r[14] = r[15] + ((int)(op << 21) >> 9);
+}
+
+// Instructions that can write to the PC
+bool ARM7TDMI::thumbEndsBlock(const unsigned int op)
+{
+	if ((op & 0xF000) == 0xD000) return true; // B{cond}, SWI
+	if ((op & 0xF800) == 0xE000) return true; // B
+	if ((op & 0xF800) == 0xF800) return true; // BL (low offset)
+	if ((op & 0xFF00) == 0xBD00) return true; // POP with PC
+	if ((op & 0xFF00) == 0x4700) return true; // BX
+	if ((op & 0xFC87) == 0x4487) return true; // ADD, CMP, MOV with PC
+	return false;
+}
+
+// Registers and flags read and written by an instruction, returns false if it stores, branches or changes the mode
+static bool thumbAccesses(const unsigned int op, unsigned int& reads, unsigned int& writes)
+{
+	const unsigned int rd = op & 0x7;
+	const unsigned int rs = (op >> 3) & 0x7;
+
+	if ((op & 0xF800) == 0x1800) // ADD, SUB Rd, Rs, Rn / #Offset3
+	{
+		reads = (1 << rs) | (op & 0x0400 ? 0 : 1 << ((op >> 6) & 0x7));
+		writes = (1 << rd) | ACCESS_NZCV;
+		return true;
+	}
+
+	if ((op & 0xE000) == 0x0000) // LSL, LSR, ASR Rd, Rs, #Offset5 (LSL #0 keeps C)
+	{
+		reads = 1 << rs;
+		writes = (1 << rd) | ACCESS_NZ | (op & 0x1FC0 ? ACCESS_C : 0);
+		return true;
+	}
+
+	if ((op & 0xE000) == 0x2000) // MOV, CMP, ADD, SUB Rd, #Offset8
+	{
+		const unsigned int r = 1 << ((op >> 8) & 0x7);
+		const unsigned int alu = (op >> 11) & 0x3;
+		reads = alu == 0 ? 0 : r;
+		writes = (alu == 1 ? 0 : r) | (alu == 0 ? ACCESS_NZ : ACCESS_NZCV);
+		return true;
+	}
+
+	if ((op & 0xFC00) == 0x4000) // Data processing between low registers
+	{
+		const unsigned int alu = (op >> 6) & 0xF;
+		reads = (1 << rs) | (alu == 0x9 || alu == 0xF ? 0 : 1 << rd);
+		writes = (alu == 0x8 || alu == 0xA || alu == 0xB ? 0 : 1 << rd) | ACCESS_NZ;
+
+		if (alu == 0x5 || alu == 0x6) reads |= ACCESS_C;
+		if (alu == 0x5 || alu == 0x6 || (alu >= 0x9 && alu <= 0xB)) writes |= ACCESS_C | ACCESS_V;
+
+		// Shifts by a register keep C if the amount is zero
+		if (alu == 0x2 || alu == 0x3 || alu == 0x4 || alu == 0x7)
+		{
+			reads |= ACCESS_C;
+			writes |= ACCESS_C;
+		}
+		return true;
+	}
+
+	if ((op & 0xFC00) == 0x4400) // ADD, CMP, MOV with the high registers (writes to the PC branch)
+	{
+		const unsigned int hd = (op & 0x7) | ((op >> 4) & 0x8);
+		const unsigned int alu = (op >> 8) & 0x3;
+		if (alu == 3 || (alu != 1 && hd == 15)) return false;
+
+		reads = (1 << ((op >> 3) & 0xF)) | (alu == 2 ? 0 : 1 << hd);
+		writes = alu == 1 ? ACCESS_NZCV : 1 << hd;
+		return true;
+	}
+
+	if ((op & 0xF800) == 0x4800) // LDR Rd, [PC, #Imm]
+	{
+		reads = 1 << 15;
+		writes = 1 << ((op >> 8) & 0x7);
+		return true;
+	}
+
+	if ((op & 0xF000) == 0x5000) // Register offset (STR, STRH and STRB are stores)
+	{
+		reads = (1 << rs) | (1 << ((op >> 6) & 0x7));
+		writes = 1 << rd;
+		return ((op >> 9) & 0x7) >= 3;
+	}
+
+	if ((op & 0xE000) == 0x6000 || (op & 0xF000) == 0x8000) // Immediate offset
+	{
+		reads = 1 << rs;
+		writes = 1 << rd;
+		return (op & 0x0800) != 0;
+	}
+
+	if ((op & 0xF000) == 0x9000) // SP-relative
+	{
+		reads = 1 << 13;
+		writes = 1 << ((op >> 8) & 0x7);
+		return (op & 0x0800) != 0;
+	}
+
+	if ((op & 0xF000) == 0xA000) // ADD Rd, PC / SP, #Imm
+	{
+		reads = op & 0x0800 ? 1 << 13 : 1 << 15;
+		writes = 1 << ((op >> 8) & 0x7);
+		return true;
+	}
+
+	return false;
+}
+
+// Loops that branch to their first instruction and compute the same values from the same memory on every
+// iteration (polling VCOUNT, DISPSTAT or a variable set by an interrupt) can only exit after an event
+bool ARM7TDMI::thumbIdleLoop(const ARMBlock& block)
+{
+	const unsigned int last = block.ops.back().op;
+	const unsigned int pc = block.address + block.size - 2;
+	unsigned int live = 0;
+
+	if ((last & 0xF000) == 0xD000 && ((last >> 8) & 0xF) < 0xE) // B{cond}
+	{
+		if (pc + 4 + ((int)(last << 24) >> 23) != block.address) return false;
+		live = ACCESS_NZCV;
+	}
+	else if ((last & 0xF800) == 0xE000) // B
+	{
+		if (pc + 4 + ((int)(last << 21) >> 20) != block.address) return false;
+	}
+	else
+		return false;
+
+	// Registers read before they are written must not be written later in the iteration
+	unsigned int read = 0, written = 0;
+	for (size_t i = 0; i + 1 < block.ops.size(); i++)
+	{
+		unsigned int reads, writes;
+		if (!thumbAccesses(block.ops[i].op, reads, writes)) return false;
+		read |= reads & ~written;
+		written |= writes;
+	}
+	read |= live & ~written;
+
+	return !(read & written);
+}
+
+// Approximate cycle cost (S + N + I cycles without wait states)
+unsigned char ARM7TDMI::thumbCycles(const unsigned int op)
+{
+	if ((op & 0xF000) == 0xD000) return 3; // B{cond}, SWI
+	if ((op & 0xF800) == 0xE000) return 3; // B
+	if ((op & 0xF800) == 0xF800) return 3; // BL (low offset)
+	if ((op & 0xFF00) == 0x4700) return 3; // BX
+	if ((op & 0xFC87) == 0x4487) return 3; // ADD, MOV with PC
+	if ((op & 0xFFC0) == 0x4340) return 2; // MUL
+	if ((op & 0xF800) == 0x4800) return 3; // LDR PC-relative
+
+	if ((op & 0xF600) == 0xB400 || (op & 0xF000) == 0xC000) // PUSH, POP, STMIA, LDMIA
+	{
+		unsigned char n = (op & 0xF000) == 0xB000 && (op & 0x0100) ? 1 : 0; // LR, PC
+		for (unsigned int list = op & 0xFF; list; list &= list - 1) n++;
+		if ((op & 0xFF00) == 0xBD00) return n + 4; // POP with PC
+		return n + (op & 0x0800 ? 2 : 1);
+	}
+
+	if ((op & 0xF000) == 0x5000) // Register offset
+		return (op & 0x0800) || (op & 0x0E00) == 0x0600 ? 3 : 2;
+	if ((op & 0xE000) == 0x6000 || (op & 0xF000) == 0x8000 || (op & 0xF000) == 0x9000) // Immediate offset
+		return op & 0x0800 ? 3 : 2;
+
+	return 1;
+}
+
+void ARM7TDMI::loadThumbInstructionSet()
+{
+	InstructionSet* set = new InstructionSet("THUMB", 0xFFFF, 0x0000);
+
+	addInstructions(*set, THUMB_ISA);
+	thumb_instructions = set;
+}
@@ -0,0 +1,95 @@
+#include "Trace.h"
+#include "ARM7.h"
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+unsigned long long TraceBuffer::flush(std::ostream& out)
+{
+	const unsigned long long t = tail.load(std::memory_order_relaxed);
+	const unsigned long long h = head.load(std::memory_order_acquire);
+	const unsigned long long size = mask + 1;
+
+	// The pending records are at most two contiguous ranges of the ring
+	const unsigned long long n = h - t;
+	const unsigned long long start = t & mask;
+	const unsigned long long first = std::min(n, size - start);
+	out.write((const char*)&records[start], first * sizeof(TraceRecord));
+	out.write((const char*)&records[0], (n - first) * sizeof(TraceRecord));
+
+	tail.store(h, std::memory_order_release);
+	return n;
+}
+
+TraceWriter::TraceWriter(TraceBuffer& b, const char* path) : buffer(b), file(path, std::ios::binary), running(true)
+{
+	TraceHeader header;
+	std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(TraceRecord);
+	file.write((const char*)&header, sizeof(header));
+
+	buffer.setBlocking(true);
+	thread = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+	running = false;
+	thread.join();
+	buffer.setBlocking(false);
+	buffer.flush(file);
+}
+
+void TraceWriter::drain()
+{
+	while (running)
+		if (buffer.flush(file) == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+bool decodeTrace(const char* path, ARM7TDMI& cpu, std::ostream& out)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	TraceHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord))
+	{
+		std::cout << "Error: " << path << " is not a trace file!" << std::endl;
+		return false;
+	}
+
+	char buffer[arc::HEX_BUFFER_SIZE];
+	std::vector<TraceRecord> records(4096);
+
+	while (file)
+	{
+		file.read((char*)records.data(), records.size() * sizeof(TraceRecord));
+		const size_t n = (size_t)file.gcount() / sizeof(TraceRecord);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			const TraceRecord& rec = records[i];
+			const bool thumb = rec.pc & 1;
+
+			out << std::dec << rec.cycle << "\t" << arc::toHex(buffer, rec.pc & ~1, 32) << "\t";
+			out << arc::toHex(buffer, rec.op, thumb ? 16 : 32) << (thumb ? cpu.identify((unsigned short)rec.op) : cpu.identify(rec.op));
+
+			// Only the values of the two lowest registers are recorded
+			unsigned int shown = 0;
+			for (unsigned int r = 0; r < 16; r++)
+			{
+				if (!(rec.changed & (1 << r))) continue;
+				out << " R" << std::dec << r;
+				if (shown < 2) out << "=" << arc::toHex(buffer, rec.values[shown], 32);
+				shown++;
+			}
+
+			out << " CPSR=" << arc::toHex(buffer, rec.cpsr, 32) << "\n";
+		}
+	}
+
+	out.flush();
+	return true;
+}
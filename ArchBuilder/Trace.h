@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <fstream>
+
+// Executed instruction (written to trace files as is)
+struct TraceRecord
+{
+	unsigned long long cycle;	// Cycle counter before the instruction
+	unsigned int pc;			// Address of the instruction (bit 0 is set in THUMB state)
+	unsigned int op;			// Opcode
+	unsigned int cpsr;			// CPSR after the instruction
+	unsigned short changed;		// Registers written by the instruction (bit n = Rn)
+	unsigned short reserved;
+	unsigned int values[2];		// New values of the two lowest written registers
+};
+
+static_assert(sizeof(TraceRecord) == 32, "trace records must stay 32 bytes");
+
+// Header of a trace file, followed by the records
+struct TraceHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int record_size;
+};
+
+constexpr char TRACE_MAGIC[8] = { 'A', 'R', 'C', 'T', 'R', 'A', 'C', 'E' };
+constexpr unsigned int TRACE_VERSION = 1;
+
+/**
+ * @brief Lock-free single producer, single consumer ring of trace records.
+ * The processor pushes records, another thread (or the processor between runs) drains them.
+*/
+class TraceBuffer
+{
+private:
+	std::vector<TraceRecord> records;
+	const unsigned long long mask;
+	alignas(64) std::atomic<unsigned long long> head;	// Next record written by the producer
+	alignas(64) std::atomic<unsigned long long> tail;	// Next record read by the consumer
+	std::atomic<unsigned long long> dropped;
+	std::atomic<bool> blocking;							// A consumer is draining the ring
+
+public:
+	/**
+	 * @brief Creates an empty ring
+	 * @param log2_size - log2 of the number of records
+	*/
+	TraceBuffer(const unsigned int log2_size = 16)
+		: records(1ULL << log2_size), mask((1ULL << log2_size) - 1), head(0), tail(0), dropped(0), blocking(false) {}
+
+	/**
+	 * @brief Adds a record, waits for the consumer if the ring is full and being drained
+	 * @param record - executed instruction
+	*/
+	inline void push(const TraceRecord& record)
+	{
+		const unsigned long long h = head.load(std::memory_order_relaxed);
+
+		while (h - tail.load(std::memory_order_acquire) > mask)
+		{
+			if (!blocking.load(std::memory_order_relaxed))
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			std::this_thread::yield();
+		}
+
+		records[h & mask] = record;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Removes every pending record (consumer side)
+	 * @param out - stream the records are written to
+	 * @return number of records written
+	*/
+	unsigned long long flush(std::ostream& out);
+
+	void setBlocking(const bool b) { blocking.store(b); }
+	unsigned long long pending() const { return head.load() - tail.load(); }
+	unsigned long long getDropped() const { return dropped.load(); }
+};
+
+/**
+ * @brief Drains a trace buffer to a file on a background thread
+*/
+class TraceWriter
+{
+private:
+	TraceBuffer& buffer;
+	std::ofstream file;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void drain();
+
+public:
+	TraceWriter(TraceBuffer& b, const char* path);
+	~TraceWriter();
+
+	bool isOpen() const { return file.is_open(); }
+};
+
+class ARM7TDMI;
+
+/**
+ * @brief Disassembles a trace file
+ * @param path - trace file
+ * @param cpu - processor used to identify the opcodes
+ * @param out - output text stream
+ * @return false if the file is not a trace
+*/
+bool decodeTrace(const char* path, ARM7TDMI& cpu, std::ostream& out);
+
+#endif
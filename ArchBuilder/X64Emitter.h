@@ -0,0 +1,191 @@
+#pragma once
+
+#ifndef X64_EMITTER_H
+#define X64_EMITTER_H
+
+#include <vector>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ARC_X64
+#endif
+
+namespace x64
+{
+	enum Reg : unsigned char {
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+
+	enum Cond : unsigned char {
+		CC_O = 0x0, CC_NO = 0x1, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+		CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+	};
+
+#ifdef _WIN32
+	constexpr Reg ARG0 = RCX;
+	constexpr Reg ARG1 = RDX;
+#else
+	constexpr Reg ARG0 = RDI;
+	constexpr Reg ARG1 = RSI;
+#endif
+
+	/**
+	 * @brief Encodes x86-64 instructions into a position independent buffer.
+	 * Only 32-bit integer operations are supported, calls use absolute addresses.
+	*/
+	class Emitter
+	{
+	private:
+		std::vector<unsigned char> code;
+
+		inline void byte(const unsigned char b) { code.push_back(b); }
+
+		inline void dword(const unsigned int d)
+		{
+			for (unsigned int i = 0; i < 4; i++) byte((d >> (i << 3)) & 0xFF);
+		}
+
+		inline void qword(const unsigned long long q)
+		{
+			for (unsigned int i = 0; i < 8; i++) byte((q >> (i << 3)) & 0xFF);
+		}
+
+		inline void rex(const bool w, const unsigned char reg, const unsigned char rm, const bool force = false)
+		{
+			const unsigned char prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+			if (prefix != 0x40 || force) byte(prefix);
+		}
+
+		inline void modrm(const unsigned char mod, const unsigned char reg, const unsigned char rm)
+		{
+			byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+		}
+
+		// op r/m32, r32
+		inline void rr(const unsigned char opcode, const Reg rm, const Reg reg)
+		{
+			rex(false, reg, rm);
+			byte(opcode);
+			modrm(3, reg, rm);
+		}
+
+		// op r/m32, imm32
+		inline void ri(const unsigned char ext, const Reg rm, const unsigned int imm)
+		{
+			rex(false, 0, rm);
+			byte(0x81);
+			modrm(3, ext, rm);
+			dword(imm);
+		}
+
+		// op r32, [base + disp32] (base cannot be RSP or R12)
+		inline void mem(const unsigned char opcode, const unsigned char reg, const Reg base, const int disp, const bool force = false)
+		{
+			rex(false, reg, base, force);
+			byte(opcode);
+			modrm(2, reg, base);
+			dword((unsigned int)disp);
+		}
+
+	public:
+		const std::vector<unsigned char>& getCode() const { return code; }
+		unsigned int size() const { return (unsigned int)code.size(); }
+		void clear() { code.clear(); }
+
+		void mov(const Reg dst, const Reg src) { rr(0x89, dst, src); }
+		void add(const Reg dst, const Reg src) { rr(0x01, dst, src); }
+		void sub(const Reg dst, const Reg src) { rr(0x29, dst, src); }
+		void and_(const Reg dst, const Reg src) { rr(0x21, dst, src); }
+		void or_(const Reg dst, const Reg src) { rr(0x09, dst, src); }
+		void xor_(const Reg dst, const Reg src) { rr(0x31, dst, src); }
+		void cmp(const Reg dst, const Reg src) { rr(0x39, dst, src); }
+		void test(const Reg dst, const Reg src) { rr(0x85, dst, src); }
+
+		void add(const Reg dst, const unsigned int imm) { ri(0, dst, imm); }
+		void and_(const Reg dst, const unsigned int imm) { ri(4, dst, imm); }
+		void sub(const Reg dst, const unsigned int imm) { ri(5, dst, imm); }
+		void cmp(const Reg dst, const unsigned int imm) { ri(7, dst, imm); }
+
+		void not_(const Reg r) { rex(false, 0, r); byte(0xF7); modrm(3, 2, r); }
+		void shl(const Reg r, const unsigned char n) { rex(false, 0, r); byte(0xC1); modrm(3, 4, r); byte(n); }
+		void shr(const Reg r, const unsigned char n) { rex(false, 0, r); byte(0xC1); modrm(3, 5, r); byte(n); }
+		void sar(const Reg r, const unsigned char n) { rex(false, 0, r); byte(0xC1); modrm(3, 7, r); byte(n); }
+		void imul(const Reg dst, const Reg src) { rex(false, dst, src); byte(0x0F); byte(0xAF); modrm(3, dst, src); }
+
+		void mov(const Reg dst, const unsigned int imm) { rex(false, 0, dst); byte(0xB8 + (dst & 7)); dword(imm); }
+		void mov64(const Reg dst, const unsigned long long imm) { rex(true, 0, dst); byte(0xB8 + (dst & 7)); qword(imm); }
+
+		void load(const Reg dst, const Reg base, const int disp) { mem(0x8B, dst, base, disp); }
+		void store(const Reg base, const int disp, const Reg src) { mem(0x89, src, base, disp); }
+		void store8(const Reg base, const int disp, const Reg src) { mem(0x88, src, base, disp, true); }
+		void storeImm(const Reg base, const int disp, const unsigned int imm) { mem(0xC7, 0, base, disp); dword(imm); }
+
+		// lea r32, [base + index] (does not modify flags)
+		void lea(const Reg dst, const Reg base, const Reg index)
+		{
+			const unsigned char prefix = 0x40 | ((dst >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+			if (prefix != 0x40) byte(prefix);
+			byte(0x8D);
+			modrm(1, dst, 4);
+			byte(((index & 7) << 3) | (base & 7));
+			byte(0);
+		}
+
+		// lea r32, [base + disp32] (does not modify flags)
+		void lea(const Reg dst, const Reg base, const int disp) { mem(0x8D, dst, base, disp); }
+
+		void setcc(const Cond cc, const Reg dst) { rex(false, 0, dst, true); byte(0x0F); byte(0x90 + cc); modrm(3, 0, dst); }
+		void test8(const Reg r) { rex(false, r, r, true); byte(0x84); modrm(3, r, r); }
+		void movzx8(const Reg dst, const Reg src) { rex(false, dst, src, true); byte(0x0F); byte(0xB6); modrm(3, dst, src); }
+
+		// add qword [base], imm32
+		void add64(const Reg base, const unsigned int imm) { rex(true, 0, base); byte(0x81); modrm(0, 0, base); dword(imm); }
+
+		void push(const Reg r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+		void pop(const Reg r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+		void subRSP(const unsigned char n) { byte(0x48); byte(0x83); byte(0xEC); byte(n); }
+		void addRSP(const unsigned char n) { byte(0x48); byte(0x83); byte(0xC4); byte(n); }
+		void ret() { byte(0xC3); }
+
+		void call(const void* function)
+		{
+			mov64(RAX, (unsigned long long)function);
+			byte(0xFF);
+			byte(0xD0);
+		}
+
+		// Emits a jump with an unresolved target, returns the label to patch
+		unsigned int jcc(const Cond cc) { byte(0x0F); byte(0x80 + cc); dword(0); return size(); }
+		unsigned int jmp() { byte(0xE9); dword(0); return size(); }
+
+		// Points a jump to the current position
+		void bind(const unsigned int label)
+		{
+			const unsigned int rel = size() - label;
+			std::memcpy(&code[label - 4], &rel, 4);
+		}
+	};
+
+	/**
+	 * @brief Executable memory that compiled code is copied into (never writable and executable at once)
+	*/
+	class CodeArena
+	{
+	private:
+		unsigned char* memory;
+		size_t capacity;
+		size_t used;
+
+	public:
+		CodeArena(const size_t size);
+		~CodeArena();
+
+		// Copies the code into the arena, returns nullptr when the arena is full
+		void* place(const Emitter& emitter);
+
+		void reset() { used = 0; }
+	};
+}
+
+#endif
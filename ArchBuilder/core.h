@@ -4,6 +4,7 @@
 #define ARCH_CORE_H
 
 #include <vector>
+#include <string>
 #include <list>
 #include <iostream>
 #include <fstream>
@@ -33,12 +34,11 @@ namespace arc
 		return product;
 	}
 
-	static char TEMP_ID_BUFFER[5] = "\0\0\0\0";
-
-	inline const char* toString(const u32 id)
+	// Converts a four character code (ex. a RIFF chunk id) into a string
+	inline std::string toString(const u32 id)
 	{
-		memcpy(TEMP_ID_BUFFER, &id, 4);
-		return TEMP_ID_BUFFER;
+		const char* str = (const char*)&id;
+		return std::string(str, strnlen(str, 4));
 	}
 
 	constexpr u32 HEX_BUFFER_SIZE = 20;